@@ -1,5 +1,7 @@
+#include <errno.h>
 #include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <phosg/Filesystem.hh>
@@ -8,9 +10,178 @@
 #include <phosg/Time.hh>
 
 #include "Account.hh"
+#include "Loggers.hh"
 
 using namespace std;
 
+AccountLogStore::AccountLogStore(const string& filename)
+    : filename(filename),
+      f(nullptr, +[](FILE* f) -> void { fclose(f); }) {}
+
+map<uint32_t, phosg::JSON> AccountLogStore::load() {
+  lock_guard g(this->lock);
+
+  this->f.reset();
+  this->live_records.clear();
+  this->file_size = 0;
+  this->live_bytes = 0;
+
+  string data;
+  try {
+    data = phosg::load_file(this->filename);
+  } catch (const phosg::cannot_open_file&) {
+  }
+
+  phosg::StringReader r(data);
+  size_t valid_size = 0;
+  while (!r.eof()) {
+    if (r.remaining() < sizeof(RecordHeader)) {
+      break;
+    }
+    const auto& header = r.get<RecordHeader>();
+    if (header.magic != RECORD_MAGIC) {
+      throw runtime_error(phosg::string_printf(
+          "account log %s is corrupt at offset %zX", this->filename.c_str(), valid_size));
+    }
+    if (r.remaining() < header.data_size) {
+      break;
+    }
+    size_t data_offset = r.where();
+    r.skip(header.data_size);
+    if (phosg::fnv1a32(data.data() + data_offset, header.data_size) != header.data_checksum) {
+      throw runtime_error(phosg::string_printf(
+          "account log %s has an incorrect checksum at offset %zX", this->filename.c_str(), valid_size));
+    }
+
+    auto existing_it = this->live_records.find(header.account_id);
+    if (existing_it != this->live_records.end()) {
+      this->live_bytes -= (existing_it->second.size + sizeof(RecordHeader));
+      this->live_records.erase(existing_it);
+    }
+    if (header.data_size) {
+      this->live_records.emplace(header.account_id, RecordLocation{data_offset, header.data_size});
+      this->live_bytes += (header.data_size + sizeof(RecordHeader));
+    }
+    valid_size = r.where();
+  }
+
+  if (valid_size < data.size()) {
+    config_log.warning("Account log %s ends with an incomplete record; discarding %zu bytes",
+        this->filename.c_str(), data.size() - valid_size);
+    data.resize(valid_size);
+    phosg::save_file(this->filename, data);
+  }
+  this->file_size = valid_size;
+
+  map<uint32_t, phosg::JSON> ret;
+  for (const auto& it : this->live_records) {
+    ret.emplace(it.first, phosg::JSON::parse(data.substr(it.second.offset, it.second.size)));
+  }
+
+  if (this->should_compact_locked()) {
+    this->compact_locked();
+  }
+  return ret;
+}
+
+void AccountLogStore::open_for_append_locked() {
+  if (!this->f) {
+    this->f = phosg::fopen_unique(this->filename, "ab");
+  }
+}
+
+void AccountLogStore::write(uint32_t account_id, const string& data) {
+  lock_guard g(this->lock);
+
+  auto existing_it = this->live_records.find(account_id);
+  if (existing_it != this->live_records.end()) {
+    this->live_bytes -= (existing_it->second.size + sizeof(RecordHeader));
+    this->live_records.erase(existing_it);
+  } else if (data.empty()) {
+    return; // Account isn't in the log; no need to write a tombstone
+  }
+
+  RecordHeader header;
+  header.magic = RECORD_MAGIC;
+  header.account_id = account_id;
+  header.data_size = data.size();
+  header.data_checksum = phosg::fnv1a32(data);
+
+  this->open_for_append_locked();
+  phosg::fwritex(this->f.get(), &header, sizeof(header));
+  phosg::fwritex(this->f.get(), data);
+  fflush(this->f.get());
+
+  if (!data.empty()) {
+    this->live_records.emplace(account_id, RecordLocation{this->file_size + sizeof(RecordHeader), data.size()});
+    this->live_bytes += (data.size() + sizeof(RecordHeader));
+  }
+  this->file_size += (data.size() + sizeof(RecordHeader));
+
+  if (this->should_compact_locked()) {
+    this->compact_locked();
+  }
+}
+
+bool AccountLogStore::should_compact_locked() const {
+  size_t garbage_bytes = this->file_size - this->live_bytes;
+  return (garbage_bytes >= MIN_GARBAGE_BYTES_FOR_COMPACTION) && (garbage_bytes > this->live_bytes);
+}
+
+void AccountLogStore::compact() {
+  lock_guard g(this->lock);
+  this->compact_locked();
+}
+
+void AccountLogStore::compact_locked() {
+  this->f.reset();
+  string src_data;
+  try {
+    src_data = phosg::load_file(this->filename);
+  } catch (const phosg::cannot_open_file&) {
+  }
+
+  // Write the records in account ID order so that the compacted log is
+  // deterministic
+  map<uint32_t, RecordLocation> sorted_records(this->live_records.begin(), this->live_records.end());
+
+  phosg::StringWriter w;
+  unordered_map<uint32_t, RecordLocation> new_live_records;
+  for (const auto& it : sorted_records) {
+    if (it.second.offset + it.second.size > src_data.size()) {
+      throw logic_error("live account record is beyond the end of the log");
+    }
+    RecordHeader header;
+    header.magic = RECORD_MAGIC;
+    header.account_id = it.first;
+    header.data_size = it.second.size;
+    header.data_checksum = phosg::fnv1a32(src_data.data() + it.second.offset, it.second.size);
+    w.put(header);
+    new_live_records.emplace(it.first, RecordLocation{w.size(), it.second.size});
+    w.write(src_data.data() + it.second.offset, it.second.size);
+  }
+
+  // Write to a temporary file and rename it over the original, so that if the
+  // server crashes during compaction, the original log is still intact
+  string temp_filename = this->filename + ".tmp";
+  phosg::save_file(temp_filename, w.str());
+  if (::rename(temp_filename.c_str(), this->filename.c_str()) != 0) {
+    throw runtime_error(phosg::string_printf(
+        "cannot replace account log %s: %s", this->filename.c_str(), phosg::string_for_error(errno).c_str()));
+  }
+
+  config_log.info("Compacted account log %s from %zu to %zu bytes (%zu accounts)",
+      this->filename.c_str(), this->file_size, w.size(), new_live_records.size());
+  this->live_records = std::move(new_live_records);
+  this->file_size = w.size();
+  this->live_bytes = w.size();
+}
+
+size_t AccountLogStore::live_record_count() const {
+  lock_guard g(this->lock);
+  return this->live_records.size();
+}
+
 shared_ptr<DCNTELicense> DCNTELicense::from_json(const phosg::JSON& json) {
   auto ret = make_shared<DCNTELicense>();
   ret->serial_number = json.get_string("SerialNumber");
@@ -386,7 +557,12 @@ void Account::print(FILE* stream) const {
 }
 
 void Account::save() const {
-  if (!this->is_temporary) {
+  if (this->is_temporary) {
+    return;
+  }
+  if (this->log_store) {
+    this->log_store->write(this->account_id, this->json().serialize());
+  } else {
     auto json = this->json();
     string json_data = json.serialize(phosg::JSON::SerializeOption::FORMAT | phosg::JSON::SerializeOption::HEX_INTEGERS);
     string filename = phosg::string_printf("system/licenses/%010" PRIu32 ".json", this->account_id);
@@ -395,6 +571,10 @@ void Account::save() const {
 }
 
 void Account::delete_file() const {
+  if (this->log_store) {
+    this->log_store->erase(this->account_id);
+    return;
+  }
   string filename = phosg::string_printf("system/licenses/%010" PRIu32 ".json", this->account_id);
   remove(filename.c_str());
 }
@@ -760,6 +940,7 @@ void AccountIndex::add_locked(shared_ptr<Account> a) {
   if (this->force_all_temporary) {
     a->is_temporary = true;
   }
+  a->log_store = this->log_store;
 
   for (const auto& it : a->dc_nte_licenses) {
     if (this->by_dc_nte_serial_number.count(it.second->serial_number)) {
@@ -981,23 +1162,117 @@ shared_ptr<Account> AccountIndex::create_temporary_account_for_shared_account(
   return ret;
 }
 
-AccountIndex::AccountIndex(bool force_all_temporary)
-    : force_all_temporary(force_all_temporary) {
-  if (!this->force_all_temporary) {
-    if (!phosg::isdir("system/licenses")) {
-      mkdir("system/licenses", 0755);
-    } else {
-      for (const auto& item : phosg::list_directory("system/licenses")) {
-        if (phosg::ends_with(item, ".json")) {
-          try {
-            phosg::JSON json = phosg::JSON::parse(phosg::load_file("system/licenses/" + item));
-            this->add(make_shared<Account>(json));
-          } catch (const exception& e) {
-            phosg::log_error("Failed to index account %s", item.c_str());
-            throw;
-          }
+AccountIndex::AccountIndex(bool force_all_temporary, shared_ptr<AccountLogStore> log_store)
+    : force_all_temporary(force_all_temporary),
+      log_store(this->force_all_temporary ? nullptr : log_store) {
+  if (this->force_all_temporary) {
+    return;
+  }
+
+  if (this->log_store) {
+    auto accounts_json = this->log_store->load();
+    if (accounts_json.empty() && phosg::isdir("system/licenses")) {
+      size_t count = this->export_json_files_to_log(this->log_store);
+      if (count) {
+        config_log.info("Imported %zu accounts from system/licenses into %s; the JSON files were not deleted",
+            count, this->log_store->get_filename().c_str());
+        accounts_json = this->log_store->load();
+      }
+    }
+    for (const auto& it : accounts_json) {
+      try {
+        this->add(make_shared<Account>(it.second));
+      } catch (const exception& e) {
+        phosg::log_error("Failed to index account %08" PRIX32 " from account log", it.first);
+        throw;
+      }
+    }
+
+  } else if (!phosg::isdir("system/licenses")) {
+    mkdir("system/licenses", 0755);
+
+  } else {
+    for (const auto& item : phosg::list_directory("system/licenses")) {
+      if (phosg::ends_with(item, ".json")) {
+        try {
+          phosg::JSON json = phosg::JSON::parse(phosg::load_file("system/licenses/" + item));
+          this->add(make_shared<Account>(json));
+        } catch (const exception& e) {
+          phosg::log_error("Failed to index account %s", item.c_str());
+          throw;
         }
       }
     }
   }
 }
+
+void AccountIndex::set_log_store(shared_ptr<AccountLogStore> log_store) {
+  if (this->force_all_temporary) {
+    return;
+  }
+
+  unique_lock g(this->lock);
+  if (log_store == this->log_store) {
+    return;
+  }
+  this->log_store = std::move(log_store);
+
+  if (this->log_store) {
+    for (const auto& it : this->log_store->load()) {
+      if (!this->by_account_id.count(it.first)) {
+        this->log_store->erase(it.first);
+      }
+    }
+  } else if (!phosg::isdir("system/licenses")) {
+    mkdir("system/licenses", 0755);
+  } else {
+    for (const auto& item : phosg::list_directory("system/licenses")) {
+      if (!phosg::ends_with(item, ".json")) {
+        continue;
+      }
+      // Only delete files that Account::save could have written; anything else
+      // was put there by someone else, so leave it alone
+      uint32_t account_id = strtoul(item.c_str(), nullptr, 10);
+      if (phosg::string_printf("%010" PRIu32 ".json", account_id) != item) {
+        config_log.warning("Skipping unrecognized file system/licenses/%s", item.c_str());
+      } else if (!this->by_account_id.count(account_id)) {
+        remove(("system/licenses/" + item).c_str());
+      }
+    }
+  }
+
+  for (const auto& it : this->by_account_id) {
+    it.second->log_store = this->log_store;
+    it.second->save();
+  }
+}
+
+size_t AccountIndex::export_json_files_to_log(shared_ptr<AccountLogStore> log_store) {
+  size_t count = 0;
+  for (const auto& item : phosg::list_directory("system/licenses")) {
+    if (phosg::ends_with(item, ".json")) {
+      try {
+        Account a(phosg::JSON::parse(phosg::load_file("system/licenses/" + item)));
+        log_store->write(a.account_id, a.json().serialize());
+        count++;
+      } catch (const exception& e) {
+        phosg::log_error("Failed to export account %s", item.c_str());
+        throw;
+      }
+    }
+  }
+  return count;
+}
+
+size_t AccountIndex::export_log_to_json_files(shared_ptr<AccountLogStore> log_store) {
+  if (!phosg::isdir("system/licenses")) {
+    mkdir("system/licenses", 0755);
+  }
+  size_t count = 0;
+  for (const auto& it : log_store->load()) {
+    Account a(it.second);
+    a.save();
+    count++;
+  }
+  return count;
+}
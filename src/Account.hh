@@ -1,9 +1,11 @@
 #pragma once
 
+#include <map>
 #include <memory>
 #include <mutex>
 #include <phosg/JSON.hh>
 #include <shared_mutex>
+#include <stdio.h>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -54,6 +56,75 @@ struct BBLicense {
   phosg::JSON json() const;
 };
 
+// Alternative to storing each account in its own JSON file. All accounts live
+// in a single append-only file; each save appends one record containing the
+// account's compact JSON, and deleting an account appends a tombstone record.
+// When records are loaded, later records for the same account ID replace
+// earlier ones. When the superseded records take up more space than the live
+// ones, the file is rewritten with only the live records (this is called
+// compaction, and also happens when the file is loaded). This class is
+// thread-safe, and a single instance is shared by all AccountIndexes that
+// refer to the same file (so reloading accounts doesn't result in two objects
+// appending to the same file independently).
+class AccountLogStore {
+public:
+  explicit AccountLogStore(const std::string& filename);
+  AccountLogStore(const AccountLogStore&) = delete;
+  AccountLogStore(AccountLogStore&&) = delete;
+  AccountLogStore& operator=(const AccountLogStore&) = delete;
+  AccountLogStore& operator=(AccountLogStore&&) = delete;
+  ~AccountLogStore() = default;
+
+  inline const std::string& get_filename() const {
+    return this->filename;
+  }
+
+  // Reads the entire log and returns the latest JSON for each live account,
+  // in account ID order. If the log ends with an incomplete record (e.g. if
+  // the server crashed while writing it), the incomplete record is discarded.
+  std::map<uint32_t, phosg::JSON> load();
+
+  // Appends a record for the given account. If data is empty, the account is
+  // marked as deleted.
+  void write(uint32_t account_id, const std::string& data);
+  inline void erase(uint32_t account_id) {
+    this->write(account_id, "");
+  }
+
+  // Rewrites the log with only the latest record for each live account
+  void compact();
+
+  size_t live_record_count() const;
+
+private:
+  struct RecordHeader {
+    le_uint32_t magic;
+    le_uint32_t account_id;
+    le_uint32_t data_size; // 0 = account was deleted
+    le_uint32_t data_checksum; // fnv1a32 of the data that follows
+  } __packed_ws__(RecordHeader, 0x10);
+  static constexpr uint32_t RECORD_MAGIC = 0x41434354; // 'ACCT'
+  // Compaction is skipped if the log has fewer than this many garbage bytes,
+  // even if all the records are garbage
+  static constexpr size_t MIN_GARBAGE_BYTES_FOR_COMPACTION = 0x100000;
+
+  struct RecordLocation {
+    size_t offset; // Offset of the record's data (not its header)
+    size_t size;
+  };
+
+  std::string filename;
+  mutable std::mutex lock;
+  std::unique_ptr<FILE, void (*)(FILE*)> f;
+  std::unordered_map<uint32_t, RecordLocation> live_records;
+  size_t file_size = 0;
+  size_t live_bytes = 0;
+
+  void open_for_append_locked();
+  void compact_locked();
+  bool should_compact_locked() const;
+};
+
 struct Account {
   enum class Flag : uint32_t {
     // clang-format off
@@ -100,6 +171,10 @@ struct Account {
   std::unordered_map<std::string, std::shared_ptr<XBLicense>> xb_licenses;
   std::unordered_map<std::string, std::shared_ptr<BBLicense>> bb_licenses;
 
+  // If this is not null, save() and delete_file() write to this log instead of
+  // to the per-account JSON file. This is set by AccountIndex::add.
+  std::shared_ptr<AccountLogStore> log_store;
+
   Account() = default;
   explicit Account(const phosg::JSON& json);
   virtual ~Account() = default;
@@ -164,7 +239,11 @@ public:
     account_banned() : invalid_argument("account is banned") {}
   };
 
-  explicit AccountIndex(bool force_all_temporary);
+  // If log_store is null, accounts are loaded from and saved to individual
+  // JSON files in system/licenses; otherwise, they're loaded from and saved to
+  // the given log. If the log is empty and there are JSON files present, the
+  // JSON files are imported into the log (but not deleted).
+  explicit AccountIndex(bool force_all_temporary, std::shared_ptr<AccountLogStore> log_store = nullptr);
   virtual ~AccountIndex() = default;
 
   std::shared_ptr<Account> create_account(bool is_temporary) const;
@@ -225,8 +304,23 @@ public:
   std::shared_ptr<Account> create_temporary_account_for_shared_account(
       std::shared_ptr<const Account> src_a, const std::string& variation_data) const;
 
+  // Switches the index (and all accounts in it) to a different storage
+  // backend, as if log_store had been passed to the constructor. All accounts
+  // are written to the new storage, and any accounts that exist only in the
+  // new storage (because they were deleted while it wasn't in use) are
+  // deleted from it, so it ends up with the same contents as the index. The
+  // old storage isn't modified. This writes every account, so it can take a
+  // long time when there are many accounts.
+  void set_log_store(std::shared_ptr<AccountLogStore> log_store);
+
+  // Migrates accounts between the per-account JSON files and a log. These
+  // don't modify or delete the source data.
+  static size_t export_json_files_to_log(std::shared_ptr<AccountLogStore> log_store);
+  static size_t export_log_to_json_files(std::shared_ptr<AccountLogStore> log_store);
+
 protected:
   bool force_all_temporary;
+  std::shared_ptr<AccountLogStore> log_store;
 
   // This class must be thread-safe because it's used by both the patch server
   // and game server threads
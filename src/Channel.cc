@@ -110,6 +110,10 @@ void Channel::set_bufferevent(struct bufferevent* bev, uint64_t virtual_network_
   }
 }
 
+size_t Channel::output_buffer_bytes() const {
+  return this->bev.get() ? evbuffer_get_length(bufferevent_get_output(this->bev.get())) : 0;
+}
+
 void Channel::disconnect() {
   if (this->bev.get()) {
     // If the output buffer is not empty, move the bufferevent into the draining
@@ -78,6 +78,10 @@ struct Channel {
   }
   void disconnect();
 
+  // Returns the number of bytes that have been sent but not yet written to
+  // the underlying connection
+  size_t output_buffer_bytes() const;
+
   // Receives a message. Throws std::out_of_range if no messages are available.
   Message recv();
 
@@ -205,6 +205,7 @@ public:
   Config config;
   Config synced_config;
   std::unique_ptr<parray<le_uint32_t, 0x20>> override_variations;
+  bool game_creation_in_progress = false;
   int32_t sub_version;
   float x;
   float z;
@@ -271,7 +272,13 @@ public:
   // File loading state
   uint32_t dol_base_addr;
   std::shared_ptr<DOLFileIndex::File> loading_dol_file;
-  std::unordered_map<std::string, std::shared_ptr<const std::string>> sending_files;
+  struct SendingFile {
+    std::shared_ptr<const std::string> data;
+    bool is_download_quest = false;
+    size_t next_chunk_index = 0;
+    size_t num_chunks_acknowledged = 0;
+  };
+  std::unordered_map<std::string, SendingFile> sending_files;
 
   Client(
       std::shared_ptr<Server> server,
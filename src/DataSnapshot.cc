@@ -0,0 +1,133 @@
+#include "DataSnapshot.hh"
+
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include <functional>
+#include <map>
+#include <phosg/Filesystem.hh>
+#include <phosg/Hash.hh>
+#include <phosg/Strings.hh>
+#include <stdexcept>
+
+using namespace std;
+
+DataSnapshot::DataSnapshot(const string& filename) {
+  auto data = phosg::load_file(filename);
+  phosg::StringReader r(data);
+
+  const auto& header = r.get<Header>();
+  if (header.magic != MAGIC) {
+    throw runtime_error("file is not a data snapshot");
+  }
+  if (header.format_version != FORMAT_VERSION) {
+    throw runtime_error(phosg::string_printf(
+        "data snapshot has format version %" PRIu32 "; expected %" PRIu32,
+        header.format_version.load(), FORMAT_VERSION));
+  }
+  if (header.total_size != data.size()) {
+    throw runtime_error("data snapshot is truncated");
+  }
+  this->source_fingerprint = header.source_fingerprint;
+
+  for (size_t z = 0; z < header.num_entries; z++) {
+    const auto& entry = r.get<EntryHeader>();
+    string key = r.pread(entry.key_offset, entry.key_size);
+    auto blob = make_shared<string>(r.pread(entry.data_offset, entry.data_size));
+    if (!this->entries.emplace(std::move(key), std::move(blob)).second) {
+      throw runtime_error("data snapshot contains duplicate keys");
+    }
+  }
+}
+
+shared_ptr<const string> DataSnapshot::get(const string& key) const {
+  lock_guard g(this->lock);
+  auto it = this->entries.find(key);
+  return (it == this->entries.end()) ? nullptr : it->second;
+}
+
+void DataSnapshot::set(const string& key, shared_ptr<const string> data) {
+  lock_guard g(this->lock);
+  this->entries[key] = std::move(data);
+}
+
+size_t DataSnapshot::size() const {
+  lock_guard g(this->lock);
+  return this->entries.size();
+}
+
+string DataSnapshot::serialize(uint64_t source_fingerprint) const {
+  lock_guard g(this->lock);
+
+  // Sort the entries by key so the output is deterministic
+  map<string, shared_ptr<const string>> sorted_entries(this->entries.begin(), this->entries.end());
+
+  auto align = +[](size_t offset) -> size_t {
+    return (offset + 0x0F) & (~0x0F);
+  };
+
+  size_t offset = align(sizeof(Header) + sizeof(EntryHeader) * sorted_entries.size());
+  vector<EntryHeader> entry_headers;
+  for (const auto& it : sorted_entries) {
+    auto& entry = entry_headers.emplace_back();
+    entry.key_offset = offset;
+    entry.key_size = it.first.size();
+    offset = align(offset + it.first.size());
+    entry.data_offset = offset;
+    entry.data_size = it.second->size();
+    offset = align(offset + it.second->size());
+  }
+
+  Header header;
+  header.magic = MAGIC;
+  header.format_version = FORMAT_VERSION;
+  header.source_fingerprint = source_fingerprint;
+  header.num_entries = entry_headers.size();
+  header.unused = 0;
+  header.total_size = offset;
+
+  phosg::StringWriter w;
+  w.put(header);
+  for (const auto& entry : entry_headers) {
+    w.put(entry);
+  }
+  auto it = sorted_entries.begin();
+  for (const auto& entry : entry_headers) {
+    w.extend_to(entry.key_offset, 0x00);
+    w.write(it->first);
+    w.extend_to(entry.data_offset, 0x00);
+    w.write(*it->second);
+    it++;
+  }
+  w.extend_to(offset, 0x00);
+  return std::move(w.str());
+}
+
+uint64_t DataSnapshot::compute_source_fingerprint(const vector<string>& directories, const string& extra_data) {
+  uint64_t ret = phosg::fnv1a64(extra_data);
+
+  function<void(const string&)> add_directory = [&](const string& dir) -> void {
+    if (!phosg::isdir(dir)) {
+      ret = phosg::fnv1a64(dir + ":missing", ret);
+      return;
+    }
+    for (const auto& name : phosg::list_directory_sorted(dir)) {
+      string path = dir + "/" + name;
+      struct stat st;
+      if (stat(path.c_str(), &st) != 0) {
+        continue;
+      }
+      if (S_ISDIR(st.st_mode)) {
+        add_directory(path);
+      } else {
+        string record = phosg::string_printf("%s:%" PRIu64 ":%" PRId64,
+            path.c_str(), static_cast<uint64_t>(st.st_size), static_cast<int64_t>(st.st_mtime));
+        ret = phosg::fnv1a64(record, ret);
+      }
+    }
+  };
+  for (const auto& dir : directories) {
+    add_directory(dir);
+  }
+  return ret;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <phosg/Encoding.hh>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Text.hh"
+
+// A data snapshot is a single file containing preprocessed forms of some of
+// the static game data that is otherwise rebuilt from source files at startup.
+// Currently this is the decompressed item parameter and mag evolution tables,
+// the decrypted and decompressed level tables, and JSON rare item sets with
+// all item descriptions already resolved; everything else (text sets, item
+// name indexes, maps, quests, etc.) is still loaded from its source files.
+// Each entry is an opaque blob identified by a string key; the loaders in
+// ServerState decide what each blob contains.
+//
+// The file begins with a header and a table of fixed-size entry records,
+// followed by the keys and blobs. When a snapshot is loaded, each blob is
+// copied out of the file into its own string, which the loaders then own. The
+// header contains a fingerprint of the source files' names, sizes, and
+// modification times; if any source file has changed since the snapshot was
+// built, the snapshot is considered stale and isn't used.
+class DataSnapshot {
+public:
+  static constexpr uint32_t FORMAT_VERSION = 1;
+
+  // Creates an empty snapshot (to be filled in with set() and then saved)
+  DataSnapshot() = default;
+  // Loads a snapshot file. Throws if the file can't be read, is malformed, or
+  // was written by a different format version.
+  explicit DataSnapshot(const std::string& filename);
+  DataSnapshot(const DataSnapshot&) = delete;
+  DataSnapshot(DataSnapshot&&) = delete;
+  DataSnapshot& operator=(const DataSnapshot&) = delete;
+  DataSnapshot& operator=(DataSnapshot&&) = delete;
+  ~DataSnapshot() = default;
+
+  // Returns null if the key isn't present
+  std::shared_ptr<const std::string> get(const std::string& key) const;
+  // This function is thread-safe, so loaders running in parallel can all
+  // record their results in the same snapshot
+  void set(const std::string& key, std::shared_ptr<const std::string> data);
+
+  size_t size() const;
+  uint64_t get_source_fingerprint() const {
+    return this->source_fingerprint;
+  }
+
+  std::string serialize(uint64_t source_fingerprint) const;
+
+  // Computes a fingerprint of all files in the given directories (recursively).
+  // Only the files' names, sizes, and modification times are used, so this is
+  // fast even for large data directories. extra_data is also included in the
+  // fingerprint; this can be used for configuration that affects the contents
+  // of the snapshot.
+  static uint64_t compute_source_fingerprint(
+      const std::vector<std::string>& directories, const std::string& extra_data = "");
+
+private:
+  struct Header {
+    be_uint32_t magic;
+    le_uint32_t format_version;
+    le_uint64_t source_fingerprint;
+    le_uint32_t num_entries;
+    le_uint32_t unused;
+    le_uint64_t total_size;
+  } __packed_ws__(Header, 0x20);
+  struct EntryHeader {
+    le_uint64_t key_offset;
+    le_uint64_t key_size;
+    le_uint64_t data_offset;
+    le_uint64_t data_size;
+  } __packed_ws__(EntryHeader, 0x20);
+  static constexpr uint32_t MAGIC = 0x4E534453; // 'NSDS'
+
+  mutable std::mutex lock;
+  uint64_t source_fingerprint = 0;
+  std::unordered_map<std::string, std::shared_ptr<const std::string>> entries;
+};
@@ -6,6 +6,7 @@
 #include <inttypes.h>
 #include <stdlib.h>
 
+#include <phosg/Hash.hh>
 #include <phosg/Network.hh>
 #include <string>
 #include <vector>
@@ -93,6 +94,12 @@ void HTTPServer::send_response(struct evhttp_request* req, int code, const char*
   struct evkeyvalq* headers = evhttp_request_get_output_headers(req);
   evhttp_add_header(headers, "Content-Type", content_type);
   evhttp_add_header(headers, "Server", "newserv");
+  // HEAD responses have the same headers as GET responses, but no body
+  if (b && (evhttp_request_get_command(req) == EVHTTP_REQ_HEAD)) {
+    size_t size = evbuffer_get_length(b);
+    evhttp_add_header(headers, "Content-Length", phosg::string_printf("%zu", size).c_str());
+    evbuffer_drain(b, size);
+  }
   evhttp_send_reply(req, code, explanation_for_response_code.at(code), b);
 }
 
@@ -166,8 +173,15 @@ HTTPServer::HTTPServer(shared_ptr<ServerState> state)
     : state(state),
       base(event_base_new(), event_base_free),
       http(evhttp_new(this->base.get()), evhttp_free),
-      th(&HTTPServer::thread_fn, this) {
+      th(&HTTPServer::thread_fn, this),
+      publish_state_snapshot_event(nullptr, event_free) {
   evhttp_set_gencb(this->http.get(), this->dispatch_handle_request, this);
+  if (this->state->http_state_snapshot_interval_usecs) {
+    this->publish_state_snapshot_event.reset(event_new(
+        this->state->base.get(), -1, EV_TIMEOUT | EV_PERSIST, &HTTPServer::dispatch_publish_state_snapshot, this));
+    auto tv = phosg::usecs_to_timeval(this->state->http_state_snapshot_interval_usecs);
+    event_add(this->publish_state_snapshot_event.get(), &tv);
+  }
 }
 
 void HTTPServer::listen(const string& socket_path) {
@@ -965,172 +979,290 @@ phosg::JSON HTTPServer::generate_lobby_json_st(shared_ptr<const Lobby> l, shared
 }
 
 phosg::JSON HTTPServer::generate_game_server_clients_json() const {
-  return call_on_event_thread<phosg::JSON>(this->state->base, [&]() {
-    auto res = phosg::JSON::list();
-    for (const auto& it : this->state->channel_to_client) {
-      res.emplace_back(this->generate_game_client_json_st(it.second, this->state->item_name_index_opt(it.second->version())));
-    }
-    return res;
-  });
+  auto res = phosg::JSON::list();
+  for (const auto& it : this->state->channel_to_client) {
+    res.emplace_back(this->generate_game_client_json_st(it.second, this->state->item_name_index_opt(it.second->version())));
+  }
+  return res;
 }
 
 phosg::JSON HTTPServer::generate_proxy_server_clients_json() const {
-  return call_on_event_thread<phosg::JSON>(this->state->base, [&]() {
-    phosg::JSON res = phosg::JSON::list();
-    if (this->state->proxy_server) {
-      for (const auto& it : this->state->proxy_server->all_sessions()) {
-        res.emplace_back(this->generate_proxy_client_json_st(it.second));
-      }
+  phosg::JSON res = phosg::JSON::list();
+  if (this->state->proxy_server) {
+    for (const auto& it : this->state->proxy_server->all_sessions()) {
+      res.emplace_back(this->generate_proxy_client_json_st(it.second));
     }
-    return res;
-  });
+  }
+  return res;
 }
 
 phosg::JSON HTTPServer::generate_server_info_json() const {
-  return call_on_event_thread<phosg::JSON>(this->state->base, [&]() {
-    size_t game_count = 0;
-    size_t lobby_count = 0;
-    for (const auto& it : this->state->id_to_lobby) {
-      if (it.second->is_game()) {
-        game_count++;
-      } else {
-        lobby_count++;
-      }
+  size_t game_count = 0;
+  size_t lobby_count = 0;
+  for (const auto& it : this->state->id_to_lobby) {
+    if (it.second->is_game()) {
+      game_count++;
+    } else {
+      lobby_count++;
     }
-    uint64_t uptime_usecs = phosg::now() - this->state->creation_time;
-    return phosg::JSON::dict({
-        {"StartTimeUsecs", this->state->creation_time},
-        {"StartTime", phosg::format_time(this->state->creation_time)},
-        {"UptimeUsecs", uptime_usecs},
-        {"Uptime", phosg::format_duration(uptime_usecs)},
-        {"LobbyCount", lobby_count},
-        {"GameCount", game_count},
-        {"ClientCount", this->state->channel_to_client.size()},
-        {"ProxySessionCount", this->state->proxy_server ? this->state->proxy_server->num_sessions() : 0},
-        {"ServerName", this->state->name},
-    });
+  }
+  uint64_t uptime_usecs = phosg::now() - this->state->creation_time;
+  return phosg::JSON::dict({
+      {"StartTimeUsecs", this->state->creation_time},
+      {"StartTime", phosg::format_time(this->state->creation_time)},
+      {"UptimeUsecs", uptime_usecs},
+      {"Uptime", phosg::format_duration(uptime_usecs)},
+      {"LobbyCount", lobby_count},
+      {"GameCount", game_count},
+      {"ClientCount", this->state->channel_to_client.size()},
+      {"ProxySessionCount", this->state->proxy_server ? this->state->proxy_server->num_sessions() : 0},
+      {"ServerName", this->state->name},
   });
 }
 
 phosg::JSON HTTPServer::generate_lobbies_json() const {
-  return call_on_event_thread<phosg::JSON>(this->state->base, [&]() {
-    phosg::JSON res = phosg::JSON::list();
-    for (const auto& it : this->state->id_to_lobby) {
-      res.emplace_back(this->generate_lobby_json_st(it.second, this->state->item_name_index_opt(it.second->base_version)));
-    }
-    return res;
-  });
+  phosg::JSON res = phosg::JSON::list();
+  for (const auto& it : this->state->id_to_lobby) {
+    res.emplace_back(this->generate_lobby_json_st(it.second, this->state->item_name_index_opt(it.second->base_version)));
+  }
+  return res;
 }
 
 phosg::JSON HTTPServer::generate_summary_json() const {
-  auto ret = call_on_event_thread<phosg::JSON>(this->state->base, [&]() {
-    auto clients_json = phosg::JSON::list();
-    for (const auto& it : this->state->channel_to_client) {
-      auto c = it.second;
-      auto p = c->character(false, false);
-      auto l = c->lobby.lock();
-      clients_json.emplace_back(phosg::JSON::dict({
-          {"ID", c->id},
-          {"AccountID", c->login ? c->login->account->account_id : phosg::JSON(nullptr)},
-          {"Name", p ? p->disp.name.decode(it.second->language()) : phosg::JSON(nullptr)},
+  auto clients_json = phosg::JSON::list();
+  for (const auto& it : this->state->channel_to_client) {
+    auto c = it.second;
+    auto p = c->character(false, false);
+    auto l = c->lobby.lock();
+    clients_json.emplace_back(phosg::JSON::dict({
+        {"ID", c->id},
+        {"AccountID", c->login ? c->login->account->account_id : phosg::JSON(nullptr)},
+        {"Name", p ? p->disp.name.decode(it.second->language()) : phosg::JSON(nullptr)},
+        {"Version", phosg::name_for_enum(it.second->version())},
+        {"Language", name_for_language_code(it.second->language())},
+        {"Level", p ? p->disp.stats.level + 1 : phosg::JSON(nullptr)},
+        {"Class", p ? name_for_char_class(p->disp.visual.char_class) : phosg::JSON(nullptr)},
+        {"SectionID", p ? name_for_section_id(p->disp.visual.section_id) : phosg::JSON(nullptr)},
+        {"LobbyID", l ? l->lobby_id : phosg::JSON(nullptr)},
+    }));
+  }
+
+  auto proxy_clients_json = phosg::JSON::list();
+  if (this->state->proxy_server) {
+    for (const auto& it : this->state->proxy_server->all_sessions()) {
+      proxy_clients_json.emplace_back(phosg::JSON::dict({
+          {"AccountID", it.second->login ? it.second->login->account->account_id : phosg::JSON(nullptr)},
+          {"Name", it.second->character_name},
           {"Version", phosg::name_for_enum(it.second->version())},
           {"Language", name_for_language_code(it.second->language())},
-          {"Level", p ? p->disp.stats.level + 1 : phosg::JSON(nullptr)},
-          {"Class", p ? name_for_char_class(p->disp.visual.char_class) : phosg::JSON(nullptr)},
-          {"SectionID", p ? name_for_section_id(p->disp.visual.section_id) : phosg::JSON(nullptr)},
-          {"LobbyID", l ? l->lobby_id : phosg::JSON(nullptr)},
       }));
     }
+  }
 
-    auto proxy_clients_json = phosg::JSON::list();
-    if (this->state->proxy_server) {
-      for (const auto& it : this->state->proxy_server->all_sessions()) {
-        proxy_clients_json.emplace_back(phosg::JSON::dict({
-            {"AccountID", it.second->login ? it.second->login->account->account_id : phosg::JSON(nullptr)},
-            {"Name", it.second->character_name},
-            {"Version", phosg::name_for_enum(it.second->version())},
-            {"Language", name_for_language_code(it.second->language())},
-        }));
+  auto games_json = phosg::JSON::list();
+  for (const auto& it : this->state->id_to_lobby) {
+    auto l = it.second;
+    if (l->is_game()) {
+      auto game_json = phosg::JSON::dict({
+          {"ID", l->lobby_id},
+          {"Name", l->name},
+          {"BaseVersion", phosg::name_for_enum(l->base_version)},
+          {"Players", l->count_clients()},
+          {"CheatsEnabled", l->check_flag(Lobby::Flag::CHEATS_ENABLED)},
+          {"Episode", name_for_episode(l->episode)},
+          {"HasPassword", !l->password.empty()},
+      });
+      if (l->episode == Episode::EP3) {
+        auto ep3s = l->ep3_server;
+        game_json.emplace("BattleInProgress", l->check_flag(Lobby::Flag::BATTLE_IN_PROGRESS));
+        game_json.emplace("IsSpectatorTeam", l->check_flag(Lobby::Flag::IS_SPECTATOR_TEAM));
+        game_json.emplace("MapNumber", (ep3s && ep3s->last_chosen_map) ? ep3s->last_chosen_map->map_number : phosg::JSON(nullptr));
+        game_json.emplace("Rules", (ep3s && ep3s->map_and_rules) ? ep3s->map_and_rules->rules.json() : nullptr);
+      } else {
+        game_json.emplace("QuestSelectionInProgress", l->check_flag(Lobby::Flag::QUEST_SELECTION_IN_PROGRESS));
+        game_json.emplace("QuestInProgress", l->check_flag(Lobby::Flag::QUEST_IN_PROGRESS));
+        game_json.emplace("JoinableQuestInProgress", l->check_flag(Lobby::Flag::JOINABLE_QUEST_IN_PROGRESS));
+        game_json.emplace("SectionID", name_for_section_id(l->effective_section_id()));
+        game_json.emplace("Mode", name_for_mode(l->mode));
+        game_json.emplace("Difficulty", name_for_difficulty(l->difficulty));
+        game_json.emplace("Quest", this->generate_quest_json_st(l->quest));
       }
+      games_json.emplace_back(std::move(game_json));
     }
+  }
 
-    auto games_json = phosg::JSON::list();
-    for (const auto& it : this->state->id_to_lobby) {
-      auto l = it.second;
-      if (l->is_game()) {
-        auto game_json = phosg::JSON::dict({
-            {"ID", l->lobby_id},
-            {"Name", l->name},
-            {"BaseVersion", phosg::name_for_enum(l->base_version)},
-            {"Players", l->count_clients()},
-            {"CheatsEnabled", l->check_flag(Lobby::Flag::CHEATS_ENABLED)},
-            {"Episode", name_for_episode(l->episode)},
-            {"HasPassword", !l->password.empty()},
-        });
-        if (l->episode == Episode::EP3) {
-          auto ep3s = l->ep3_server;
-          game_json.emplace("BattleInProgress", l->check_flag(Lobby::Flag::BATTLE_IN_PROGRESS));
-          game_json.emplace("IsSpectatorTeam", l->check_flag(Lobby::Flag::IS_SPECTATOR_TEAM));
-          game_json.emplace("MapNumber", (ep3s && ep3s->last_chosen_map) ? ep3s->last_chosen_map->map_number : phosg::JSON(nullptr));
-          game_json.emplace("Rules", (ep3s && ep3s->map_and_rules) ? ep3s->map_and_rules->rules.json() : nullptr);
-        } else {
-          game_json.emplace("QuestSelectionInProgress", l->check_flag(Lobby::Flag::QUEST_SELECTION_IN_PROGRESS));
-          game_json.emplace("QuestInProgress", l->check_flag(Lobby::Flag::QUEST_IN_PROGRESS));
-          game_json.emplace("JoinableQuestInProgress", l->check_flag(Lobby::Flag::JOINABLE_QUEST_IN_PROGRESS));
-          game_json.emplace("SectionID", name_for_section_id(l->effective_section_id()));
-          game_json.emplace("Mode", name_for_mode(l->mode));
-          game_json.emplace("Difficulty", name_for_difficulty(l->difficulty));
-          game_json.emplace("Quest", this->generate_quest_json_st(l->quest));
-        }
-        games_json.emplace_back(std::move(game_json));
-      }
+  return phosg::JSON::dict({
+      {"Clients", std::move(clients_json)},
+      {"ProxyClients", std::move(proxy_clients_json)},
+      {"Games", std::move(games_json)},
+      {"Server", this->generate_server_info_json()},
+  });
+}
+
+phosg::JSON HTTPServer::generate_state_view_json(StateView view) const {
+  switch (view) {
+    case StateView::GAME_SERVER_CLIENTS:
+      return this->generate_game_server_clients_json();
+    case StateView::PROXY_SERVER_CLIENTS:
+      return this->generate_proxy_server_clients_json();
+    case StateView::LOBBIES:
+      return this->generate_lobbies_json();
+    case StateView::SERVER_INFO:
+      return this->generate_server_info_json();
+    case StateView::SUMMARY:
+      return this->generate_summary_json();
+  }
+  throw logic_error("invalid state view");
+}
+
+void HTTPServer::dispatch_publish_state_snapshot(evutil_socket_t, short, void* ctx) {
+  reinterpret_cast<HTTPServer*>(ctx)->publish_state_snapshot();
+}
+
+void HTTPServer::publish_state_snapshot() {
+  uint64_t now = phosg::now();
+  for (size_t z = 0; z < NUM_STATE_VIEWS; z++) {
+    auto& slot = this->state_snapshots[z];
+    uint64_t last_request_usecs = slot.last_request_usecs.load();
+    if (last_request_usecs && (now - last_request_usecs < STATE_VIEW_PUBLISH_TTL_USECS)) {
+      auto snapshot = make_shared<StateSnapshot>();
+      snapshot->time_usecs = phosg::now();
+      snapshot->data = this->generate_state_view_json(static_cast<StateView>(z));
+      lock_guard g(slot.lock);
+      slot.snapshot = std::move(snapshot);
+    }
+  }
+}
+
+shared_ptr<const phosg::JSON> HTTPServer::get_state_view(StateView view, uint64_t* max_age_usecs) {
+  auto& slot = this->state_snapshots.at(static_cast<size_t>(view));
+  uint64_t now = phosg::now();
+  slot.last_request_usecs.store(now);
+
+  uint64_t interval_usecs = this->state->http_state_snapshot_interval_usecs;
+  shared_ptr<const StateSnapshot> ret;
+  {
+    lock_guard g(slot.lock);
+    ret = slot.snapshot;
+  }
+
+  if (!ret || !interval_usecs) {
+    // There's nothing to serve yet (or snapshots are disabled), so the request
+    // has to wait for the event thread
+    ret = call_on_event_thread<shared_ptr<const StateSnapshot>>(this->state->base, [&]() {
+      auto snapshot = make_shared<StateSnapshot>();
+      snapshot->time_usecs = phosg::now();
+      snapshot->data = this->generate_state_view_json(view);
+      return snapshot;
+    });
+    if (interval_usecs) {
+      lock_guard g(slot.lock);
+      slot.snapshot = ret;
     }
 
-    return phosg::JSON::dict({
-        {"Clients", std::move(clients_json)},
-        {"ProxyClients", std::move(proxy_clients_json)},
-        {"Games", std::move(games_json)},
+  } else if ((now - ret->time_usecs >= interval_usecs * 2) && !slot.refresh_pending.exchange(true)) {
+    // While a view is in use, the publisher replaces its snapshot once per
+    // interval, so this only happens if the view hasn't been requested in a
+    // long time or the event thread is busy. Serve the stale snapshot instead
+    // of blocking, and generate a new one for the next request.
+    forward_to_event_thread(this->state->base, [this, view, &slot]() -> void {
+      auto snapshot = make_shared<StateSnapshot>();
+      snapshot->time_usecs = phosg::now();
+      snapshot->data = this->generate_state_view_json(view);
+      {
+        lock_guard g(slot.lock);
+        slot.snapshot = std::move(snapshot);
+      }
+      slot.refresh_pending.store(false);
     });
-  });
-  ret.emplace("Server", this->generate_server_info_json());
-  return ret;
+  }
+
+  if (max_age_usecs) {
+    uint64_t age_usecs = (now > ret->time_usecs) ? (now - ret->time_usecs) : 0;
+    *max_age_usecs = max<uint64_t>(*max_age_usecs, age_usecs);
+  }
+  return shared_ptr<const phosg::JSON>(ret, &ret->data);
 }
 
-phosg::JSON HTTPServer::generate_all_json() const {
+phosg::JSON HTTPServer::generate_all_json(uint64_t* max_age_usecs) {
   return phosg::JSON::dict({
-      {"Clients", this->generate_game_server_clients_json()},
-      {"ProxyClients", this->generate_proxy_server_clients_json()},
-      {"Lobbies", this->generate_lobbies_json()},
-      {"Server", this->generate_server_info_json()},
+      {"Clients", *this->get_state_view(StateView::GAME_SERVER_CLIENTS, max_age_usecs)},
+      {"ProxyClients", *this->get_state_view(StateView::PROXY_SERVER_CLIENTS, max_age_usecs)},
+      {"Lobbies", *this->get_state_view(StateView::LOBBIES, max_age_usecs)},
+      {"Server", *this->get_state_view(StateView::SERVER_INFO, max_age_usecs)},
   });
 }
 
-phosg::JSON HTTPServer::generate_ep3_cards_json(bool trial) const {
+shared_ptr<const HTTPServer::CachedResponse> HTTPServer::get_cached_response(
+    const string& key,
+    uint32_t serialize_options,
+    vector<shared_ptr<const void>>&& sources,
+    function<phosg::JSON()> generate) {
+  string cache_key = phosg::string_printf("%s:%08" PRIX32, key.c_str(), serialize_options);
+  auto& entry = this->response_cache[cache_key];
+  if (entry && (entry->sources.size() == sources.size())) {
+    bool sources_match = true;
+    for (size_t z = 0; z < sources.size(); z++) {
+      if (entry->sources[z].lock() != sources[z]) {
+        sources_match = false;
+        break;
+      }
+    }
+    if (sources_match) {
+      return entry;
+    }
+  }
+
+  auto new_entry = make_shared<CachedResponse>();
+  for (const auto& source : sources) {
+    new_entry->sources.emplace_back(source);
+  }
+  auto data = make_shared<string>(generate().serialize(phosg::JSON::SerializeOption::ESCAPE_CONTROLS_ONLY | serialize_options));
+  new_entry->etag = phosg::string_printf("\"%016" PRIX64 "\"", phosg::fnv1a64(*data));
+  new_entry->data = std::move(data);
+  entry = new_entry;
+  return entry;
+}
+
+shared_ptr<const HTTPServer::CachedResponse> HTTPServer::generate_ep3_cards_response(bool trial, uint32_t serialize_options) {
   auto index = call_on_event_thread<shared_ptr<const Episode3::CardIndex>>(this->state->base, [&]() {
     return trial ? this->state->ep3_card_index_trial : this->state->ep3_card_index;
   });
-  return index->definitions_json();
+  return this->get_cached_response(trial ? "ep3-cards-trial" : "ep3-cards", serialize_options, {index}, [&]() {
+    return index->definitions_json();
+  });
 }
 
-phosg::JSON HTTPServer::generate_common_tables_json() const {
+shared_ptr<const HTTPServer::CachedResponse> HTTPServer::generate_common_tables_response(uint32_t serialize_options) {
   auto [set_v2, set_v3_v4] = call_on_event_thread<pair<shared_ptr<const CommonItemSet>, shared_ptr<const CommonItemSet>>>(this->state->base, [&]() {
     return make_pair(this->state->common_item_set_v2, this->state->common_item_set_v3_v4);
   });
-  return phosg::JSON::dict({{"v1_v2", set_v2->json()}, {"v3_v4", set_v3_v4->json()}});
+  return this->get_cached_response("common-tables", serialize_options, {set_v2, set_v3_v4}, [&]() {
+    return phosg::JSON::dict({{"v1_v2", set_v2->json()}, {"v3_v4", set_v3_v4->json()}});
+  });
 }
 
-phosg::JSON HTTPServer::generate_rare_tables_json() const {
+shared_ptr<const HTTPServer::CachedResponse> HTTPServer::generate_rare_tables_response(uint32_t serialize_options) {
   auto sets = call_on_event_thread<unordered_map<string, shared_ptr<const RareItemSet>>>(this->state->base, [&]() {
     return this->state->rare_item_sets;
   });
-  phosg::JSON ret = phosg::JSON::list();
-  for (const auto& it : sets) {
-    ret.emplace_back(it.first);
+  // The response only contains the table names, but the sources must be in a
+  // consistent order for the cache to recognize them
+  map<string, shared_ptr<const RareItemSet>> sorted_sets(sets.begin(), sets.end());
+  vector<shared_ptr<const void>> sources;
+  for (const auto& it : sorted_sets) {
+    sources.emplace_back(it.second);
   }
-  return ret;
+  return this->get_cached_response("rare-tables", serialize_options, std::move(sources), [&]() {
+    phosg::JSON ret = phosg::JSON::list();
+    for (const auto& it : sets) {
+      ret.emplace_back(it.first);
+    }
+    return ret;
+  });
 }
 
-phosg::JSON HTTPServer::generate_rare_table_json(const std::string& table_name) const {
+shared_ptr<const HTTPServer::CachedResponse> HTTPServer::generate_rare_table_response(const std::string& table_name, uint32_t serialize_options) {
   try {
     auto colls = call_on_event_thread<pair<shared_ptr<const RareItemSet>, shared_ptr<const ItemNameIndex>>>(this->state->base, [&]() {
       const auto& table = this->state->rare_item_sets.at(table_name);
@@ -1146,19 +1278,40 @@ phosg::JSON HTTPServer::generate_rare_table_json(const std::string& table_name)
       }
       return make_pair(table, name_index);
     });
-    return colls.first->json(colls.second);
+    return this->get_cached_response("rare-tables/" + table_name, serialize_options, {colls.first, colls.second}, [&]() {
+      return colls.first->json(colls.second);
+    });
   } catch (const out_of_range&) {
     throw http_error(404, "table does not exist");
   }
 }
 
+shared_ptr<const HTTPServer::CachedResponse> HTTPServer::generate_config_response(uint32_t serialize_options) {
+  auto config_json = call_on_event_thread<shared_ptr<const phosg::JSON>>(this->state->base, [this]() {
+    return this->state->config_json;
+  });
+  return this->get_cached_response("config", serialize_options, {config_json}, [&]() {
+    return *config_json;
+  });
+}
+
 void HTTPServer::handle_request(struct evhttp_request* req) {
   shared_ptr<const phosg::JSON> ret;
+  shared_ptr<const CachedResponse> cached_ret;
   uint32_t serialize_options = 0;
+  bool ret_is_state_view = false;
+  uint64_t snapshot_age_usecs = 0;
   uint64_t start_time = phosg::now();
   string uri = evhttp_request_get_uri(req);
 
   try {
+    // All endpoints are read-only
+    auto command = evhttp_request_get_command(req);
+    if ((command != EVHTTP_REQ_GET) && (command != EVHTTP_REQ_HEAD)) {
+      evhttp_add_header(evhttp_request_get_output_headers(req), "Allow", "GET, HEAD");
+      throw http_error(405, "only GET and HEAD requests are supported");
+    }
+
     std::unordered_multimap<std::string, std::string> query;
     size_t query_pos = uri.find('?');
     if (query_pos != string::npos) {
@@ -1189,6 +1342,8 @@ void HTTPServer::handle_request(struct evhttp_request* req) {
           "/y/rare-drops/stream",
           "/y/summary",
           "/y/all",
+          "/y/reload-jobs",
+          "/y/reload-jobs/<JOB-ID>",
       });
       ret = make_shared<phosg::JSON>(phosg::JSON::dict({{"endpoints", std::move(endpoints_json)}}));
 
@@ -1204,29 +1359,51 @@ void HTTPServer::handle_request(struct evhttp_request* req) {
       }
 
     } else if (uri == "/y/data/ep3-cards") {
-      ret = make_shared<phosg::JSON>(this->generate_ep3_cards_json(false));
+      cached_ret = this->generate_ep3_cards_response(false, serialize_options);
     } else if (uri == "/y/data/ep3-cards-trial") {
-      ret = make_shared<phosg::JSON>(this->generate_ep3_cards_json(true));
+      cached_ret = this->generate_ep3_cards_response(true, serialize_options);
     } else if (uri == "/y/data/common-tables") {
-      ret = make_shared<phosg::JSON>(this->generate_common_tables_json());
+      cached_ret = this->generate_common_tables_response(serialize_options);
     } else if (uri == "/y/data/rare-tables") {
-      ret = make_shared<phosg::JSON>(this->generate_rare_tables_json());
+      cached_ret = this->generate_rare_tables_response(serialize_options);
     } else if (!strncmp(uri.c_str(), "/y/data/rare-tables/", 20)) {
-      ret = make_shared<phosg::JSON>(this->generate_rare_table_json(uri.substr(20)));
+      cached_ret = this->generate_rare_table_response(uri.substr(20), serialize_options);
     } else if (uri == "/y/data/config") {
-      ret = call_on_event_thread<shared_ptr<const phosg::JSON>>(this->state->base, [this]() { return this->state->config_json; });
+      cached_ret = this->generate_config_response(serialize_options);
     } else if (uri == "/y/clients") {
-      ret = make_shared<phosg::JSON>(this->generate_game_server_clients_json());
+      ret = this->get_state_view(StateView::GAME_SERVER_CLIENTS, &snapshot_age_usecs);
+      ret_is_state_view = true;
     } else if (uri == "/y/proxy-clients") {
-      ret = make_shared<phosg::JSON>(this->generate_proxy_server_clients_json());
+      ret = this->get_state_view(StateView::PROXY_SERVER_CLIENTS, &snapshot_age_usecs);
+      ret_is_state_view = true;
     } else if (uri == "/y/lobbies") {
-      ret = make_shared<phosg::JSON>(this->generate_lobbies_json());
+      ret = this->get_state_view(StateView::LOBBIES, &snapshot_age_usecs);
+      ret_is_state_view = true;
     } else if (uri == "/y/server") {
-      ret = make_shared<phosg::JSON>(this->generate_server_info_json());
+      ret = this->get_state_view(StateView::SERVER_INFO, &snapshot_age_usecs);
+      ret_is_state_view = true;
     } else if (uri == "/y/summary") {
-      ret = make_shared<phosg::JSON>(this->generate_summary_json());
+      ret = this->get_state_view(StateView::SUMMARY, &snapshot_age_usecs);
+      ret_is_state_view = true;
     } else if (uri == "/y/all") {
-      ret = make_shared<phosg::JSON>(this->generate_all_json());
+      ret = make_shared<phosg::JSON>(this->generate_all_json(&snapshot_age_usecs));
+      ret_is_state_view = true;
+
+    } else if (uri == "/y/reload-jobs") {
+      ret = make_shared<phosg::JSON>(this->state->reload_jobs->jobs_json());
+
+    } else if (!strncmp(uri.c_str(), "/y/reload-jobs/", 15)) {
+      uint64_t job_id;
+      try {
+        job_id = stoull(uri.substr(15), nullptr, 0);
+      } catch (const exception&) {
+        throw http_error(400, "invalid job ID");
+      }
+      try {
+        ret = make_shared<phosg::JSON>(this->state->reload_jobs->get_job(job_id).json());
+      } catch (const out_of_range&) {
+        throw http_error(404, "job does not exist");
+      }
 
     } else {
       throw http_error(404, "unknown action");
@@ -1248,14 +1425,42 @@ void HTTPServer::handle_request(struct evhttp_request* req) {
 
   uint64_t handler_end = phosg::now();
   unique_ptr<struct evbuffer, void (*)(struct evbuffer*)> out_buffer(evbuffer_new(), evbuffer_free);
-  string* serialized = new string(ret->serialize(phosg::JSON::SerializeOption::ESCAPE_CONTROLS_ONLY | serialize_options));
-  size_t size = serialized->size();
+  size_t size;
+  if (cached_ret) {
+    // Responses from the cache have an ETag, so clients that already have the
+    // current version don't need to download it again
+    struct evkeyvalq* headers = evhttp_request_get_output_headers(req);
+    evhttp_add_header(headers, "ETag", cached_ret->etag.c_str());
+    const char* if_none_match = evhttp_find_header(evhttp_request_get_input_headers(req), "If-None-Match");
+    if (if_none_match && (cached_ret->etag == if_none_match)) {
+      size = 0;
+      this->send_response(req, 304, "application/json", out_buffer.get());
+    } else {
+      // The evbuffer holds a reference to the cached data, so it remains valid
+      // even if the cache entry is replaced before the response is sent
+      auto* data_ref = new shared_ptr<const string>(cached_ret->data);
+      auto cleanup = +[](const void*, size_t, void* s) -> void {
+        delete reinterpret_cast<shared_ptr<const string>*>(s);
+      };
+      size = cached_ret->data->size();
+      evbuffer_add_reference(out_buffer.get(), cached_ret->data->data(), size, cleanup, data_ref);
+      this->send_response(req, 200, "application/json", out_buffer.get());
+    }
+  } else {
+    if (ret_is_state_view) {
+      // Responses may come from a stale snapshot; tell the client how stale
+      struct evkeyvalq* headers = evhttp_request_get_output_headers(req);
+      evhttp_add_header(headers, "X-Snapshot-Age-Usecs", phosg::string_printf("%" PRIu64, snapshot_age_usecs).c_str());
+    }
+    string* serialized = new string(ret->serialize(phosg::JSON::SerializeOption::ESCAPE_CONTROLS_ONLY | serialize_options));
+    size = serialized->size();
+    auto cleanup = +[](const void*, size_t, void* s) -> void {
+      delete reinterpret_cast<string*>(s);
+    };
+    evbuffer_add_reference(out_buffer.get(), serialized->data(), serialized->size(), cleanup, serialized);
+    this->send_response(req, 200, "application/json", out_buffer.get());
+  }
   uint64_t serialize_end = phosg::now();
-  auto cleanup = +[](const void*, size_t, void* s) -> void {
-    delete reinterpret_cast<string*>(s);
-  };
-  evbuffer_add_reference(out_buffer.get(), serialized->data(), serialized->size(), cleanup, serialized);
-  this->send_response(req, 200, "application/json", out_buffer.get());
 
   string handler_time = phosg::format_duration(handler_end - start_time);
   string serialize_time = phosg::format_duration(serialize_end - handler_end);
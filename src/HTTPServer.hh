@@ -5,7 +5,10 @@
 #include <event2/http.h>
 #include <stdlib.h>
 
+#include <array>
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
 
 #include "ProxyServer.hh"
@@ -54,11 +57,60 @@ protected:
     void reset_pending_frame();
   };
 
+  // The parts of the server's state that the HTTP server can return. Each
+  // view is generated separately (on the event thread), so polling one
+  // endpoint doesn't cause the others to be generated.
+  enum class StateView {
+    GAME_SERVER_CLIENTS = 0,
+    PROXY_SERVER_CLIENTS,
+    LOBBIES,
+    SERVER_INFO,
+    SUMMARY,
+  };
+  static constexpr size_t NUM_STATE_VIEWS = 5;
+
+  // A copy of one view of the server's state. Snapshots are immutable once
+  // published, so the HTTP thread can serve them without synchronization.
+  struct StateSnapshot {
+    uint64_t time_usecs;
+    phosg::JSON data;
+  };
+  struct StateSnapshotSlot {
+    std::mutex lock; // Guards snapshot (but not its contents)
+    std::shared_ptr<const StateSnapshot> snapshot;
+    // Set by the HTTP thread when it uses the snapshot; the publisher only
+    // generates new snapshots for views that were requested within the last
+    // STATE_VIEW_PUBLISH_TTL_USECS, so there's no overhead for views that no
+    // one is requesting
+    std::atomic<uint64_t> last_request_usecs = 0;
+    // True while a refresh for this view is queued on the event thread, so
+    // repeated requests for a stale view don't queue more than one
+    std::atomic<bool> refresh_pending = false;
+  };
+  // This is long so that infrequent pollers (e.g. metrics scrapers) still get
+  // a recent snapshot without waiting for the event thread
+  static constexpr uint64_t STATE_VIEW_PUBLISH_TTL_USECS = 10 * 60 * 1000000ULL;
+
   std::shared_ptr<ServerState> state;
   std::shared_ptr<struct event_base> base;
   std::shared_ptr<struct evhttp> http;
   std::thread th;
 
+  // Serialized responses for the static data endpoints (/y/data/...), keyed
+  // by path and serialize options. Each entry remembers the objects it was
+  // generated from; since reloads replace these objects instead of modifying
+  // them, the entry is valid as long as the server still uses the same ones.
+  // This is only accessed from the HTTP thread.
+  struct CachedResponse {
+    std::vector<std::weak_ptr<const void>> sources;
+    std::shared_ptr<const std::string> data;
+    std::string etag;
+  };
+  std::unordered_map<std::string, std::shared_ptr<const CachedResponse>> response_cache;
+
+  std::array<StateSnapshotSlot, NUM_STATE_VIEWS> state_snapshots;
+  std::unique_ptr<struct event, void (*)(struct event*)> publish_state_snapshot_event;
+
   std::unordered_set<std::shared_ptr<WebsocketClient>> rare_drop_subscribers;
 
   std::unordered_map<struct bufferevent*, std::shared_ptr<WebsocketClient>> bev_to_websocket_client;
@@ -100,15 +152,35 @@ protected:
   static phosg::JSON generate_game_client_json_st(std::shared_ptr<const Client> c, std::shared_ptr<const ItemNameIndex> item_name_index);
   static phosg::JSON generate_proxy_client_json_st(std::shared_ptr<const ProxyServer::LinkedSession> ses);
   static phosg::JSON generate_lobby_json_st(std::shared_ptr<const Lobby> l, std::shared_ptr<const ItemNameIndex> item_name_index);
+  // These must only be called on the event thread
   phosg::JSON generate_game_server_clients_json() const;
   phosg::JSON generate_proxy_server_clients_json() const;
   phosg::JSON generate_server_info_json() const;
   phosg::JSON generate_lobbies_json() const;
   phosg::JSON generate_summary_json() const;
-  phosg::JSON generate_all_json() const;
-
-  phosg::JSON generate_ep3_cards_json(bool trial) const;
-  phosg::JSON generate_common_tables_json() const;
-  phosg::JSON generate_rare_tables_json() const;
-  phosg::JSON generate_rare_table_json(const std::string& table_name) const;
+  phosg::JSON generate_state_view_json(StateView view) const;
+
+  static void dispatch_publish_state_snapshot(evutil_socket_t fd, short events, void* ctx);
+  void publish_state_snapshot();
+  // Returns the most recent snapshot of the given view. If the snapshot is
+  // stale, returns it anyway and schedules a refresh; this only waits for the
+  // event thread if there is no snapshot at all. If max_age_usecs is not null,
+  // it is set to the snapshot's age if that is greater than its current value.
+  // This must only be called on the HTTP thread.
+  std::shared_ptr<const phosg::JSON> get_state_view(StateView view, uint64_t* max_age_usecs = nullptr);
+  phosg::JSON generate_all_json(uint64_t* max_age_usecs = nullptr);
+
+  // Returns the cached response for key if all of its sources are still the
+  // same objects as those given; otherwise, calls generate, serializes the
+  // result, and caches it
+  std::shared_ptr<const CachedResponse> get_cached_response(
+      const std::string& key,
+      uint32_t serialize_options,
+      std::vector<std::shared_ptr<const void>>&& sources,
+      std::function<phosg::JSON()> generate);
+  std::shared_ptr<const CachedResponse> generate_ep3_cards_response(bool trial, uint32_t serialize_options);
+  std::shared_ptr<const CachedResponse> generate_common_tables_response(uint32_t serialize_options);
+  std::shared_ptr<const CachedResponse> generate_rare_tables_response(uint32_t serialize_options);
+  std::shared_ptr<const CachedResponse> generate_rare_table_response(const std::string& table_name, uint32_t serialize_options);
+  std::shared_ptr<const CachedResponse> generate_config_response(uint32_t serialize_options);
 };
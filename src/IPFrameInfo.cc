@@ -1,8 +1,19 @@
 #include "IPFrameInfo.hh"
 
 #include <inttypes.h>
+#include <string.h>
 
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include <array>
+#include <bit>
+#include <phosg/Random.hh>
 #include <phosg/Strings.hh>
+#include <phosg/Time.hh>
+#include <random>
+#include <vector>
 
 using namespace std;
 
@@ -13,6 +24,161 @@ static inline uint16_t collapse_checksum(uint32_t sum) {
   return (sum & 0xFFFF) + (sum >> 16);
 }
 
+static inline uint16_t collapse_checksum64(uint64_t sum) {
+  // Since 0xFFFF divides 0xFFFFFFFF, folding the high 32 bits into the low 32
+  // bits (with end-around carry) doesn't change the 16-bit result
+  sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+  sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+  return collapse_checksum(sum);
+}
+
+// Returns the ones' complement sum of data as native-endian 16-bit words. The
+// sum is independent of byte order except that the result is byteswapped (RFC
+// 1071), so we can load words in the native order and only swap the result.
+static uint16_t native_ones_complement_sum(const uint8_t* data, size_t size) {
+  uint64_t sum = 0;
+
+#if defined(__AVX2__) || defined(__SSE2__)
+  // Each 16-bit word is zero-extended into a 32-bit lane before it's added, so
+  // each lane grows by at most 0x1FFFE per block. We fold the lanes into sum
+  // after at most 0x8000 blocks, before any of them can overflow.
+  static constexpr size_t MAX_BLOCKS_PER_FOLD = 0x8000;
+#endif
+#if defined(__AVX2__)
+  const __m256i zero256 = _mm256_setzero_si256();
+  while (size >= 32) {
+    size_t num_blocks = min<size_t>(size / 32, MAX_BLOCKS_PER_FOLD);
+    __m256i acc = zero256;
+    for (size_t z = 0; z < num_blocks; z++) {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+      acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero256));
+      acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero256));
+      data += 32;
+    }
+    size -= num_blocks * 32;
+    uint32_t lanes[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+    for (uint32_t lane : lanes) {
+      sum += lane;
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i zero128 = _mm_setzero_si128();
+  while (size >= 16) {
+    size_t num_blocks = min<size_t>(size / 16, MAX_BLOCKS_PER_FOLD);
+    __m128i acc = zero128;
+    for (size_t z = 0; z < num_blocks; z++) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+      acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero128));
+      acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero128));
+      data += 16;
+    }
+    size -= num_blocks * 16;
+    uint32_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+    for (uint32_t lane : lanes) {
+      sum += lane;
+    }
+  }
+#endif
+
+  // Scalar fallback (and the tail of the data on x86). Summing 32-bit words
+  // into a 64-bit accumulator is equivalent to summing 16-bit words, since the
+  // carries out of the low halves are accounted for when the sum is collapsed.
+  for (; size >= 4; data += 4, size -= 4) {
+    uint32_t w;
+    memcpy(&w, data, sizeof(w));
+    sum += w;
+  }
+  if (size >= 2) {
+    uint16_t w;
+    memcpy(&w, data, sizeof(w));
+    sum += w;
+    data += 2;
+    size -= 2;
+  }
+  if (size) {
+    // The odd byte is the high byte of a big-endian word, so it's the low byte
+    // of a little-endian word
+    sum += (std::endian::native == std::endian::little) ? *data : (*data << 8);
+  }
+
+  return collapse_checksum64(sum);
+}
+
+uint16_t ones_complement_sum(const void* data, size_t size, uint16_t initial_sum) {
+  uint16_t native_sum = native_ones_complement_sum(reinterpret_cast<const uint8_t*>(data), size);
+  uint16_t be_sum = (std::endian::native == std::endian::little) ? phosg::bswap16(native_sum) : native_sum;
+  return collapse_checksum(static_cast<uint32_t>(initial_sum) + be_sum);
+}
+
+static uint16_t bytewise_ones_complement_sum(const void* data, size_t size) {
+  const uint8_t* u8_data = reinterpret_cast<const uint8_t*>(data);
+  uint32_t sum = 0;
+  for (size_t offset = 0; offset + 2 <= size; offset += 2) {
+    sum = collapse_checksum(sum + ((u8_data[offset] << 8) | u8_data[offset + 1]));
+  }
+  if (size & 1) {
+    sum = collapse_checksum(sum + (u8_data[size - 1] << 8));
+  }
+  return sum;
+}
+
+void ip_checksum_speed_test(uint64_t seed) {
+  uint32_t effective_seed = (seed & 0xFFFFFFFF00000000) ? phosg::random_object<uint32_t>() : seed;
+  fprintf(stderr, "IP checksum speed test with seed=%08" PRIX32 "\n", effective_seed);
+  mt19937 rng(effective_seed);
+
+  // These are the sizes of a bare TCP ACK, a typical PSO command, a full
+  // Ethernet frame, and an odd-sized frame (to exercise the tail handling)
+  static const array<size_t, 4> frame_sizes = {0x28, 0x1A0, 0x5DC, 0x5DB};
+  static constexpr size_t num_frames = 0x100;
+  static constexpr size_t num_iterations = 0x100;
+  for (size_t frame_size : frame_sizes) {
+    vector<string> frames;
+    for (size_t z = 0; z < num_frames; z++) {
+      string& frame = frames.emplace_back(frame_size, '\0');
+      for (auto& ch : frame) {
+        ch = rng();
+      }
+    }
+
+    size_t num_disagreements = 0;
+    uint64_t time_slow = 0;
+    uint64_t time_fast = 0;
+    uint32_t slow_result = 0;
+    uint32_t fast_result = 0;
+    for (size_t iteration = 0; iteration < num_iterations; iteration++) {
+      uint64_t start = phosg::now();
+      for (const auto& frame : frames) {
+        slow_result += bytewise_ones_complement_sum(frame.data(), frame.size());
+      }
+      time_slow += phosg::now() - start;
+
+      start = phosg::now();
+      for (const auto& frame : frames) {
+        fast_result += ones_complement_sum(frame.data(), frame.size());
+      }
+      time_fast += phosg::now() - start;
+    }
+    for (const auto& frame : frames) {
+      if (bytewise_ones_complement_sum(frame.data(), frame.size()) != ones_complement_sum(frame.data(), frame.size())) {
+        num_disagreements++;
+      }
+    }
+
+    size_t total_frames = num_frames * num_iterations;
+    fprintf(stderr, "Frame size 0x%zX (%zu frames):\n", frame_size, total_frames);
+    fprintf(stderr, "  Total time (slow): %" PRIu64 " usecs (%g nsecs per frame; result %08" PRIX32 ")\n",
+        time_slow, static_cast<double>(time_slow * 1000) / total_frames, slow_result);
+    fprintf(stderr, "  Total time (fast): %" PRIu64 " usecs (%g nsecs per frame; result %08" PRIX32 ")\n",
+        time_fast, static_cast<double>(time_fast * 1000) / total_frames, fast_result);
+    fprintf(stderr, "  Fast vs. slow speedup: %gx\n", static_cast<double>(time_slow) / max<uint64_t>(time_fast, 1));
+    fprintf(stderr, "  Disagreements: %zu\n", num_disagreements);
+  }
+}
+
 FrameInfo::FrameInfo(LinkType link_type, const string& data)
     : FrameInfo(link_type, data.data(), data.size()) {}
 
@@ -244,14 +410,7 @@ uint16_t FrameInfo::computed_udp4_checksum(
       udp.dest_port +
       udp.size;
 
-  const uint8_t* u8_data = reinterpret_cast<const uint8_t*>(data);
-  for (size_t offset = 0; offset + 2 <= size; offset += 2) {
-    sum += *reinterpret_cast<const be_uint16_t*>(u8_data + offset);
-  }
-  if (size & 1) {
-    sum += u8_data[size - 1] << 8;
-  }
-  return ~collapse_checksum(sum);
+  return ~ones_complement_sum(data, size, collapse_checksum(sum));
 }
 
 uint16_t FrameInfo::computed_udp4_checksum() const {
@@ -285,14 +444,7 @@ uint16_t FrameInfo::computed_tcp4_checksum(
       tcp.window +
       tcp.urgent_ptr;
 
-  const uint8_t* u8_data = reinterpret_cast<const uint8_t*>(data);
-  for (size_t offset = 0; offset + 2 <= size; offset += 2) {
-    sum += *reinterpret_cast<const be_uint16_t*>(u8_data + offset);
-  }
-  if (size & 1) {
-    sum += u8_data[size - 1] << 8;
-  }
-  return ~collapse_checksum(sum);
+  return ~ones_complement_sum(data, size, collapse_checksum(sum));
 }
 
 uint16_t FrameInfo::computed_tcp4_checksum() const {
@@ -308,13 +460,23 @@ uint16_t FrameInfo::computed_tcp4_checksum() const {
 }
 
 uint16_t FrameInfo::computed_hdlc_checksum(const void* vdata, size_t size) {
+  // This is the CRC-16 used by PPP (RFC 1662), computed a byte at a time
+  static const auto table = []() -> array<uint16_t, 0x100> {
+    array<uint16_t, 0x100> ret;
+    for (size_t z = 0; z < 0x100; z++) {
+      uint16_t crc = z;
+      for (size_t b = 0; b < 8; b++) {
+        crc = (crc & 1) ? ((crc >> 1) ^ 0x8408) : (crc >> 1);
+      }
+      ret[z] = crc;
+    }
+    return ret;
+  }();
+
   const uint8_t* data = reinterpret_cast<const uint8_t*>(vdata);
   uint16_t crc = 0xFFFF;
   for (size_t z = 0; z < size; z++) {
-    crc ^= data[z];
-    for (size_t b = 0; b < 8; b++) {
-      crc = (crc & 1) ? ((crc >> 1) ^ 0x8408) : (crc >> 1);
-    }
+    crc = (crc >> 8) ^ table[(crc ^ data[z]) & 0xFF];
   }
   return ~crc;
 }
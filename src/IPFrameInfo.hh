@@ -107,6 +107,18 @@ struct DHCPHeader {
   // Options follow here, terminated with FF
 } __packed_ws__(DHCPHeader, 0xF0);
 
+// Returns the 16-bit ones' complement sum of data (treated as a sequence of
+// big-endian 16-bit words, with a zero byte appended if size is odd) added to
+// initial_sum. The result is not inverted, so it can be passed as initial_sum
+// in another call to checksum more data, as long as all chunks except the last
+// have even sizes.
+uint16_t ones_complement_sum(const void* data, size_t size, uint16_t initial_sum = 0);
+
+// Compares the speed of ones_complement_sum against a simple byte-wise
+// implementation over synthetic frames of various sizes, and checks that they
+// produce the same results
+void ip_checksum_speed_test(uint64_t seed = 0xFFFFFFFFFFFFFFFF);
+
 struct FrameInfo {
   enum class LinkType {
     ETHERNET = 0,
@@ -20,6 +20,11 @@
 using namespace std;
 
 static const size_t DEFAULT_RESEND_PUSH_USECS = 200000; // 200ms
+// The congestion window starts at this many segments and grows by the amount of
+// data acknowledged, up to MAX_CONGESTION_WINDOW_BYTES. It's reduced when data
+// is lost (to one segment on a resend timeout, or by half on a fast retransmit)
+static const size_t INITIAL_CONGESTION_WINDOW_SEGMENTS = 2;
+static const size_t MAX_CONGESTION_WINDOW_BYTES = 0x10000;
 
 static string unescape_hdlc_frame(const void* data, size_t size) {
   phosg::StringReader r(data, size);
@@ -228,6 +233,11 @@ IPStackSimulator::IPClient::TCPConnection::TCPConnection()
       client_port(0),
       next_client_seq(0),
       acked_server_seq(0),
+      next_server_seq(0),
+      max_server_seq(0),
+      client_window(0),
+      congestion_window(0),
+      num_duplicate_acks(0),
       resend_push_usecs(DEFAULT_RESEND_PUSH_USECS),
       next_push_max_frame_size(1024),
       max_frame_size(1024),
@@ -239,6 +249,23 @@ void IPStackSimulator::disconnect_client(uint64_t network_id) {
   this->network_id_to_client.erase(network_id);
 }
 
+static bool is_local_address(const struct sockaddr_storage& ss) {
+  switch (ss.ss_family) {
+    case AF_UNIX:
+      return true;
+    case AF_INET: {
+      const auto* sin = reinterpret_cast<const struct sockaddr_in*>(&ss);
+      return ((ntohl(sin->sin_addr.s_addr) & 0xFF000000) == 0x7F000000);
+    }
+    case AF_INET6: {
+      const auto* sin6 = reinterpret_cast<const struct sockaddr_in6*>(&ss);
+      return IN6_IS_ADDR_LOOPBACK(&sin6->sin6_addr);
+    }
+    default:
+      return false;
+  }
+}
+
 void IPStackSimulator::dispatch_on_listen_accept(
     struct evconnlistener* listener, evutil_socket_t fd,
     struct sockaddr* address, int socklen, void* ctx) {
@@ -269,6 +296,7 @@ void IPStackSimulator::on_listen_accept(struct evconnlistener* listener, evutil_
 
   struct bufferevent* bev = bufferevent_socket_new(this->base.get(), fd, BEV_OPT_CLOSE_ON_FREE | BEV_OPT_DEFER_CALLBACKS);
   auto c = make_shared<IPClient>(this->shared_from_this(), network_id, listening_socket->protocol, bev);
+  c->verify_checksums = this->state->ip_stack_verify_local_checksums || !is_local_address(remote_addr);
   this->network_id_to_client.emplace(c->network_id, c);
 
   bufferevent_setcb(bev, &IPStackSimulator::IPClient::dispatch_on_client_input, nullptr,
@@ -507,12 +535,14 @@ void IPStackSimulator::on_client_frame(shared_ptr<IPClient> c, const string& fra
       throw runtime_error("client sent IPv4 packet from different MAC address");
     }
   } else if (fi.hdlc) {
-    uint16_t expected_checksum = fi.computed_hdlc_checksum();
-    uint16_t stored_checksum = fi.stored_hdlc_checksum();
-    if (expected_checksum != stored_checksum) {
-      throw runtime_error(phosg::string_printf(
-          "HDLC checksum is incorrect (%04hX expected, %04hX received)",
-          expected_checksum, stored_checksum));
+    if (c->verify_checksums) {
+      uint16_t expected_checksum = fi.computed_hdlc_checksum();
+      uint16_t stored_checksum = fi.stored_hdlc_checksum();
+      if (expected_checksum != stored_checksum) {
+        throw runtime_error(phosg::string_printf(
+            "HDLC checksum is incorrect (%04hX expected, %04hX received)",
+            expected_checksum, stored_checksum));
+      }
     }
   } else {
     throw runtime_error("frame is not Ethernet or HDLC");
@@ -531,11 +561,13 @@ void IPStackSimulator::on_client_frame(shared_ptr<IPClient> c, const string& fra
     this->on_client_arp_frame(c, fi);
 
   } else if (fi.ipv4) {
-    uint16_t expected_ipv4_checksum = fi.computed_ipv4_header_checksum();
-    if (fi.ipv4->checksum != expected_ipv4_checksum) {
-      throw runtime_error(phosg::string_printf(
-          "IPv4 header checksum is incorrect (%04hX expected, %04hX received)",
-          expected_ipv4_checksum, fi.ipv4->checksum.load()));
+    if (c->verify_checksums) {
+      uint16_t expected_ipv4_checksum = fi.computed_ipv4_header_checksum();
+      if (fi.ipv4->checksum != expected_ipv4_checksum) {
+        throw runtime_error(phosg::string_printf(
+            "IPv4 header checksum is incorrect (%04hX expected, %04hX received)",
+            expected_ipv4_checksum, fi.ipv4->checksum.load()));
+      }
     }
 
     if ((fi.ipv4->src_addr != c->ipv4_addr) && (fi.ipv4->src_addr != 0)) {
@@ -543,20 +575,24 @@ void IPStackSimulator::on_client_frame(shared_ptr<IPClient> c, const string& fra
     }
 
     if (fi.udp) {
-      uint16_t expected_udp_checksum = fi.computed_udp4_checksum();
-      if (fi.udp->checksum != expected_udp_checksum) {
-        throw runtime_error(phosg::string_printf(
-            "UDP checksum is incorrect (%04hX expected, %04hX received)",
-            expected_udp_checksum, fi.udp->checksum.load()));
+      if (c->verify_checksums) {
+        uint16_t expected_udp_checksum = fi.computed_udp4_checksum();
+        if (fi.udp->checksum != expected_udp_checksum) {
+          throw runtime_error(phosg::string_printf(
+              "UDP checksum is incorrect (%04hX expected, %04hX received)",
+              expected_udp_checksum, fi.udp->checksum.load()));
+        }
       }
       this->on_client_udp_frame(c, fi);
 
     } else if (fi.tcp) {
-      uint16_t expected_tcp_checksum = fi.computed_tcp4_checksum();
-      if (fi.tcp->checksum != expected_tcp_checksum) {
-        throw runtime_error(phosg::string_printf(
-            "TCP checksum is incorrect (%04hX expected, %04hX received)",
-            expected_tcp_checksum, fi.tcp->checksum.load()));
+      if (c->verify_checksums) {
+        uint16_t expected_tcp_checksum = fi.computed_tcp4_checksum();
+        if (fi.tcp->checksum != expected_tcp_checksum) {
+          throw runtime_error(phosg::string_printf(
+              "TCP checksum is incorrect (%04hX expected, %04hX received)",
+              expected_tcp_checksum, fi.tcp->checksum.load()));
+        }
       }
       this->on_client_tcp_frame(c, fi);
 
@@ -1136,6 +1172,11 @@ void IPStackSimulator::on_client_tcp_frame(
       conn.client_port = fi.tcp->src_port;
       conn.next_client_seq = fi.tcp->seq_num + 1;
       conn.acked_server_seq = phosg::random_object<uint32_t>();
+      conn.next_server_seq = conn.acked_server_seq;
+      conn.max_server_seq = conn.acked_server_seq;
+      conn.client_window = fi.tcp->window;
+      conn.congestion_window = max_frame_size * INITIAL_CONGESTION_WINDOW_SEGMENTS;
+      conn.num_duplicate_acks = 0;
       conn.resend_push_usecs = DEFAULT_RESEND_PUSH_USECS;
       conn.next_push_max_frame_size = max_frame_size;
       conn.awaiting_first_ack = true;
@@ -1175,29 +1216,40 @@ void IPStackSimulator::on_client_tcp_frame(
     }
     bool conn_valid = true;
     bool acked_seq_changed = false;
+    bool should_fast_retransmit = false;
 
     if (fi.tcp->flags & TCPHeader::Flag::ACK) {
       ip_stack_simulator_log.debug("Client sent ACK %08" PRIX32, fi.tcp->ack_num.load());
+      conn->client_window = fi.tcp->window;
       if (conn->awaiting_first_ack) {
         if (fi.tcp->ack_num != conn->acked_server_seq + 1) {
           throw runtime_error("first ack_num was not acked_server_seq + 1");
         }
         conn->acked_server_seq++;
+        conn->next_server_seq = conn->acked_server_seq;
+        conn->max_server_seq = conn->acked_server_seq;
         conn->awaiting_first_ack = false;
 
       } else {
         if (seq_num_greater(fi.tcp->ack_num, conn->acked_server_seq)) {
           ip_stack_simulator_log.debug("Advancing acked_server_seq from %08" PRIX32, conn->acked_server_seq);
+          // Validate against max_server_seq rather than next_server_seq, since
+          // an ACK for data sent before a resend timeout may arrive after
+          // next_server_seq was rewound
           uint32_t ack_delta = fi.tcp->ack_num - conn->acked_server_seq;
-          size_t pending_bytes = evbuffer_get_length(conn->pending_data.get());
-          if (pending_bytes < ack_delta) {
+          if (static_cast<uint32_t>(conn->max_server_seq - conn->acked_server_seq) < ack_delta) {
             throw runtime_error("client acknowledged beyond end of sent data");
           }
 
           evbuffer_drain(conn->pending_data.get(), ack_delta);
           conn->acked_server_seq += ack_delta;
+          if (seq_num_greater(conn->acked_server_seq, conn->next_server_seq)) {
+            conn->next_server_seq = conn->acked_server_seq;
+          }
+          conn->num_duplicate_acks = 0;
           conn->resend_push_usecs = DEFAULT_RESEND_PUSH_USECS;
           conn->next_push_max_frame_size = conn->max_frame_size;
+          conn->congestion_window = min<size_t>(conn->congestion_window + ack_delta, MAX_CONGESTION_WINDOW_BYTES);
           acked_seq_changed = true;
 
           ip_stack_simulator_log.debug("Removed %08" PRIX32 " bytes from pending buffer and advanced acked_server_seq to %08" PRIX32,
@@ -1205,6 +1257,15 @@ void IPStackSimulator::on_client_tcp_frame(
 
         } else if (seq_num_less(fi.tcp->ack_num, conn->acked_server_seq)) {
           throw runtime_error("client sent lower ack num than previous frame");
+
+        } else if ((fi.payload_size == 0) && conn->bytes_in_flight() &&
+            !(fi.tcp->flags & (TCPHeader::Flag::RST | TCPHeader::Flag::FIN))) {
+          // The client received a frame after a gap in the data it expected, so
+          // a frame was probably lost. After three duplicate ACKs, resend the
+          // first unacknowledged frame without waiting for the resend timer.
+          if (++conn->num_duplicate_acks == 3) {
+            should_fast_retransmit = true;
+          }
         }
       }
 
@@ -1308,9 +1369,18 @@ void IPStackSimulator::on_client_tcp_frame(
           conn_str.c_str(), conn->acked_server_seq, conn->next_client_seq, conn->bytes_received);
     }
 
-    if (conn_valid && acked_seq_changed) {
-      // Try to send some more data if the client is waiting on it
-      this->send_pending_push_frame(c, *conn, true);
+    if (conn_valid && should_fast_retransmit) {
+      size_t bytes_to_send = min<size_t>(conn->bytes_in_flight(), conn->next_push_max_frame_size);
+      ip_stack_simulator_log.debug("Received 3 duplicate ACKs; resending 0x%zX bytes at %08" PRIX32,
+          bytes_to_send, conn->acked_server_seq);
+      this->send_tcp_data_frame(c, *conn, 0, bytes_to_send);
+      conn->congestion_window = max<size_t>(conn->bytes_in_flight() / 2, conn->max_frame_size);
+    }
+
+    if (conn_valid && (acked_seq_changed || (fi.tcp->flags & TCPHeader::Flag::ACK))) {
+      // Try to send some more data if the client is waiting on it (the client
+      // may also have opened its window without acknowledging anything new)
+      this->send_pending_push_frames(c, *conn, acked_seq_changed);
     }
   }
 }
@@ -1360,42 +1430,61 @@ void IPStackSimulator::open_server_connection(shared_ptr<IPClient> c, IPClient::
   }
 }
 
-void IPStackSimulator::send_pending_push_frame(
-    shared_ptr<IPClient> c, IPClient::TCPConnection& conn, bool always_send) {
+void IPStackSimulator::send_pending_push_frames(
+    shared_ptr<IPClient> c, IPClient::TCPConnection& conn, bool restart_resend_timer) {
   size_t pending_bytes = evbuffer_get_length(conn.pending_data.get());
   if (!pending_bytes) {
     event_del(conn.resend_push_event.get());
     return;
   }
 
-  // If we're waiting to receive an ACK from the client, don't send another PSH
-  // until we get the ACK (unless this is a resend of a previous PSH due to a
-  // timeout)
-  if (!always_send && event_pending(conn.resend_push_event.get(), EV_TIMEOUT, nullptr)) {
-    return;
-  }
-
-  size_t bytes_to_send = min<size_t>(pending_bytes, conn.next_push_max_frame_size);
+  size_t segment_size = conn.next_push_max_frame_size;
+  size_t window = min<size_t>(conn.client_window, conn.congestion_window);
   if (c->protocol == Protocol::HDLC_TAPSERVER) {
     // There is a bug in Dolphin's modem implementation (which I wrote, so it's
     // my fault) that causes commands to be dropped when too much data is sent
     // at once. To work around this, we only send up to 200 bytes in each push
-    // frame.
-    bytes_to_send = min<size_t>(bytes_to_send, 200);
+    // frame, and only one frame at a time.
+    segment_size = min<size_t>(segment_size, 200);
+    window = segment_size;
+  }
+  // Always allow at least one frame in flight, even if the client's window is
+  // smaller than that; otherwise, the connection could stall forever
+  window = max<size_t>(window, min<size_t>(segment_size, pending_bytes));
+
+  while ((conn.bytes_in_flight() < pending_bytes) && (conn.bytes_in_flight() < window)) {
+    size_t offset = conn.bytes_in_flight();
+    size_t bytes_to_send = min<size_t>({segment_size, pending_bytes - offset, window - offset});
+    ip_stack_simulator_log.debug("Sending PSH frame with seq_num %08" PRIX32 ", 0x%zX/0x%zX data bytes",
+        conn.next_server_seq, bytes_to_send, pending_bytes - offset);
+    this->send_tcp_data_frame(c, conn, offset, bytes_to_send);
+    conn.next_server_seq += bytes_to_send;
+    if (seq_num_greater(conn.next_server_seq, conn.max_server_seq)) {
+      conn.max_server_seq = conn.next_server_seq;
+    }
+    conn.bytes_sent += bytes_to_send;
   }
 
-  ip_stack_simulator_log.debug("Sending PSH frame with seq_num %08" PRIX32 ", 0x%zX/0x%zX data bytes",
-      conn.acked_server_seq, bytes_to_send, pending_bytes);
-
-  this->send_tcp_frame(c, conn, TCPHeader::Flag::PSH, conn.pending_data.get(), bytes_to_send);
-  struct timeval resend_push_timeout = phosg::usecs_to_timeval(conn.resend_push_usecs);
-  event_add(conn.resend_push_event.get(), &resend_push_timeout);
+  if (conn.bytes_in_flight() && (restart_resend_timer || !event_pending(conn.resend_push_event.get(), EV_TIMEOUT, nullptr))) {
+    struct timeval resend_push_timeout = phosg::usecs_to_timeval(conn.resend_push_usecs);
+    event_add(conn.resend_push_event.get(), &resend_push_timeout);
+  }
+}
 
-  // If the client isn't responding to our PSHes, back off exponentially up to
-  // a limit of 5 seconds between PSH frames. This window is reset when
+void IPStackSimulator::on_resend_push_timeout(shared_ptr<IPClient> c, IPClient::TCPConnection& conn) {
+  // The client hasn't acknowledged anything recently, so assume all the data in
+  // flight was lost and send it again, starting with only one frame. If the
+  // client isn't responding to our PSHes, back off exponentially up to a limit
+  // of 5 seconds between PSH frames. This window is reset when
   // acked_server_seq changes (that is, when the client has acknowledged any new
   // data). It seems some situations cause GameCube clients to drop packets more
   // often; to alleviate this, we also try to resend less data.
+  ip_stack_simulator_log.debug("Resend timer expired with 0x%zX bytes in flight", conn.bytes_in_flight());
+  conn.next_server_seq = conn.acked_server_seq;
+  conn.num_duplicate_acks = 0;
+  conn.congestion_window = conn.next_push_max_frame_size;
+  this->send_pending_push_frames(c, conn, true);
+
   conn.resend_push_usecs *= 2;
   if (conn.resend_push_usecs > 5000000) {
     conn.resend_push_usecs = 5000000;
@@ -1403,13 +1492,29 @@ void IPStackSimulator::send_pending_push_frame(
   conn.next_push_max_frame_size = max<size_t>(0x100, conn.next_push_max_frame_size - 0x100);
 }
 
+void IPStackSimulator::send_tcp_data_frame(
+    shared_ptr<IPClient> c, IPClient::TCPConnection& conn, size_t offset, size_t size) {
+  string data(size, '\0');
+  struct evbuffer_ptr pos;
+  if (evbuffer_ptr_set(conn.pending_data.get(), &pos, offset, EVBUFFER_PTR_SET) ||
+      (evbuffer_copyout_from(conn.pending_data.get(), &pos, data.data(), size) != static_cast<ssize_t>(size))) {
+    throw logic_error("pending data range is out of bounds");
+  }
+  this->send_tcp_frame(c, conn, TCPHeader::Flag::PSH, conn.acked_server_seq + offset, data.data(), data.size());
+}
+
+void IPStackSimulator::send_tcp_frame(shared_ptr<IPClient> c, IPClient::TCPConnection& conn, uint16_t flags) {
+  this->send_tcp_frame(c, conn, flags, conn.next_server_seq, nullptr, 0);
+}
+
 void IPStackSimulator::send_tcp_frame(
     shared_ptr<IPClient> c,
     IPClient::TCPConnection& conn,
     uint16_t flags,
-    struct evbuffer* src_buf,
-    size_t src_bytes) {
-  if (!src_bytes != !(flags & TCPHeader::Flag::PSH)) {
+    uint32_t seq_num,
+    const void* data,
+    size_t size) {
+  if (!size != !(flags & TCPHeader::Flag::PSH)) {
     throw logic_error("data should be given if and only if PSH is given");
   }
 
@@ -1428,24 +1533,22 @@ void IPStackSimulator::send_tcp_frame(
   TCPHeader tcp;
   tcp.src_port = conn.server_port;
   tcp.dest_port = conn.client_port;
-  tcp.seq_num = conn.acked_server_seq;
+  tcp.seq_num = seq_num;
   tcp.ack_num = conn.next_client_seq;
   tcp.flags = (5 << 12) | TCPHeader::Flag::ACK | flags;
   tcp.window = 0x1000;
   tcp.urgent_ptr = 0;
   // tcp.checksum filled in later
 
-  ipv4.size = sizeof(IPv4Header) + sizeof(TCPHeader) + src_bytes;
+  ipv4.size = sizeof(IPv4Header) + sizeof(TCPHeader) + size;
   ipv4.checksum = FrameInfo::computed_ipv4_header_checksum(ipv4);
-
-  const void* linear_data = src_bytes ? evbuffer_pullup(src_buf, src_bytes) : nullptr;
-  tcp.checksum = FrameInfo::computed_tcp4_checksum(ipv4, tcp, linear_data, src_bytes);
+  tcp.checksum = FrameInfo::computed_tcp4_checksum(ipv4, tcp, data, size);
 
   phosg::StringWriter w;
   w.put(ipv4);
   w.put(tcp);
-  if (src_bytes) {
-    w.write(linear_data, src_bytes);
+  if (size) {
+    w.write(data, size);
   }
 
   this->send_layer3_frame(c, FrameInfo::Protocol::IPV4, w.str());
@@ -1461,7 +1564,7 @@ void IPStackSimulator::dispatch_on_resend_push(evutil_socket_t, short, void* ctx
     if (!sim) {
       ip_stack_simulator_log.warning("Resend push event triggered for client on deleted simulator; ignoring");
     } else {
-      sim->send_pending_push_frame(c, *conn, true);
+      sim->on_resend_push_timeout(c, *conn);
     }
   }
 }
@@ -1492,7 +1595,7 @@ void IPStackSimulator::on_server_input(shared_ptr<IPClient> c, IPClient::TCPConn
   event_add(c->idle_timeout_event.get(), &tv);
 
   evbuffer_add_buffer(conn.pending_data.get(), buf);
-  this->send_pending_push_frame(c, conn, false);
+  this->send_pending_push_frames(c, conn, false);
 }
 
 void IPStackSimulator::dispatch_on_server_error(
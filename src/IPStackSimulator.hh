@@ -37,6 +37,9 @@ public:
     uint32_t hdlc_remote_magic_number = 0;
     parray<uint8_t, 6> mac_addr; // Only used for LinkType::ETHERNET
     uint32_t ipv4_addr;
+    // False if the client is connected via a local link (Unix socket or
+    // loopback) and IPStackVerifyLocalChecksums is disabled
+    bool verify_checksums = true;
 
     struct TCPConnection {
       std::weak_ptr<IPClient> client;
@@ -47,9 +50,17 @@ public:
       // (receive SYN, send SYN+ACK, receive ACK). This means server_bev is null
       // during the first part of the connection phase.
       unique_bufferevent server_bev;
+      // pending_data contains all data from acked_server_seq onward; the first
+      // (next_server_seq - acked_server_seq) bytes have been sent but not yet
+      // acknowledged by the client. After a resend timeout, next_server_seq is
+      // rewound to acked_server_seq, but the client may still acknowledge data
+      // up to max_server_seq (the highest sequence number ever sent) from
+      // before the rewind.
       // TODO: Get rid of pending_data and just use server_bev's input buffer in
       // its place
       unique_evbuffer pending_data;
+      // Fires if the client doesn't acknowledge any new data for
+      // resend_push_usecs; when this happens, all unacknowledged data is resent
       unique_event resend_push_event;
 
       bool awaiting_first_ack;
@@ -59,12 +70,21 @@ public:
       uint16_t client_port;
       uint32_t next_client_seq;
       uint32_t acked_server_seq;
+      uint32_t next_server_seq;
+      uint32_t max_server_seq;
+      size_t client_window; // As advertised in the client's most recent frame
+      size_t congestion_window;
+      size_t num_duplicate_acks;
       size_t resend_push_usecs;
       size_t next_push_max_frame_size;
       size_t max_frame_size;
       size_t bytes_received;
       size_t bytes_sent;
 
+      inline size_t bytes_in_flight() const {
+        return this->next_server_seq - this->acked_server_seq;
+      }
+
       TCPConnection();
     };
     std::unordered_map<uint64_t, TCPConnection> tcp_connections;
@@ -155,13 +175,21 @@ private:
   void on_server_error(std::shared_ptr<IPClient> c, IPClient::TCPConnection& conn, short events);
 
   static void dispatch_on_resend_push(evutil_socket_t, short, void* ctx);
-  void send_pending_push_frame(std::shared_ptr<IPClient> c, IPClient::TCPConnection& conn, bool always_send);
+  void on_resend_push_timeout(std::shared_ptr<IPClient> c, IPClient::TCPConnection& conn);
+  // Sends as much pending data as the client's window and the congestion
+  // window allow. If restart_resend_timer is true, the resend timer is
+  // restarted (this should be done when the client acknowledges new data);
+  // otherwise, it's only started if it isn't already running.
+  void send_pending_push_frames(std::shared_ptr<IPClient> c, IPClient::TCPConnection& conn, bool restart_resend_timer);
+  void send_tcp_data_frame(std::shared_ptr<IPClient> c, IPClient::TCPConnection& conn, size_t offset, size_t size);
+  void send_tcp_frame(std::shared_ptr<IPClient> c, IPClient::TCPConnection& conn, uint16_t flags = 0);
   void send_tcp_frame(
       std::shared_ptr<IPClient> c,
       IPClient::TCPConnection& conn,
-      uint16_t flags = 0,
-      struct evbuffer* src_buf = nullptr,
-      size_t src_bytes = 0);
+      uint16_t flags,
+      uint32_t seq_num,
+      const void* data,
+      size_t size);
 
   void open_server_connection(std::shared_ptr<IPClient> c, IPClient::TCPConnection& conn);
 
@@ -107,6 +107,112 @@ ItemParameterTable::ItemParameterTable(shared_ptr<const string> data, Version ve
   }
 
   this->first_rare_mag_index = 0x28;
+
+  this->decode_all_definitions();
+}
+
+void ItemParameterTable::decode_all_definitions() {
+  // Classes that can't be read (e.g. because the table is truncated) are left
+  // empty, so looking up any item in them throws out_of_range, just as it
+  // would if we read the definitions from the data on demand
+  if (!this->offsets_v4) {
+    this->decoded_weapons.resize(this->num_weapon_classes);
+    for (size_t data1_1 = 0; data1_1 < this->num_weapon_classes; data1_1++) {
+      try {
+        size_t count = this->num_weapons_in_class(data1_1);
+        auto& decoded = this->decoded_weapons[data1_1];
+        decoded.reserve(count);
+        for (size_t data1_2 = 0; data1_2 < count; data1_2++) {
+          decoded.emplace_back(this->decode_weapon(data1_1, data1_2));
+        }
+      } catch (const out_of_range&) {
+        this->decoded_weapons[data1_1].clear();
+      }
+    }
+
+    for (size_t data1_1 = 1; data1_1 <= 2; data1_1++) {
+      auto& decoded = this->decoded_armors_and_shields[data1_1 - 1];
+      try {
+        size_t count = this->num_armors_or_shields_in_class(data1_1);
+        decoded.reserve(count);
+        for (size_t data1_2 = 0; data1_2 < count; data1_2++) {
+          decoded.emplace_back(this->decode_armor_or_shield(data1_1, data1_2));
+        }
+      } catch (const out_of_range&) {
+        decoded.clear();
+      }
+    }
+
+    try {
+      size_t count = this->num_units();
+      this->decoded_units.reserve(count);
+      for (size_t data1_2 = 0; data1_2 < count; data1_2++) {
+        this->decoded_units.emplace_back(this->decode_unit(data1_2));
+      }
+    } catch (const out_of_range&) {
+      this->decoded_units.clear();
+    }
+
+    try {
+      size_t count = this->num_mags();
+      this->decoded_mags.reserve(count);
+      for (size_t data1_1 = 0; data1_1 < count; data1_1++) {
+        this->decoded_mags.emplace_back(this->decode_mag(data1_1));
+      }
+    } catch (const out_of_range&) {
+      this->decoded_mags.clear();
+    }
+
+    this->decoded_tools.resize(this->num_tool_classes);
+    for (size_t data1_1 = 0; data1_1 < this->num_tool_classes; data1_1++) {
+      try {
+        size_t count = this->num_tools_in_class(data1_1);
+        auto& decoded = this->decoded_tools[data1_1];
+        decoded.reserve(count);
+        for (size_t data1_2 = 0; data1_2 < count; data1_2++) {
+          decoded.emplace_back(this->decode_tool(data1_1, data1_2));
+        }
+      } catch (const out_of_range&) {
+        this->decoded_tools[data1_1].clear();
+      }
+    }
+  }
+
+  if (this->offsets_gc_nte || this->offsets_v3_be) {
+    try {
+      this->decoded_specials.reserve(this->num_specials);
+      for (size_t z = 0; z < this->num_specials; z++) {
+        this->decoded_specials.emplace_back(this->decode_special(z));
+      }
+    } catch (const out_of_range&) {
+      this->decoded_specials.clear();
+    }
+  }
+
+  uint32_t offset, count;
+  if (this->offsets_dc_protos || this->offsets_v1_v2 || this->offsets_gc_nte) {
+    return;
+  } else if (this->offsets_v3_le) {
+    const auto& co = this->r.pget<ArrayRef>(this->offsets_v3_le->combination_table);
+    offset = co.offset;
+    count = co.count;
+  } else if (this->offsets_v3_be) {
+    const auto& co = this->r.pget<ArrayRefBE>(this->offsets_v3_be->combination_table);
+    offset = co.offset;
+    count = co.count;
+  } else if (this->offsets_v4) {
+    const auto& co = this->r.pget<ArrayRef>(this->offsets_v4->combination_table);
+    offset = co.offset;
+    count = co.count;
+  } else {
+    throw logic_error("table is not v2, v3, or v4");
+  }
+  const auto* defs = &this->r.pget<ItemCombination>(offset, count * sizeof(ItemCombination));
+  for (size_t z = 0; z < count; z++) {
+    const auto& def = defs[z];
+    uint32_t key = (def.used_item[0] << 16) | (def.used_item[1] << 8) | def.used_item[2];
+    this->item_combination_index[key].emplace_back(def);
+  }
 }
 
 set<uint32_t> ItemParameterTable::compute_all_valid_primary_identifiers() const {
@@ -431,6 +537,14 @@ const T& indirect_lookup_2d(const phosg::StringReader& r, size_t root_offset, si
   return r.pget<T>(co.offset + sizeof(T) * item_index);
 }
 
+template <typename T>
+const T& dense_lookup(const std::vector<T>& decoded, size_t item_index) {
+  if (item_index >= decoded.size()) {
+    throw out_of_range("item ID out of range");
+  }
+  return decoded[item_index];
+}
+
 size_t ItemParameterTable::num_weapons_in_class(uint8_t data1_1) const {
   if (data1_1 >= this->num_weapon_classes) {
     throw out_of_range("weapon ID out of range");
@@ -456,30 +570,25 @@ const ItemParameterTable::WeaponV4& ItemParameterTable::get_weapon(uint8_t data1
   if (data1_1 >= this->num_weapon_classes) {
     throw out_of_range("weapon ID out of range");
   }
-
   if (this->offsets_v4) {
     return indirect_lookup_2d<WeaponV4, false>(this->r, this->offsets_v4->weapon_table, data1_1, data1_2);
   }
+  return dense_lookup(this->decoded_weapons[data1_1], data1_2);
+}
 
-  uint16_t key = (data1_1 << 8) | data1_2;
-  try {
-    return this->parsed_weapons.at(key);
-  } catch (const std::out_of_range&) {
-    WeaponV4 def_v4;
-    if (this->offsets_dc_protos) {
-      def_v4 = indirect_lookup_2d<WeaponDCProtos, false>(this->r, this->offsets_dc_protos->weapon_table, data1_1, data1_2).to_v4();
-    } else if (this->offsets_v1_v2) {
-      def_v4 = indirect_lookup_2d<WeaponV1V2, false>(this->r, this->offsets_v1_v2->weapon_table, data1_1, data1_2).to_v4();
-    } else if (this->offsets_gc_nte) {
-      def_v4 = indirect_lookup_2d<WeaponGCNTE, true>(this->r, this->offsets_gc_nte->weapon_table, data1_1, data1_2).to_v4();
-    } else if (this->offsets_v3_le) {
-      def_v4 = indirect_lookup_2d<WeaponV3, false>(this->r, this->offsets_v3_le->weapon_table, data1_1, data1_2).to_v4();
-    } else if (this->offsets_v3_be) {
-      def_v4 = indirect_lookup_2d<WeaponV3BE, true>(this->r, this->offsets_v3_be->weapon_table, data1_1, data1_2).to_v4();
-    } else {
-      throw logic_error("table is not v2, v3, or v4");
-    }
-    return this->parsed_weapons.emplace(key, def_v4).first->second;
+ItemParameterTable::WeaponV4 ItemParameterTable::decode_weapon(uint8_t data1_1, uint8_t data1_2) const {
+  if (this->offsets_dc_protos) {
+    return indirect_lookup_2d<WeaponDCProtos, false>(this->r, this->offsets_dc_protos->weapon_table, data1_1, data1_2).to_v4();
+  } else if (this->offsets_v1_v2) {
+    return indirect_lookup_2d<WeaponV1V2, false>(this->r, this->offsets_v1_v2->weapon_table, data1_1, data1_2).to_v4();
+  } else if (this->offsets_gc_nte) {
+    return indirect_lookup_2d<WeaponGCNTE, true>(this->r, this->offsets_gc_nte->weapon_table, data1_1, data1_2).to_v4();
+  } else if (this->offsets_v3_le) {
+    return indirect_lookup_2d<WeaponV3, false>(this->r, this->offsets_v3_le->weapon_table, data1_1, data1_2).to_v4();
+  } else if (this->offsets_v3_be) {
+    return indirect_lookup_2d<WeaponV3BE, true>(this->r, this->offsets_v3_be->weapon_table, data1_1, data1_2).to_v4();
+  } else {
+    throw logic_error("table is not v2, v3, or v4");
   }
 }
 
@@ -508,39 +617,25 @@ const ItemParameterTable::ArmorOrShieldV4& ItemParameterTable::get_armor_or_shie
   if ((data1_1 < 1) || (data1_1 > 2)) {
     throw out_of_range("armor/shield class ID out of range");
   }
-
   if (this->offsets_v4) {
     return indirect_lookup_2d<ArmorOrShieldV4, false>(this->r, this->offsets_v4->armor_table, data1_1 - 1, data1_2);
   }
+  return dense_lookup(this->decoded_armors_and_shields[data1_1 - 1], data1_2);
+}
 
-  auto& parsed_vec = (data1_1 == 2) ? this->parsed_shields : this->parsed_armors;
-  try {
-    const auto& ret = parsed_vec.at(data1_2);
-    if (ret.base.id == 0xFFFFFFFF) {
-      throw out_of_range("cache entry not populated");
-    }
-    return ret;
-  } catch (const std::out_of_range&) {
-    ArmorOrShieldV4 def_v4;
-
-    if (this->offsets_dc_protos) {
-      def_v4 = indirect_lookup_2d<ArmorOrShieldDCProtos, false>(this->r, this->offsets_dc_protos->armor_table, data1_1 - 1, data1_2).to_v4();
-    } else if (this->offsets_v1_v2) {
-      def_v4 = indirect_lookup_2d<ArmorOrShieldV1V2, false>(this->r, this->offsets_v1_v2->armor_table, data1_1 - 1, data1_2).to_v4();
-    } else if (this->offsets_gc_nte) {
-      def_v4 = indirect_lookup_2d<ArmorOrShieldV3BE, true>(this->r, this->offsets_gc_nte->armor_table, data1_1 - 1, data1_2).to_v4();
-    } else if (this->offsets_v3_le) {
-      def_v4 = indirect_lookup_2d<ArmorOrShieldV3, false>(this->r, this->offsets_v3_le->armor_table, data1_1 - 1, data1_2).to_v4();
-    } else if (this->offsets_v3_be) {
-      def_v4 = indirect_lookup_2d<ArmorOrShieldV3BE, true>(this->r, this->offsets_v3_be->armor_table, data1_1 - 1, data1_2).to_v4();
-    } else {
-      throw logic_error("table is not v2, v3, or v4");
-    }
-    if (data1_2 >= parsed_vec.size()) {
-      parsed_vec.resize(data1_2 + 1);
-    }
-    parsed_vec[data1_2] = def_v4;
-    return parsed_vec[data1_2];
+ItemParameterTable::ArmorOrShieldV4 ItemParameterTable::decode_armor_or_shield(uint8_t data1_1, uint8_t data1_2) const {
+  if (this->offsets_dc_protos) {
+    return indirect_lookup_2d<ArmorOrShieldDCProtos, false>(this->r, this->offsets_dc_protos->armor_table, data1_1 - 1, data1_2).to_v4();
+  } else if (this->offsets_v1_v2) {
+    return indirect_lookup_2d<ArmorOrShieldV1V2, false>(this->r, this->offsets_v1_v2->armor_table, data1_1 - 1, data1_2).to_v4();
+  } else if (this->offsets_gc_nte) {
+    return indirect_lookup_2d<ArmorOrShieldV3BE, true>(this->r, this->offsets_gc_nte->armor_table, data1_1 - 1, data1_2).to_v4();
+  } else if (this->offsets_v3_le) {
+    return indirect_lookup_2d<ArmorOrShieldV3, false>(this->r, this->offsets_v3_le->armor_table, data1_1 - 1, data1_2).to_v4();
+  } else if (this->offsets_v3_be) {
+    return indirect_lookup_2d<ArmorOrShieldV3BE, true>(this->r, this->offsets_v3_be->armor_table, data1_1 - 1, data1_2).to_v4();
+  } else {
+    throw logic_error("table is not v2, v3, or v4");
   }
 }
 
@@ -566,33 +661,22 @@ const ItemParameterTable::UnitV4& ItemParameterTable::get_unit(uint8_t data1_2)
   if (this->offsets_v4) {
     return indirect_lookup_2d<UnitV4, false>(this->r, this->offsets_v4->unit_table, 0, data1_2);
   }
+  return dense_lookup(this->decoded_units, data1_2);
+}
 
-  try {
-    const auto& ret = this->parsed_units.at(data1_2);
-    if (ret.base.id == 0xFFFFFFFF) {
-      throw out_of_range("cache entry not populated");
-    }
-    return ret;
-  } catch (const std::out_of_range&) {
-    UnitV4 def_v4;
-    if (this->offsets_dc_protos) {
-      def_v4 = indirect_lookup_2d<UnitDCProtos, false>(this->r, this->offsets_dc_protos->unit_table, 0, data1_2).to_v4();
-    } else if (this->offsets_v1_v2) {
-      def_v4 = indirect_lookup_2d<UnitV1V2, false>(this->r, this->offsets_v1_v2->unit_table, 0, data1_2).to_v4();
-    } else if (this->offsets_gc_nte) {
-      def_v4 = indirect_lookup_2d<UnitV3BE, true>(this->r, this->offsets_gc_nte->unit_table, 0, data1_2).to_v4();
-    } else if (this->offsets_v3_le) {
-      def_v4 = indirect_lookup_2d<UnitV3, false>(this->r, this->offsets_v3_le->unit_table, 0, data1_2).to_v4();
-    } else if (this->offsets_v3_be) {
-      def_v4 = indirect_lookup_2d<UnitV3BE, true>(this->r, this->offsets_v3_be->unit_table, 0, data1_2).to_v4();
-    } else {
-      throw logic_error("table is not v2, v3, or v4");
-    }
-    if (data1_2 >= this->parsed_units.size()) {
-      this->parsed_units.resize(data1_2 + 1);
-    }
-    this->parsed_units[data1_2] = def_v4;
-    return this->parsed_units[data1_2];
+ItemParameterTable::UnitV4 ItemParameterTable::decode_unit(uint8_t data1_2) const {
+  if (this->offsets_dc_protos) {
+    return indirect_lookup_2d<UnitDCProtos, false>(this->r, this->offsets_dc_protos->unit_table, 0, data1_2).to_v4();
+  } else if (this->offsets_v1_v2) {
+    return indirect_lookup_2d<UnitV1V2, false>(this->r, this->offsets_v1_v2->unit_table, 0, data1_2).to_v4();
+  } else if (this->offsets_gc_nte) {
+    return indirect_lookup_2d<UnitV3BE, true>(this->r, this->offsets_gc_nte->unit_table, 0, data1_2).to_v4();
+  } else if (this->offsets_v3_le) {
+    return indirect_lookup_2d<UnitV3, false>(this->r, this->offsets_v3_le->unit_table, 0, data1_2).to_v4();
+  } else if (this->offsets_v3_be) {
+    return indirect_lookup_2d<UnitV3BE, true>(this->r, this->offsets_v3_be->unit_table, 0, data1_2).to_v4();
+  } else {
+    throw logic_error("table is not v2, v3, or v4");
   }
 }
 
@@ -618,37 +702,26 @@ const ItemParameterTable::MagV4& ItemParameterTable::get_mag(uint8_t data1_1) co
   if (this->offsets_v4) {
     return indirect_lookup_2d<MagV4, false>(this->r, this->offsets_v4->mag_table, 0, data1_1);
   }
+  return dense_lookup(this->decoded_mags, data1_1);
+}
 
-  try {
-    const auto& ret = this->parsed_mags.at(data1_1);
-    if (ret.base.id == 0xFFFFFFFF) {
-      throw out_of_range("cache entry not populated");
-    }
-    return ret;
-  } catch (const std::out_of_range&) {
-    MagV4 def_v4;
-    if (this->offsets_dc_protos) {
-      def_v4 = indirect_lookup_2d<MagV1, false>(this->r, this->offsets_dc_protos->mag_table, 0, data1_1).to_v4();
-    } else if (this->offsets_v1_v2) {
-      if (is_v1(this->version)) {
-        def_v4 = indirect_lookup_2d<MagV1, false>(this->r, this->offsets_v1_v2->mag_table, 0, data1_1).to_v4();
-      } else {
-        def_v4 = indirect_lookup_2d<MagV2, false>(this->r, this->offsets_v1_v2->mag_table, 0, data1_1).to_v4();
-      }
-    } else if (this->offsets_gc_nte) {
-      def_v4 = indirect_lookup_2d<MagV3BE, true>(this->r, this->offsets_gc_nte->mag_table, 0, data1_1).to_v4();
-    } else if (this->offsets_v3_le) {
-      def_v4 = indirect_lookup_2d<MagV3, false>(this->r, this->offsets_v3_le->mag_table, 0, data1_1).to_v4();
-    } else if (this->offsets_v3_be) {
-      def_v4 = indirect_lookup_2d<MagV3BE, true>(this->r, this->offsets_v3_be->mag_table, 0, data1_1).to_v4();
+ItemParameterTable::MagV4 ItemParameterTable::decode_mag(uint8_t data1_1) const {
+  if (this->offsets_dc_protos) {
+    return indirect_lookup_2d<MagV1, false>(this->r, this->offsets_dc_protos->mag_table, 0, data1_1).to_v4();
+  } else if (this->offsets_v1_v2) {
+    if (is_v1(this->version)) {
+      return indirect_lookup_2d<MagV1, false>(this->r, this->offsets_v1_v2->mag_table, 0, data1_1).to_v4();
     } else {
-      throw logic_error("table is not v2, v3, or v4");
-    }
-    if (data1_1 >= this->parsed_mags.size()) {
-      this->parsed_mags.resize(data1_1 + 1);
+      return indirect_lookup_2d<MagV2, false>(this->r, this->offsets_v1_v2->mag_table, 0, data1_1).to_v4();
     }
-    this->parsed_mags[data1_1] = def_v4;
-    return this->parsed_mags[data1_1];
+  } else if (this->offsets_gc_nte) {
+    return indirect_lookup_2d<MagV3BE, true>(this->r, this->offsets_gc_nte->mag_table, 0, data1_1).to_v4();
+  } else if (this->offsets_v3_le) {
+    return indirect_lookup_2d<MagV3, false>(this->r, this->offsets_v3_le->mag_table, 0, data1_1).to_v4();
+  } else if (this->offsets_v3_be) {
+    return indirect_lookup_2d<MagV3BE, true>(this->r, this->offsets_v3_be->mag_table, 0, data1_1).to_v4();
+  } else {
+    throw logic_error("table is not v2, v3, or v4");
   }
 }
 
@@ -677,32 +750,25 @@ const ItemParameterTable::ToolV4& ItemParameterTable::get_tool(uint8_t data1_1,
   if (data1_1 >= this->num_tool_classes) {
     throw out_of_range("tool class ID out of range");
   }
-
   if (this->offsets_v4) {
     return indirect_lookup_2d<ToolV4, false>(this->r, this->offsets_v4->tool_table, data1_1, data1_2);
   }
+  return dense_lookup(this->decoded_tools[data1_1], data1_2);
+}
 
-  uint16_t key = (data1_1 << 8) | data1_2;
-  try {
-    return this->parsed_tools.at(key);
-  } catch (const std::out_of_range&) {
-    ToolV4 def_v4;
-
-    if (this->offsets_dc_protos) {
-      def_v4 = indirect_lookup_2d<ToolV1V2, false>(this->r, this->offsets_dc_protos->tool_table, data1_1, data1_2).to_v4();
-    } else if (this->offsets_v1_v2) {
-      def_v4 = indirect_lookup_2d<ToolV1V2, false>(this->r, this->offsets_v1_v2->tool_table, data1_1, data1_2).to_v4();
-    } else if (this->offsets_gc_nte) {
-      def_v4 = indirect_lookup_2d<ToolV3BE, true>(this->r, this->offsets_gc_nte->tool_table, data1_1, data1_2).to_v4();
-    } else if (this->offsets_v3_le) {
-      def_v4 = indirect_lookup_2d<ToolV3, false>(this->r, this->offsets_v3_le->tool_table, data1_1, data1_2).to_v4();
-    } else if (this->offsets_v3_be) {
-      def_v4 = indirect_lookup_2d<ToolV3BE, true>(this->r, this->offsets_v3_be->tool_table, data1_1, data1_2).to_v4();
-    } else {
-      throw logic_error("table is not v2, v3, or v4");
-    }
-
-    return this->parsed_tools.emplace(key, def_v4).first->second;
+ItemParameterTable::ToolV4 ItemParameterTable::decode_tool(uint8_t data1_1, uint8_t data1_2) const {
+  if (this->offsets_dc_protos) {
+    return indirect_lookup_2d<ToolV1V2, false>(this->r, this->offsets_dc_protos->tool_table, data1_1, data1_2).to_v4();
+  } else if (this->offsets_v1_v2) {
+    return indirect_lookup_2d<ToolV1V2, false>(this->r, this->offsets_v1_v2->tool_table, data1_1, data1_2).to_v4();
+  } else if (this->offsets_gc_nte) {
+    return indirect_lookup_2d<ToolV3BE, true>(this->r, this->offsets_gc_nte->tool_table, data1_1, data1_2).to_v4();
+  } else if (this->offsets_v3_le) {
+    return indirect_lookup_2d<ToolV3, false>(this->r, this->offsets_v3_le->tool_table, data1_1, data1_2).to_v4();
+  } else if (this->offsets_v3_be) {
+    return indirect_lookup_2d<ToolV3BE, true>(this->r, this->offsets_v3_be->tool_table, data1_1, data1_2).to_v4();
+  } else {
+    throw logic_error("table is not v2, v3, or v4");
   }
 }
 
@@ -866,26 +932,8 @@ const ItemParameterTable::Special& ItemParameterTable::get_special(uint8_t speci
     return this->r.pget<Special>(this->offsets_v1_v2->special_data_table + sizeof(Special) * special);
   } else if (this->offsets_v3_le) {
     return this->r.pget<Special>(this->offsets_v3_le->special_data_table + sizeof(Special) * special);
-  } else if (this->offsets_gc_nte) {
-    if ((special >= this->parsed_specials.size()) || (this->parsed_specials[special].type != 0xFFFF)) {
-      if (special >= this->parsed_specials.size()) {
-        this->parsed_specials.resize(special + 1);
-      }
-      const auto& sp_be = this->r.pget<SpecialBE>(this->offsets_gc_nte->special_data_table + sizeof(SpecialBE) * special);
-      this->parsed_specials[special].type = sp_be.type.load();
-      this->parsed_specials[special].amount = sp_be.amount.load();
-    }
-    return this->parsed_specials[special];
-  } else if (this->offsets_v3_be) {
-    if ((special >= this->parsed_specials.size()) || (this->parsed_specials[special].type != 0xFFFF)) {
-      if (special >= this->parsed_specials.size()) {
-        this->parsed_specials.resize(special + 1);
-      }
-      const auto& sp_be = this->r.pget<SpecialBE>(this->offsets_v3_be->special_data_table + sizeof(SpecialBE) * special);
-      this->parsed_specials[special].type = sp_be.type.load();
-      this->parsed_specials[special].amount = sp_be.amount.load();
-    }
-    return this->parsed_specials[special];
+  } else if (this->offsets_gc_nte || this->offsets_v3_be) {
+    return dense_lookup(this->decoded_specials, special);
   } else if (this->offsets_v4) {
     return this->r.pget<Special>(this->offsets_v4->special_data_table + sizeof(Special) * special);
   } else {
@@ -893,6 +941,22 @@ const ItemParameterTable::Special& ItemParameterTable::get_special(uint8_t speci
   }
 }
 
+ItemParameterTable::Special ItemParameterTable::decode_special(uint8_t special) const {
+  uint32_t base_offset;
+  if (this->offsets_gc_nte) {
+    base_offset = this->offsets_gc_nte->special_data_table;
+  } else if (this->offsets_v3_be) {
+    base_offset = this->offsets_v3_be->special_data_table;
+  } else {
+    throw logic_error("table is not big-endian");
+  }
+  const auto& sp_be = this->r.pget<SpecialBE>(base_offset + sizeof(SpecialBE) * special);
+  Special ret;
+  ret.type = sp_be.type.load();
+  ret.amount = sp_be.amount.load();
+  return ret;
+}
+
 uint8_t ItemParameterTable::get_max_tech_level(uint8_t char_class, uint8_t tech_num) const {
   if (char_class >= 12) {
     throw out_of_range("invalid character class");
@@ -1103,34 +1167,6 @@ const std::vector<ItemParameterTable::ItemCombination>& ItemParameterTable::get_
 }
 
 const std::map<uint32_t, std::vector<ItemParameterTable::ItemCombination>>& ItemParameterTable::get_all_item_combinations() const {
-  if (this->item_combination_index.empty()) {
-    uint32_t offset, count;
-    if (this->offsets_dc_protos || this->offsets_v1_v2 || this->offsets_gc_nte) {
-      static const std::map<uint32_t, std::vector<ItemParameterTable::ItemCombination>> empty_map;
-      return empty_map;
-    } else if (this->offsets_v3_le) {
-      const auto& co = this->r.pget<ArrayRef>(this->offsets_v3_le->combination_table);
-      offset = co.offset;
-      count = co.count;
-    } else if (this->offsets_v3_be) {
-      const auto& co = this->r.pget<ArrayRefBE>(this->offsets_v3_be->combination_table);
-      offset = co.offset;
-      count = co.count;
-    } else if (this->offsets_v4) {
-      const auto& co = this->r.pget<ArrayRef>(this->offsets_v4->combination_table);
-      offset = co.offset;
-      count = co.count;
-    } else {
-      throw logic_error("table is not v2, v3, or v4");
-    }
-
-    const auto* defs = &this->r.pget<ItemCombination>(offset, count * sizeof(ItemCombination));
-    for (size_t z = 0; z < count; z++) {
-      const auto& def = defs[z];
-      uint32_t key = (def.used_item[0] << 16) | (def.used_item[1] << 8) | def.used_item[2];
-      this->item_combination_index[key].emplace_back(def);
-    }
-  }
   return this->item_combination_index;
 }
 
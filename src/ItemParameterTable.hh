@@ -2,6 +2,7 @@
 
 #include <stdint.h>
 
+#include <array>
 #include <map>
 #include <memory>
 #include <phosg/Encoding.hh>
@@ -609,19 +610,29 @@ private:
   const TableOffsetsV3V4BE* offsets_v3_be;
   const TableOffsetsV3V4* offsets_v4;
 
-  // These are unused if offsets_v4 is not null (in that case, we just return
-  // references pointing inside the data string)
-  mutable std::unordered_map<uint16_t, WeaponV4> parsed_weapons;
-  mutable std::vector<ArmorOrShieldV4> parsed_armors;
-  mutable std::vector<ArmorOrShieldV4> parsed_shields;
-  mutable std::vector<UnitV4> parsed_units;
-  mutable std::vector<MagV4> parsed_mags;
-  mutable std::unordered_map<uint16_t, ToolV4> parsed_tools;
-  mutable std::vector<Special> parsed_specials;
+  // V4-format copies of all definitions, decoded in the constructor so that
+  // lookups never modify the table (and it can be shared between threads).
+  // These are indexed by data1[1] and/or data1[2], and are unused if
+  // offsets_v4 is not null (in that case, we just return references pointing
+  // inside the data string).
+  std::vector<std::vector<WeaponV4>> decoded_weapons;
+  std::array<std::vector<ArmorOrShieldV4>, 2> decoded_armors_and_shields;
+  std::vector<UnitV4> decoded_units;
+  std::vector<MagV4> decoded_mags;
+  std::vector<std::vector<ToolV4>> decoded_tools;
+  std::vector<Special> decoded_specials; // Only used for big-endian tables
 
   // Key is used_item. We can't index on (used_item, equipped_item) because
   // equipped_item may contain wildcards, and the matching order matters.
-  mutable std::map<uint32_t, std::vector<ItemCombination>> item_combination_index;
+  std::map<uint32_t, std::vector<ItemCombination>> item_combination_index;
+
+  void decode_all_definitions();
+  WeaponV4 decode_weapon(uint8_t data1_1, uint8_t data1_2) const;
+  ArmorOrShieldV4 decode_armor_or_shield(uint8_t data1_1, uint8_t data1_2) const;
+  UnitV4 decode_unit(uint8_t data1_2) const;
+  MagV4 decode_mag(uint8_t data1_1) const;
+  ToolV4 decode_tool(uint8_t data1_1, uint8_t data1_2) const;
+  Special decode_special(uint8_t special) const;
 
   template <typename ToolDefT, bool BE>
   std::pair<uint8_t, uint8_t> find_tool_by_id_t(uint32_t tool_table_offset, uint32_t id) const;
@@ -2,6 +2,7 @@
 
 #include <string.h>
 
+#include <algorithm>
 #include <phosg/Random.hh>
 
 #include "Compression.hh"
@@ -19,12 +20,69 @@ Lobby::FloorItemManager::FloorItemManager(uint32_t lobby_id, uint8_t floor)
     : log(phosg::string_printf("[Lobby:%08" PRIX32 ":FloorItems:%02hhX] ", lobby_id, floor), lobby_log.min_level),
       next_drop_number(0) {}
 
+Lobby::FloorItemManager::ItemIterator Lobby::FloorItemManager::lower_bound(uint32_t item_id) {
+  return std::lower_bound(this->items.begin(), this->items.end(), item_id, [](const auto& it, uint32_t item_id) -> bool {
+    return it.first < item_id;
+  });
+}
+
+Lobby::FloorItemManager::ConstItemIterator Lobby::FloorItemManager::lower_bound(uint32_t item_id) const {
+  return std::lower_bound(this->items.begin(), this->items.end(), item_id, [](const auto& it, uint32_t item_id) -> bool {
+    return it.first < item_id;
+  });
+}
+
+void Lobby::FloorItemManager::link(FloorItem* fi) {
+  for (size_t z = 0; z < 12; z++) {
+    if (!fi->visible_to_client(z)) {
+      continue;
+    }
+    auto& queue = this->queue_for_client[z];
+    // New drops always go at the end; only items that are put back (e.g. after
+    // a failed pickup) have to walk backward to find their original position
+    FloorItem* prev = queue.tail;
+    while (prev && (prev->drop_number > fi->drop_number)) {
+      prev = prev->prev_for_client[z];
+    }
+    FloorItem* next = prev ? prev->next_for_client[z] : queue.head;
+    fi->prev_for_client[z] = prev;
+    fi->next_for_client[z] = next;
+    (prev ? prev->next_for_client[z] : queue.head) = fi;
+    (next ? next->prev_for_client[z] : queue.tail) = fi;
+    queue.size++;
+  }
+}
+
+void Lobby::FloorItemManager::unlink(FloorItem* fi) {
+  for (size_t z = 0; z < 12; z++) {
+    if (!fi->visible_to_client(z)) {
+      continue;
+    }
+    auto& queue = this->queue_for_client[z];
+    FloorItem* prev = fi->prev_for_client[z];
+    FloorItem* next = fi->next_for_client[z];
+    if ((prev ? prev->next_for_client[z] : queue.head) != fi) {
+      throw logic_error("item queue for client is inconsistent");
+    }
+    (prev ? prev->next_for_client[z] : queue.head) = next;
+    (next ? next->prev_for_client[z] : queue.tail) = prev;
+    fi->prev_for_client[z] = nullptr;
+    fi->next_for_client[z] = nullptr;
+    queue.size--;
+  }
+}
+
 bool Lobby::FloorItemManager::exists(uint32_t item_id) const {
-  return this->items.count(item_id);
+  auto it = this->lower_bound(item_id);
+  return (it != this->items.end()) && (it->first == item_id);
 }
 
 shared_ptr<Lobby::FloorItem> Lobby::FloorItemManager::find(uint32_t item_id) const {
-  return this->items.at(item_id);
+  auto it = this->lower_bound(item_id);
+  if ((it == this->items.end()) || (it->first != item_id)) {
+    throw out_of_range("item not present");
+  }
+  return it->second;
 }
 
 void Lobby::FloorItemManager::add(const ItemData& item, float x, float z, uint16_t flags) {
@@ -42,33 +100,27 @@ void Lobby::FloorItemManager::add(shared_ptr<Lobby::FloorItem> fi) {
     throw logic_error("floor item is not visible to any player");
   }
 
-  auto emplace_ret = this->items.emplace(fi->data.id, fi);
-  if (!emplace_ret.second) {
+  uint32_t item_id = fi->data.id;
+  auto it = this->lower_bound(item_id);
+  if ((it != this->items.end()) && (it->first == item_id)) {
     throw runtime_error("floor item already exists with the same ID");
   }
-  for (size_t z = 0; z < 12; z++) {
-    if (fi->visible_to_client(z)) {
-      this->queue_for_client[z].emplace(fi->drop_number, fi);
-    }
-  }
+  this->link(fi.get());
+  this->items.emplace(it, item_id, fi);
   this->log.info("Added floor item %08" PRIX32 " at %g, %g with drop number %" PRIu64 " with flags %03hX",
-      fi->data.id.load(), fi->x, fi->z, fi->drop_number, fi->flags);
+      item_id, fi->x, fi->z, fi->drop_number, fi->flags);
 }
 
 std::shared_ptr<Lobby::FloorItem> Lobby::FloorItemManager::remove(uint32_t item_id, uint8_t client_id) {
-  auto item_it = this->items.find(item_id);
-  if (item_it == this->items.end()) {
+  auto item_it = this->lower_bound(item_id);
+  if ((item_it == this->items.end()) || (item_it->first != item_id)) {
     throw out_of_range("item not present");
   }
   auto fi = item_it->second;
   if ((client_id != 0xFF) && !fi->visible_to_client(client_id)) {
     throw runtime_error("client does not have access to item");
   }
-  for (size_t z = 0; z < 12; z++) {
-    if (fi->visible_to_client(z) && !this->queue_for_client[z].erase(fi->drop_number)) {
-      throw logic_error("item queue for client is inconsistent");
-    }
-  }
+  this->unlink(fi.get());
   this->items.erase(item_it);
   this->log.info("Removed floor item %08" PRIX32 " at %g, %g with drop number %" PRIu64 " with flags %03hX",
       fi->data.id.load(), fi->x, fi->z, fi->drop_number, fi->flags);
@@ -78,8 +130,9 @@ std::shared_ptr<Lobby::FloorItem> Lobby::FloorItemManager::remove(uint32_t item_
 std::unordered_set<std::shared_ptr<Lobby::FloorItem>> Lobby::FloorItemManager::evict() {
   unordered_set<shared_ptr<FloorItem>> ret;
   for (size_t z = 0; z < 12; z++) {
-    while (this->queue_for_client[z].size() > 48) {
-      ret.emplace(this->remove(this->queue_for_client[z].begin()->second->data.id, 0xFF));
+    auto& queue = this->queue_for_client[z];
+    while (queue.size > 48) {
+      ret.emplace(this->remove(queue.head->data.id, 0xFF));
     }
   }
   this->log.info("Evicted %zu items", ret.size());
@@ -87,50 +140,49 @@ std::unordered_set<std::shared_ptr<Lobby::FloorItem>> Lobby::FloorItemManager::e
 }
 
 void Lobby::FloorItemManager::clear_inaccessible(uint16_t remaining_clients_mask) {
-  unordered_set<uint32_t> item_ids_to_delete;
-  for (const auto& it : this->items) {
+  size_t num_items_before = this->items.size();
+  std::erase_if(this->items, [&](const auto& it) -> bool {
     if ((it.second->flags & remaining_clients_mask) == 0) {
-      item_ids_to_delete.emplace(it.first);
+      this->unlink(it.second.get());
+      return true;
     }
-  }
-  for (uint32_t item_id : item_ids_to_delete) {
-    this->remove(item_id, 0xFF);
-  }
-  this->log.info("Deleted %zu inaccessible items", item_ids_to_delete.size());
+    return false;
+  });
+  this->log.info("Deleted %zu inaccessible items", num_items_before - this->items.size());
 }
 
 void Lobby::FloorItemManager::clear_private() {
-  unordered_set<uint32_t> item_ids_to_delete;
-  for (const auto& it : this->items) {
+  size_t num_items_before = this->items.size();
+  std::erase_if(this->items, [&](const auto& it) -> bool {
     if ((it.second->flags & 0x00F) != 0x00F) {
-      item_ids_to_delete.emplace(it.first);
+      this->unlink(it.second.get());
+      return true;
     }
-  }
-  for (uint32_t item_id : item_ids_to_delete) {
-    this->remove(item_id, 0xFF);
-  }
-  this->log.info("Deleted %zu private items", item_ids_to_delete.size());
+    return false;
+  });
+  this->log.info("Deleted %zu private items", num_items_before - this->items.size());
 }
 
 void Lobby::FloorItemManager::clear() {
   size_t num_items = this->items.size();
+  for (auto& it : this->items) {
+    it.second->prev_for_client.fill(nullptr);
+    it.second->next_for_client.fill(nullptr);
+  }
   this->items.clear();
   for (auto& queue : this->queue_for_client) {
-    queue.clear();
+    queue = ClientQueue();
   }
   this->next_drop_number = 0;
   this->log.info("Deleted %zu items", num_items);
 }
 
 uint32_t Lobby::FloorItemManager::reassign_all_item_ids(uint32_t next_item_id) {
-  ::map<uint32_t, shared_ptr<FloorItem>> old_items;
-  old_items.swap(this->items);
-  for (auto& queue : this->queue_for_client) {
-    queue.clear();
-  }
-  for (auto& it : old_items) {
-    it.second->data.id = next_item_id++;
-    this->add(it.second);
+  // IDs are assigned in the existing order, so the index stays sorted and the
+  // queues (which are ordered by drop_number) don't change
+  for (auto& it : this->items) {
+    it.first = next_item_id++;
+    it.second->data.id = it.first;
   }
   return next_item_id;
 }
@@ -210,52 +262,10 @@ void Lobby::set_drop_mode(DropMode new_mode) {
 
 void Lobby::create_item_creator() {
   auto s = this->require_server_state();
-
-  shared_ptr<const RareItemSet> rare_item_set;
-  shared_ptr<const CommonItemSet> common_item_set;
-  switch (this->base_version) {
-    case Version::PC_PATCH:
-    case Version::BB_PATCH:
-    case Version::GC_EP3_NTE:
-    case Version::GC_EP3:
-      throw runtime_error("cannot create item creator for this base version");
-    case Version::DC_NTE:
-    case Version::DC_V1_11_2000_PROTOTYPE:
-    case Version::DC_V1:
-      // TODO: We should probably have a v1 common item set at some point too
-      common_item_set = s->common_item_set_v2;
-      rare_item_set = s->rare_item_sets.at("rare-table-v1");
-      break;
-    case Version::DC_V2:
-    case Version::PC_NTE:
-    case Version::PC_V2:
-      common_item_set = s->common_item_set_v2;
-      rare_item_set = s->rare_item_sets.at("rare-table-v2");
-      break;
-    case Version::GC_NTE:
-    case Version::GC_V3:
-    case Version::XB_V3:
-      common_item_set = s->common_item_set_v3_v4;
-      rare_item_set = s->rare_item_sets.at("rare-table-v3");
-      break;
-    case Version::BB_V4:
-      common_item_set = s->common_item_set_v3_v4;
-      rare_item_set = s->rare_item_sets.at("rare-table-v4");
-      break;
-    default:
-      throw logic_error("invalid lobby base version");
-  }
-  this->item_creator = make_shared<ItemCreator>(
-      common_item_set,
-      rare_item_set,
-      s->armor_random_set,
-      s->tool_random_set,
-      s->weapon_random_sets.at(this->difficulty),
-      s->tekker_adjustment_set,
-      s->item_parameter_table(this->base_version),
-      s->item_stack_limits(this->base_version),
+  this->item_creator = s->create_item_creator(
+      this->base_version,
       this->episode,
-      (this->mode == GameMode::SOLO) ? GameMode::NORMAL : this->mode,
+      this->mode,
       this->difficulty,
       this->effective_section_id(),
       this->opt_rand_crypt,
@@ -300,15 +310,22 @@ shared_ptr<Map> Lobby::load_maps(
     shared_ptr<const Map::RareEnemyRates> rare_rates,
     uint32_t random_seed,
     shared_ptr<PSOLFGEncryption> opt_rand_crypt,
-    shared_ptr<const string> quest_dat_contents_decompressed) {
+    shared_ptr<const string> quest_dat_contents_decompressed,
+    bool lazy) {
   auto map = make_shared<Map>(version, lobby_id, random_seed, opt_rand_crypt);
-  map->add_entities_from_quest_data(
-      episode,
-      difficulty,
-      event,
-      quest_dat_contents_decompressed->data(),
-      quest_dat_contents_decompressed->size(),
-      rare_rates);
+  if (lazy) {
+    map->add_pending_floors_from_quest_data(episode, difficulty, event, quest_dat_contents_decompressed, rare_rates);
+    map->materialize_floor(0);
+  } else {
+    map->add_entities_from_quest_data(
+        episode,
+        difficulty,
+        event,
+        quest_dat_contents_decompressed->data(),
+        quest_dat_contents_decompressed->size(),
+        rare_rates);
+    map->build_indexes();
+  }
   return map;
 }
 
@@ -325,7 +342,9 @@ shared_ptr<Map> Lobby::load_maps(
     uint32_t random_seed,
     shared_ptr<PSOLFGEncryption> opt_rand_crypt,
     const parray<le_uint32_t, 0x20>& variations,
-    const phosg::PrefixedLogger* log) {
+    const phosg::PrefixedLogger* log,
+    shared_ptr<MapFloorTemplateCache> template_cache,
+    bool lazy) {
   auto enemy_filenames = sdt->map_filenames_for_variations(variations, episode, mode, SetDataTable::FilenameType::ENEMIES);
   auto object_filenames = sdt->map_filenames_for_variations(variations, episode, mode, SetDataTable::FilenameType::OBJECTS);
   auto event_filenames = sdt->map_filenames_for_variations(variations, episode, mode, SetDataTable::FilenameType::EVENTS);
@@ -343,7 +362,93 @@ shared_ptr<Map> Lobby::load_maps(
       rare_rates,
       random_seed,
       opt_rand_crypt,
-      log);
+      log,
+      template_cache,
+      lazy);
+}
+
+shared_ptr<const Map::FloorTemplate> Lobby::load_floor_template(
+    uint8_t floor,
+    const string& enemy_filename,
+    const string& object_filename,
+    const string& event_filename,
+    Version version,
+    Episode episode,
+    uint8_t difficulty,
+    uint8_t event,
+    function<shared_ptr<const string>(Version, const string&)> get_file_data,
+    const phosg::PrefixedLogger* log,
+    shared_ptr<MapFloorTemplateCache> template_cache) {
+  auto generate = [&]() -> shared_ptr<const Map::FloorTemplate> {
+    auto get_floor_file = [&](const string& filename, const char* type_name) -> shared_ptr<const string> {
+      if (filename.empty()) {
+        if (log) {
+          log->info("No %s to load for floor %02hhX", type_name, floor);
+        }
+        return nullptr;
+      }
+      auto map_data = get_file_data(version, filename);
+      if (log) {
+        if (map_data) {
+          log->info("Loaded %s map %s for floor %02hhX", type_name, filename.c_str(), floor);
+        } else {
+          log->info("%s map %s for floor %02hhX cannot be used; skipping", type_name, filename.c_str(), floor);
+        }
+      }
+      return map_data;
+    };
+    auto enemies_data = get_floor_file(enemy_filename, "enemies");
+    auto objects_data = get_floor_file(object_filename, "objects");
+    auto events_data = get_floor_file(event_filename, "events");
+    return Map::FloorTemplate::from_map_data(
+        version, episode, difficulty, event, floor, enemies_data, objects_data, events_data);
+  };
+
+  if (!template_cache) {
+    return generate();
+  }
+  // The difficulty and event are part of the key because they affect some
+  // enemy types (e.g. Dark Falz and the Episode 2 rare Rappies)
+  string key = phosg::string_printf("%s:%hhu:%hhu:%hhu:%02hhX:%s:%s:%s",
+      phosg::name_for_enum(version),
+      static_cast<uint8_t>(episode),
+      difficulty,
+      event,
+      floor,
+      enemy_filename.c_str(),
+      object_filename.c_str(),
+      event_filename.c_str());
+  return template_cache->get(key, generate);
+}
+
+vector<shared_ptr<const Map::FloorTemplate>> Lobby::load_floor_templates(
+    const vector<string>& enemy_filenames,
+    const vector<string>& object_filenames,
+    const vector<string>& event_filenames,
+    Version version,
+    Episode episode,
+    uint8_t difficulty,
+    uint8_t event,
+    function<shared_ptr<const string>(Version, const string&)> get_file_data,
+    const phosg::PrefixedLogger* log,
+    shared_ptr<MapFloorTemplateCache> template_cache) {
+  vector<shared_ptr<const Map::FloorTemplate>> ret;
+  ret.reserve(0x12);
+  for (size_t floor = 0; floor < 0x12; floor++) {
+    ret.emplace_back(Lobby::load_floor_template(
+        floor,
+        enemy_filenames.at(floor),
+        object_filenames.at(floor),
+        event_filenames.at(floor),
+        version,
+        episode,
+        difficulty,
+        event,
+        get_file_data,
+        log,
+        template_cache));
+  }
+  return ret;
 }
 
 shared_ptr<Map> Lobby::load_maps(
@@ -360,7 +465,9 @@ shared_ptr<Map> Lobby::load_maps(
     shared_ptr<const Map::RareEnemyRates> rare_rates,
     uint32_t rare_seed,
     shared_ptr<PSOLFGEncryption> opt_rand_crypt,
-    const phosg::PrefixedLogger* log) {
+    const phosg::PrefixedLogger* log,
+    shared_ptr<MapFloorTemplateCache> template_cache,
+    bool lazy) {
   auto map = make_shared<Map>(version, lobby_id, rare_seed, opt_rand_crypt);
 
   // Don't load free-roam maps in Challenge mode, since players can't go to
@@ -369,68 +476,64 @@ shared_ptr<Map> Lobby::load_maps(
     return map;
   }
 
-  for (size_t floor = 0; floor < 0x12; floor++) {
-    const auto& floor_enemy_filename = enemy_filenames.at(floor);
-    if (!floor_enemy_filename.empty()) {
-      auto map_data = get_file_data(version, floor_enemy_filename);
-      if (map_data) {
-        map->add_enemies_from_map_data(
+  if (lazy) {
+    // The pending floors are owned by the map, so they must not refer to the
+    // caller's logger, which may be destroyed first
+    Map* map_p = map.get();
+    for (size_t floor = 0; floor < 0x12; floor++) {
+      map->add_pending_floor(floor, [map_p, floor, enemy_filename = enemy_filenames.at(floor), object_filename = object_filenames.at(floor), event_filename = event_filenames.at(floor), version, episode, difficulty, event, get_file_data, rare_rates, template_cache]() -> void {
+        auto t = Lobby::load_floor_template(
+            floor,
+            enemy_filename,
+            object_filename,
+            event_filename,
+            version,
             episode,
             difficulty,
             event,
-            floor,
-            map_data->data(),
-            map_data->size(),
-            rare_rates);
-        if (log) {
-          log->info("Loaded enemies map %s for floor %02zX", floor_enemy_filename.c_str(), floor);
-        }
-      } else if (log) {
-        log->info("Enemies map %s for floor %02zX cannot be used; skipping", floor_enemy_filename.c_str(), floor);
-      }
-    } else if (log) {
-      log->info("No enemies to load for floor %02zX", floor);
-    }
-
-    const auto& floor_object_filename = object_filenames.at(floor);
-    if (!floor_object_filename.empty()) {
-      auto map_data = get_file_data(version, floor_object_filename);
-      if (map_data) {
-        map->add_objects_from_map_data(floor, map_data->data(), map_data->size());
-        if (log) {
-          log->info("Loaded objects map %s for floor %02zX", floor_object_filename.c_str(), floor);
-        }
-      } else if (log) {
-        log->info("Objects map %s for floor %02zX cannot be used; skipping", floor_object_filename.c_str(), floor);
-      }
-    } else if (log) {
-      log->info("No objects to load for floor %02zX", floor);
+            get_file_data,
+            &map_p->log,
+            template_cache);
+        map_p->add_floor_from_template(*t, rare_rates);
+      });
     }
+    // Players start on floor 0, so there's no reason to defer loading it
+    map->materialize_floor(0);
+    return map;
+  }
 
-    const auto& floor_event_filename = event_filenames.at(floor);
-    if (!floor_event_filename.empty()) {
-      auto map_data = get_file_data(version, floor_event_filename);
-      if (map_data) {
-        map->add_events_from_map_data(floor, map_data->data(), map_data->size());
-        if (log) {
-          log->info("Loaded events map %s for floor %02zX", floor_event_filename.c_str(), floor);
-        }
-      } else if (log) {
-        log->info("Events map %s for floor %02zX cannot be used; skipping", floor_event_filename.c_str(), floor);
-      }
-    } else if (log) {
-      log->info("No events to load for floor %02zX", floor);
-    }
+  auto templates = Lobby::load_floor_templates(
+      enemy_filenames,
+      object_filenames,
+      event_filenames,
+      version,
+      episode,
+      difficulty,
+      event,
+      get_file_data,
+      log,
+      template_cache);
+  for (const auto& t : templates) {
+    map->add_floor_from_template(*t, rare_rates);
   }
+  map->build_indexes();
 
   return map;
 }
 
-void Lobby::load_maps() {
+function<shared_ptr<Map>()> Lobby::map_generator() {
+  auto s = this->require_server_state();
   auto rare_rates = ((this->base_version == Version::BB_V4) && this->rare_enemy_rates)
       ? this->rare_enemy_rates
       : Map::DEFAULT_RARE_ENEMIES;
-
+  // On BB, the rare enemy list is sent to players when they join, so all
+  // floors must be loaded up front (see Map::add_pending_floor)
+  bool lazy = s->lazy_map_loading && (this->base_version != Version::BB_V4);
+
+  // Everything the generator uses is captured by value here, so it doesn't
+  // depend on the Lobby or on any part of the ServerState that can change
+  // (reloads replace these objects rather than modifying them)
+  function<shared_ptr<Map>()> generate;
   if (this->quest) {
     auto leader_c = this->clients.at(this->leader_id);
     if (!leader_c) {
@@ -438,58 +541,93 @@ void Lobby::load_maps() {
     }
 
     auto vq = this->quest->version(this->base_version, leader_c->language());
-    if (!vq->dat_contents_decompressed) {
+    if (!vq->dat_contents) {
       throw runtime_error("quest does not have DAT data");
     }
-    this->map = this->load_maps(
-        this->base_version,
-        this->episode,
-        this->difficulty,
-        this->event,
-        this->lobby_id,
-        rare_rates,
-        this->random_seed,
-        this->opt_rand_crypt,
-        vq->dat_contents_decompressed);
+    // The .dat file may not have been decompressed yet, so do it in the
+    // generator, which runs on a game creation thread if there are any
+    generate = [version = this->base_version, episode = this->episode, difficulty = this->difficulty, event = this->event, lobby_id = this->lobby_id, rare_rates, random_seed = this->random_seed, opt_rand_crypt = this->opt_rand_crypt, vq, lazy]() -> shared_ptr<Map> {
+      return Lobby::load_maps(
+          version, episode, difficulty, event, lobby_id, rare_rates, random_seed, opt_rand_crypt, vq->decompressed_dat(), lazy);
+    };
 
   } else if (this->mode != GameMode::CHALLENGE) {
-    auto s = this->require_server_state();
-    this->map = this->load_maps(
-        this->base_version,
-        this->episode,
-        this->mode,
-        this->difficulty,
-        this->event,
-        this->lobby_id,
-        s->set_data_table(this->base_version, this->episode, this->mode, this->difficulty),
-        bind(&ServerState::load_map_file, s.get(), placeholders::_1, placeholders::_2),
-        rare_rates,
-        this->random_seed,
-        this->opt_rand_crypt,
-        this->variations,
-        &this->log);
+    // Loading a map file that isn't cached reads from objects that reloads can
+    // replace (e.g. the BB patch index), so the files are loaded here, on the
+    // event thread, and the generator only looks them up. In lazy mode, only
+    // floor 0's files are needed up front; the other floors are loaded when
+    // players enter them, which also happens on the event thread.
+    auto sdt = s->set_data_table(this->base_version, this->episode, this->mode, this->difficulty);
+    auto enemy_filenames = sdt->map_filenames_for_variations(this->variations, this->episode, this->mode, SetDataTable::FilenameType::ENEMIES);
+    auto object_filenames = sdt->map_filenames_for_variations(this->variations, this->episode, this->mode, SetDataTable::FilenameType::OBJECTS);
+    auto event_filenames = sdt->map_filenames_for_variations(this->variations, this->episode, this->mode, SetDataTable::FilenameType::EVENTS);
+    auto preloaded_files = make_shared<unordered_map<string, shared_ptr<const string>>>();
+    size_t num_preload_floors = lazy ? 1 : 0x12;
+    for (const auto* filenames : {&enemy_filenames, &object_filenames, &event_filenames}) {
+      for (size_t floor = 0; floor < num_preload_floors; floor++) {
+        const auto& filename = filenames->at(floor);
+        if (!filename.empty() && !preloaded_files->count(filename)) {
+          preloaded_files->emplace(filename, s->load_map_file(this->base_version, filename));
+        }
+      }
+    }
+    auto get_file_data = [s = s.get(), preloaded_files](Version version, const string& filename) -> shared_ptr<const string> {
+      auto it = preloaded_files->find(filename);
+      return (it != preloaded_files->end()) ? it->second : s->load_map_file(version, filename);
+    };
+
+    generate = [enemy_filenames = std::move(enemy_filenames), object_filenames = std::move(object_filenames), event_filenames = std::move(event_filenames), version = this->base_version, episode = this->episode, mode = this->mode, difficulty = this->difficulty, event = this->event, lobby_id = this->lobby_id, get_file_data = std::move(get_file_data), rare_rates, random_seed = this->random_seed, opt_rand_crypt = this->opt_rand_crypt, log = this->log, template_cache = s->map_floor_template_cache, lazy]() -> shared_ptr<Map> {
+      return Lobby::load_maps(
+          enemy_filenames,
+          object_filenames,
+          event_filenames,
+          version,
+          episode,
+          mode,
+          difficulty,
+          event,
+          lobby_id,
+          get_file_data,
+          rare_rates,
+          random_seed,
+          opt_rand_crypt,
+          &log,
+          template_cache,
+          lazy);
+    };
 
   } else {
-    this->map = make_shared<Map>(this->base_version, this->lobby_id, this->random_seed, this->opt_rand_crypt);
+    generate = [version = this->base_version, lobby_id = this->lobby_id, random_seed = this->random_seed, opt_rand_crypt = this->opt_rand_crypt]() -> shared_ptr<Map> {
+      return make_shared<Map>(version, lobby_id, random_seed, opt_rand_crypt);
+    };
   }
 
-  this->log.info("Generated objects list (%zu entries):", this->map->objects.size());
-  for (size_t z = 0; z < this->map->objects.size(); z++) {
-    string o_str = this->map->objects[z].str();
-    this->log.info("(K-%zX) %s", z, o_str.c_str());
-  }
-  this->log.info("Generated enemies list (%zu entries):", this->map->enemies.size());
-  for (size_t z = 0; z < this->map->enemies.size(); z++) {
-    string e_str = this->map->enemies[z].str();
-    this->log.info("(E-%zX) %s", z, e_str.c_str());
-  }
-  this->log.info("Generated events list (%zu entries):", this->map->events.size());
-  for (size_t z = 0; z < this->map->events.size(); z++) {
-    string e_str = this->map->events[z].str();
-    this->log.info("%s", e_str.c_str());
-  }
-  this->log.info("Loaded maps contain %zu object entries and %zu enemy entries overall (%zu as rares)",
-      this->map->objects.size(), this->map->enemies.size(), this->map->rare_enemy_indexes.size());
+  return [generate = std::move(generate), log = this->log]() -> shared_ptr<Map> {
+    auto map = generate();
+    log.info("Generated objects list (%zu entries):", map->objects.size());
+    for (size_t z = 0; z < map->objects.size(); z++) {
+      string o_str = map->objects[z].str();
+      log.info("(K-%zX) %s", z, o_str.c_str());
+    }
+    log.info("Generated enemies list (%zu entries):", map->enemies.size());
+    for (size_t z = 0; z < map->enemies.size(); z++) {
+      string e_str = map->enemies[z].str();
+      log.info("(E-%zX) %s", z, e_str.c_str());
+    }
+    log.info("Generated events list (%zu entries):", map->events.size());
+    for (size_t z = 0; z < map->events.size(); z++) {
+      string e_str = map->events[z].str();
+      log.info("%s", e_str.c_str());
+    }
+    log.info("Loaded maps contain %zu object entries and %zu enemy entries overall (%zu as rares)%s",
+        map->objects.size(), map->enemies.size(), map->rare_enemy_indexes.size(),
+        map->has_pending_floors() ? "; later floors will be loaded when players enter them" : "");
+    return map;
+  };
+}
+
+void Lobby::load_maps() {
+  this->map = this->map_generator()();
 }
 
 void Lobby::create_ep3_server() {
@@ -36,16 +36,32 @@ struct Lobby : public std::enable_shared_from_this<Lobby> {
     // be sent to all players when the item is picked up. This has no effect for
     // non-rare items.
     uint16_t flags;
+    // Links for the per-client eviction queues in FloorItemManager. These are
+    // only meaningful while the item is in a manager; only the manager should
+    // touch them.
+    std::array<FloorItem*, 12> prev_for_client = {};
+    std::array<FloorItem*, 12> next_for_client = {};
 
     bool visible_to_client(uint8_t client_id) const;
   };
   struct FloorItemManager {
+    // Intrusive list of the items visible to one client, in increasing order
+    // of drop_number (which is also the order they should be evicted in)
+    struct ClientQueue {
+      FloorItem* head = nullptr;
+      FloorItem* tail = nullptr;
+      size_t size = 0;
+    };
+
     phosg::PrefixedLogger log;
     uint64_t next_drop_number;
-    // It's important that this is a map and not an unordered_map. See the
-    // comment in send_game_item_state for more details.
-    std::map<uint32_t, std::shared_ptr<FloorItem>> items; // Keyed on item_id
-    std::array<std::map<uint64_t, std::shared_ptr<FloorItem>>, 12> queue_for_client;
+    // It's important that this is always sorted by item_id. See the comment in
+    // send_game_item_state for more details. This is a flat vector rather than
+    // a map since floors rarely have more than a few hundred items, so binary
+    // search and insertion by shifting are cheaper than allocating a node for
+    // each item.
+    std::vector<std::pair<uint32_t, std::shared_ptr<FloorItem>>> items;
+    std::array<ClientQueue, 12> queue_for_client;
 
     FloorItemManager(uint32_t lobby_id, uint8_t floor);
     ~FloorItemManager() = default;
@@ -60,6 +76,14 @@ struct Lobby : public std::enable_shared_from_this<Lobby> {
     void clear_private();
     void clear();
     uint32_t reassign_all_item_ids(uint32_t next_item_id);
+
+  private:
+    using ItemIterator = std::vector<std::pair<uint32_t, std::shared_ptr<FloorItem>>>::iterator;
+    using ConstItemIterator = std::vector<std::pair<uint32_t, std::shared_ptr<FloorItem>>>::const_iterator;
+    ItemIterator lower_bound(uint32_t item_id);
+    ConstItemIterator lower_bound(uint32_t item_id) const;
+    void link(FloorItem* fi);
+    void unlink(FloorItem* fi);
   };
   enum class Flag {
     // clang-format off
@@ -217,7 +241,8 @@ struct Lobby : public std::enable_shared_from_this<Lobby> {
       std::shared_ptr<const Map::RareEnemyRates> rare_rates,
       uint32_t random_seed,
       std::shared_ptr<PSOLFGEncryption> opt_rand_crypt,
-      std::shared_ptr<const std::string> quest_dat_contents_decompressed);
+      std::shared_ptr<const std::string> quest_dat_contents_decompressed,
+      bool lazy = false);
   static std::shared_ptr<Map> load_maps(
       Version version,
       Episode episode,
@@ -231,7 +256,9 @@ struct Lobby : public std::enable_shared_from_this<Lobby> {
       uint32_t random_seed,
       std::shared_ptr<PSOLFGEncryption> opt_rand_crypt,
       const parray<le_uint32_t, 0x20>& variations,
-      const phosg::PrefixedLogger* log = nullptr);
+      const phosg::PrefixedLogger* log = nullptr,
+      std::shared_ptr<MapFloorTemplateCache> template_cache = nullptr,
+      bool lazy = false);
   static std::shared_ptr<Map> load_maps(
       const std::vector<std::string>& enemy_filenames,
       const std::vector<std::string>& object_filenames,
@@ -246,7 +273,40 @@ struct Lobby : public std::enable_shared_from_this<Lobby> {
       std::shared_ptr<const Map::RareEnemyRates> rare_rates,
       uint32_t random_seed,
       std::shared_ptr<PSOLFGEncryption> opt_rand_crypt,
-      const phosg::PrefixedLogger* log = nullptr);
+      const phosg::PrefixedLogger* log = nullptr,
+      std::shared_ptr<MapFloorTemplateCache> template_cache = nullptr,
+      bool lazy = false);
+  // Returns the parsed free-roam map for one floor, using template_cache (if
+  // given) to avoid parsing the same map files more than once
+  static std::shared_ptr<const Map::FloorTemplate> load_floor_template(
+      uint8_t floor,
+      const std::string& enemy_filename,
+      const std::string& object_filename,
+      const std::string& event_filename,
+      Version version,
+      Episode episode,
+      uint8_t difficulty,
+      uint8_t event,
+      std::function<std::shared_ptr<const std::string>(Version, const std::string&)> get_file_data,
+      const phosg::PrefixedLogger* log = nullptr,
+      std::shared_ptr<MapFloorTemplateCache> template_cache = nullptr);
+  // Calls load_floor_template for each floor
+  static std::vector<std::shared_ptr<const Map::FloorTemplate>> load_floor_templates(
+      const std::vector<std::string>& enemy_filenames,
+      const std::vector<std::string>& object_filenames,
+      const std::vector<std::string>& event_filenames,
+      Version version,
+      Episode episode,
+      uint8_t difficulty,
+      uint8_t event,
+      std::function<std::shared_ptr<const std::string>(Version, const std::string&)> get_file_data,
+      const phosg::PrefixedLogger* log = nullptr,
+      std::shared_ptr<MapFloorTemplateCache> template_cache = nullptr);
+  // Returns a function that generates this game's map. The function doesn't
+  // refer to the Lobby or to any mutable server state, so it can be called on
+  // any thread; this is used to create games without blocking the event
+  // thread. load_maps() calls it immediately and sets this->map.
+  std::function<std::shared_ptr<Map>()> map_generator();
   void load_maps();
   void create_ep3_server();
 
@@ -10,9 +10,11 @@
 #include <phosg/JSON.hh>
 #include <phosg/Math.hh>
 #include <phosg/Network.hh>
+#include <phosg/Random.hh>
 #include <phosg/Strings.hh>
 #include <phosg/Tools.hh>
 #include <set>
+#include <shared_mutex>
 #include <thread>
 #include <unordered_map>
 
@@ -29,6 +31,7 @@
 #include "GSLArchive.hh"
 #include "GVMEncoder.hh"
 #include "HTTPServer.hh"
+#include "IPFrameInfo.hh"
 #include "IPStackSimulator.hh"
 #include "Loggers.hh"
 #include "NetworkAddresses.hh"
@@ -1114,6 +1117,18 @@ Action a_find_decryption_seed(
               le_decrypt_buf.data(),
               be_decrypt_buf.data(),
               be_decrypt_buf.size());
+        } else if (!(be_decrypt_buf.size() & 3) && (be_decrypt_buf.size() <= PSOV2Encryption::NUM_FAST_OUTPUTS * 4)) {
+          // Short plaintexts only need the first few values from each seed, so
+          // we can skip constructing the entire cipher
+          uint32_t keys[PSOV2Encryption::NUM_FAST_OUTPUTS];
+          size_t num_keys = be_decrypt_buf.size() >> 2;
+          PSOV2Encryption::outputs_for_seed(keys, seed, num_keys);
+          le_uint32_t* le_data = reinterpret_cast<le_uint32_t*>(le_decrypt_buf.data());
+          be_uint32_t* be_data = reinterpret_cast<be_uint32_t*>(be_decrypt_buf.data());
+          for (size_t z = 0; z < num_keys; z++) {
+            le_data[z] ^= keys[z];
+            be_data[z] ^= keys[z];
+          }
         } else {
           PSOV2Encryption(seed).encrypt_both_endian(
               le_decrypt_buf.data(),
@@ -1902,6 +1917,151 @@ Action a_print_item_parameter_tables(
       }
     });
 
+Action a_simulate_drops(
+    "simulate-drops", "\
+  simulate-drops OPTIONS...\n\
+    Generate many item drops using the server\'s drop tables and print how often\n\
+    each item was generated. This is useful for checking drop table changes\n\
+    before using them, and for measuring item generation performance. A version\n\
+    option (e.g. --bb) and an episode option (--ep1, --ep2, or --ep4) are\n\
+    required, as is --area=FLOOR. Either --enemy=TYPE (e.g. --enemy=HILDEBLUE),\n\
+    --rt-index=INDEX, or --box must also be given to choose the drop source.\n\
+    Difficulty and game mode options may be given as for find-rare-enemy-seeds,\n\
+    and --section-id=NAME chooses the section ID (default Viridia). --count=N\n\
+    specifies how many drops to generate (default 1000000); --threads=COUNT\n\
+    specifies the number of threads to use. Drop N is generated with the random\n\
+    seed SEED + N, where SEED is given by --seed=SEED (hex), so the results do\n\
+    not depend on the thread count. Item generation logs are suppressed unless\n\
+    --verbose is given.\n",
+    +[](phosg::Arguments& args) {
+      auto version = get_cli_version(args);
+      auto episode = get_cli_episode(args);
+      auto difficulty = get_cli_difficulty(args);
+      auto mode = get_cli_game_mode(args);
+      if (episode == Episode::EP3) {
+        throw runtime_error("Episode 3 does not have item drops");
+      }
+      uint8_t area = args.get<uint8_t>("area");
+      string section_id_str = args.get<string>("section-id", false);
+      uint8_t section_id = section_id_str.empty() ? 0 : section_id_for_name(section_id_str);
+      if (section_id == 0xFF) {
+        throw runtime_error("invalid section ID");
+      }
+      bool is_box = args.get<bool>("box");
+      uint32_t rt_index = 0xFFFFFFFF;
+      string enemy_name = args.get<string>("enemy", false);
+      if (!enemy_name.empty()) {
+        rt_index = rare_table_index_for_enemy_type(phosg::enum_for_name<EnemyType>(enemy_name.c_str()));
+        if (rt_index == 0xFF) {
+          throw runtime_error("enemy type does not drop items");
+        }
+      } else if (!args.get<string>("rt-index", false).empty()) {
+        rt_index = args.get<uint32_t>("rt-index");
+      }
+      if (is_box == (rt_index != 0xFFFFFFFF)) {
+        throw runtime_error("exactly one of --enemy, --rt-index, or --box must be given");
+      }
+      uint64_t count = args.get<uint64_t>("count", 1000000);
+      size_t num_threads = args.get<size_t>("threads", 0);
+      if (num_threads == 0) {
+        num_threads = thread::hardware_concurrency();
+      }
+      string seed_str = args.get<string>("seed", false);
+      uint32_t base_seed = seed_str.empty() ? phosg::random_object<uint32_t>() : stoul(seed_str, nullptr, 16);
+
+      auto s = make_shared<ServerState>(get_config_filename(args));
+      s->load_config_early();
+      s->load_patch_indexes(false);
+      s->load_text_index(false);
+      s->load_item_definitions(false);
+      s->load_item_name_indexes(false);
+      s->load_drop_tables(false);
+      if (!args.get<bool>("verbose")) {
+        lobby_log.min_level = phosg::LogLevel::WARNING;
+      }
+
+      // Each thread has its own ItemCreator and its own counts, so the threads
+      // never need to synchronize. parallel_range hands out indexes to threads
+      // dynamically, so the random state can't be per-thread if the results
+      // are to be reproducible; instead, each drop gets a fresh generator
+      // seeded from its index.
+      struct ThreadState {
+        shared_ptr<ItemCreator> item_creator;
+        unordered_map<uint64_t, uint64_t> counts; // {is_rare << 32 | primary_identifier: count}
+        uint64_t num_empty = 0;
+        uint64_t total_meseta = 0;
+      };
+      vector<ThreadState> thread_states(num_threads);
+      for (size_t z = 0; z < num_threads; z++) {
+        thread_states[z].item_creator = s->create_item_creator(version, episode, mode, difficulty, section_id, nullptr);
+      }
+
+      auto thread_fn = [&](uint64_t index, size_t thread_num) -> bool {
+        auto& ts = thread_states[thread_num];
+        ts.item_creator->set_random_crypt(make_shared<PSOV2Encryption>(static_cast<uint32_t>(base_seed + index)));
+        auto res = is_box
+            ? ts.item_creator->on_box_item_drop(area)
+            : ts.item_creator->on_monster_item_drop(rt_index, area);
+        if (res.item.empty()) {
+          ts.num_empty++;
+        } else {
+          if (res.item.data1[0] == 0x04) {
+            ts.total_meseta += res.item.data2d;
+          }
+          ts.counts[(static_cast<uint64_t>(res.is_from_rare_table) << 32) | res.item.primary_identifier()]++;
+        }
+        return false;
+      };
+
+      uint64_t start_time = phosg::now();
+      phosg::parallel_range<uint64_t>(thread_fn, 0, count, num_threads, nullptr);
+      uint64_t elapsed_usecs = phosg::now() - start_time;
+
+      unordered_map<uint64_t, uint64_t> counts;
+      uint64_t num_empty = 0;
+      uint64_t total_meseta = 0;
+      for (const auto& ts : thread_states) {
+        for (const auto& [key, key_count] : ts.counts) {
+          counts[key] += key_count;
+        }
+        num_empty += ts.num_empty;
+        total_meseta += ts.total_meseta;
+      }
+      vector<pair<uint64_t, uint64_t>> sorted_counts(counts.begin(), counts.end());
+      sort(sorted_counts.begin(), sorted_counts.end(), [](const auto& a, const auto& b) -> bool {
+        return (a.second != b.second) ? (a.second > b.second) : (a.first < b.first);
+      });
+
+      string elapsed_str = phosg::format_duration(elapsed_usecs);
+      fprintf(stdout, "Generated %" PRIu64 " drops in %s using %zu threads (%.0f items/sec; base seed %08" PRIX32 ")\n",
+          count, elapsed_str.c_str(), num_threads,
+          static_cast<double>(count) * 1000000.0 / static_cast<double>(max<uint64_t>(elapsed_usecs, 1)), base_seed);
+      auto print_line = [&](const char* rare_str, uint64_t line_count, const string& desc) -> void {
+        double fraction = static_cast<double>(line_count) / static_cast<double>(count);
+        fprintf(stdout, "%4s %10" PRIu64 " %8.4f%% 1/%-10.1f %s\n",
+            rare_str, line_count, fraction * 100.0, 1.0 / fraction, desc.c_str());
+      };
+      if (num_empty) {
+        print_line("", num_empty, "(nothing)");
+      }
+      auto stack_limits = s->item_stack_limits(version);
+      for (const auto& [key, key_count] : sorted_counts) {
+        uint32_t primary_identifier = key & 0xFFFFFFFF;
+        string desc;
+        if (primary_identifier == 0x04000000) {
+          desc = phosg::string_printf("Meseta (average %.1f)", static_cast<double>(total_meseta) / static_cast<double>(key_count));
+        } else {
+          try {
+            ItemData item = ItemData::from_primary_identifier(*stack_limits, primary_identifier);
+            desc = phosg::string_printf("%08" PRIX32 " %s", primary_identifier, s->describe_item(version, item, false).c_str());
+          } catch (const exception& e) {
+            desc = phosg::string_printf("%08" PRIX32 " (%s)", primary_identifier, e.what());
+          }
+        }
+        print_line((key >> 32) ? "RARE" : "", key_count, desc);
+      }
+    });
+
 Action a_show_ep3_cards(
     "show-ep3-cards", "\
   show-ep3-cards\n\
@@ -2171,6 +2331,61 @@ Action a_show_battle_params(
       s->battle_params->get_table(true, Episode::EP4).print(stdout);
     });
 
+Action a_convert_account_storage(
+    "convert-account-storage", "\
+  convert-account-storage --to-log|--to-json\n\
+    Copy all accounts from the per-account JSON files in system/licenses to the\n\
+    account log (system/licenses.log), or vice versa. The source data is not\n\
+    modified or deleted. This should not be done while the server is running.\n\
+    With --to-log, the log is compacted after all accounts are copied.\n",
+    +[](phosg::Arguments& args) {
+      auto log_store = make_shared<AccountLogStore>("system/licenses.log");
+      if (args.get<bool>("to-log")) {
+        log_store->load();
+        size_t count = AccountIndex::export_json_files_to_log(log_store);
+        log_store->compact();
+        fprintf(stderr, "%zu accounts written to %s\n", count, log_store->get_filename().c_str());
+      } else if (args.get<bool>("to-json")) {
+        size_t count = AccountIndex::export_log_to_json_files(log_store);
+        fprintf(stderr, "%zu accounts written to system/licenses\n", count);
+      } else {
+        throw runtime_error("--to-log or --to-json is required");
+      }
+    });
+
+Action a_build_data_snapshot(
+    "build-data-snapshot", "\
+  build-data-snapshot [OUTPUT-FILENAME]\n\
+    Preprocess the static game data (item tables, level tables, and rare item\n\
+    tables) and save the results in a single file, which the server uses at\n\
+    startup instead of parsing the source files again. If OUTPUT-FILENAME is\n\
+    not given, the snapshot is written to system/data-snapshot.bin, which is\n\
+    where the server looks for it. The snapshot is automatically ignored if any\n\
+    of the source files change after it's built.\n",
+    +[](phosg::Arguments& args) {
+      string output_filename = args.get<string>(1, false);
+      if (output_filename.empty()) {
+        output_filename = ServerState::DATA_SNAPSHOT_FILENAME;
+      }
+
+      auto s = make_shared<ServerState>(get_config_filename(args));
+      s->load_config_early();
+      s->data_snapshot_builder = make_shared<DataSnapshot>();
+      s->clear_file_caches(false);
+      s->load_patch_indexes(false);
+      s->load_level_tables(false);
+      s->load_text_index(false);
+      s->load_item_definitions(false);
+      s->load_item_name_indexes(false);
+      s->load_drop_tables(false);
+
+      // The fingerprint is computed after all the data is loaded, so if any
+      // source file changed during loading, the snapshot will be ignored
+      uint64_t fingerprint = s->compute_data_snapshot_fingerprint();
+      phosg::save_file(output_filename, s->data_snapshot_builder->serialize(fingerprint));
+      fprintf(stderr, "%zu entries written to %s\n", s->data_snapshot_builder->size(), output_filename.c_str());
+    });
+
 Action a_find_rare_enemy_seeds(
     "find-rare-enemy-seeds", "\
   find-rare-enemy-seeds OPTIONS...\n\
@@ -2224,56 +2439,158 @@ Action a_find_rare_enemy_seeds(
         rare_rates = s->rare_enemy_rates_by_difficulty[difficulty];
       }
 
-      mutex output_lock;
-      auto thread_fn = [&](uint64_t seed, size_t) -> bool {
-        auto random_crypt = make_shared<PSOV2Encryption>(seed);
-        parray<le_uint32_t, 0x20> variations;
-
-        shared_ptr<Map> map;
-        if (vq) {
-          if (!vq->dat_contents_decompressed) {
-            throw runtime_error("quest does not have DAT data");
+      // Free-roam maps depend on the seed only through the variations and the
+      // rare enemy rolls, so instead of building a Map for each seed, we build
+      // a plan of the rare rolls once for each set of variations and evaluate
+      // only the rolls for each seed. Quest maps can have randomized sections,
+      // so for quests we still build the entire Map.
+
+      // Each thread has its own copy of the plan map, so looking up a plan
+      // (which happens for every seed) doesn't require any synchronization.
+      // The shared map is only used when a thread sees a set of variations
+      // for the first time.
+      if (num_threads == 0) {
+        num_threads = thread::hardware_concurrency();
+      }
+      struct ThreadPlanCache {
+        string key_buf;
+        unordered_map<string, shared_ptr<const Map::RareEnemyRollPlan>> plans;
+      };
+      vector<ThreadPlanCache> thread_plan_caches(num_threads);
+      shared_mutex plans_lock;
+      unordered_map<string, shared_ptr<const Map::RareEnemyRollPlan>> plans;
+      auto get_plan = [&](const parray<le_uint32_t, 0x20>& variations, size_t thread_num) -> shared_ptr<const Map::RareEnemyRollPlan> {
+        auto& cache = thread_plan_caches.at(thread_num);
+        cache.key_buf.assign(reinterpret_cast<const char*>(&variations), sizeof(variations));
+        auto local_it = cache.plans.find(cache.key_buf);
+        if (local_it != cache.plans.end()) {
+          return local_it->second;
+        }
+
+        string key = cache.key_buf;
+        {
+          shared_lock g(plans_lock);
+          auto it = plans.find(key);
+          if (it != plans.end()) {
+            return cache.plans.emplace(std::move(key), it->second).first->second;
           }
-          map = Lobby::load_maps(
-              version, episode, difficulty, 0, 0, rare_rates, seed, random_crypt, vq->dat_contents_decompressed);
+        }
 
-        } else {
-          generate_variations_deprecated(variations, random_crypt, version, episode, (mode == GameMode::SOLO));
-          map = Lobby::load_maps(
+        // Building the plan can take a while, so we don't hold the lock while
+        // doing so. If another thread builds the same plan in the meantime,
+        // the plans are identical, so it doesn't matter which one is kept.
+        vector<shared_ptr<const Map::FloorTemplate>> floors;
+        if (mode != GameMode::CHALLENGE) {
+          auto sdt = s->set_data_table(version, episode, mode, difficulty);
+          floors = Lobby::load_floor_templates(
+              sdt->map_filenames_for_variations(variations, episode, mode, SetDataTable::FilenameType::ENEMIES),
+              sdt->map_filenames_for_variations(variations, episode, mode, SetDataTable::FilenameType::OBJECTS),
+              sdt->map_filenames_for_variations(variations, episode, mode, SetDataTable::FilenameType::EVENTS),
               version,
               episode,
-              mode,
               difficulty,
               0,
-              0,
-              s->set_data_table(version, episode, mode, difficulty),
               bind(&ServerState::load_map_file, s.get(), placeholders::_1, placeholders::_2),
-              rare_rates,
-              seed,
-              random_crypt,
-              variations);
+              nullptr,
+              s->map_floor_template_cache);
         }
+        auto plan = make_shared<const Map::RareEnemyRollPlan>(version, floors, rare_rates);
 
-        vector<size_t> rare_indexes;
-        for (size_t z = 0; z < map->enemies.size(); z++) {
-          if (enemy_type_is_rare(map->enemies[z].type)) {
-            rare_indexes.emplace_back(z);
-          }
-        }
+        unique_lock g(plans_lock);
+        auto ret = plans.emplace(key, std::move(plan)).first->second;
+        return cache.plans.emplace(std::move(key), ret).first->second;
+      };
 
-        if (rare_indexes.size() >= min_count) {
+      mutex output_lock;
+      auto report_seed = [&](uint64_t seed, const vector<pair<size_t, EnemyType>>& rare_enemies) -> void {
+        if (rare_enemies.size() >= min_count) {
           lock_guard g(output_lock);
           fprintf(stdout, "%08" PRIX64 ":", seed);
-          for (size_t index : rare_indexes) {
-            fprintf(stdout, " E-%zX:%s", index, phosg::name_for_enum(map->enemies[index].type));
+          for (const auto& [index, type] : rare_enemies) {
+            fprintf(stdout, " E-%zX:%s", index, phosg::name_for_enum(type));
           }
           fprintf(stdout, "\n");
         }
+      };
 
+      // Seeds are searched in blocks. On non-BB versions, a free-roam seed is
+      // only used to generate the variations (which take at most the first
+      // 0x20 values from the seed's random stream) and for the rare enemy
+      // rolls, so we compute the random values for all seeds in the block at
+      // once instead of constructing a PSOV2Encryption for each seed. The rare
+      // enemy rolls are also computed for the whole block at once, since
+      // consecutive seeds share most of their rolls' random values (see
+      // Map::client_rare_rolls_succeed). BB needs the rest of the stream for
+      // its rare enemy rolls, and quests need an entire Map, so in those cases
+      // we still construct the crypt per seed.
+      static constexpr size_t SEED_BLOCK_SIZE = 0x400;
+      bool use_block_outputs = !vq && (version != Version::BB_V4);
+      struct ThreadBlockState {
+        vector<uint32_t> variation_values;
+        vector<shared_ptr<const Map::RareEnemyRollPlan>> plans;
+        vector<uint8_t> roll_succeeds;
+      };
+      vector<ThreadBlockState> thread_block_states(num_threads);
+      auto thread_fn = [&](uint64_t block_index, size_t thread_num) -> bool {
+        uint64_t block_start_seed = block_index * SEED_BLOCK_SIZE;
+
+        if (use_block_outputs) {
+          auto& bs = thread_block_states[thread_num];
+          // variation_values[z * SEED_BLOCK_SIZE + w] is the zth random value
+          // for the seed (block_start_seed + w)
+          bs.variation_values.resize(0x20 * SEED_BLOCK_SIZE);
+          for (size_t z = 0; z < 0x20; z++) {
+            PSOV2Encryption::outputs_for_seeds(&bs.variation_values[z * SEED_BLOCK_SIZE], block_start_seed, SEED_BLOCK_SIZE, z);
+          }
+          bs.plans.resize(SEED_BLOCK_SIZE);
+          size_t max_num_rolled_enemies = 0;
+          for (size_t w = 0; w < SEED_BLOCK_SIZE; w++) {
+            size_t value_index = 0;
+            auto next_value = [&]() -> uint32_t {
+              return bs.variation_values[(value_index++) * SEED_BLOCK_SIZE + w];
+            };
+            parray<le_uint32_t, 0x20> variations;
+            generate_variations_deprecated(variations, next_value, version, episode, (mode == GameMode::SOLO));
+            bs.plans[w] = get_plan(variations, thread_num);
+            if (!bs.plans[w]->rolls.empty()) {
+              max_num_rolled_enemies = max<size_t>(max_num_rolled_enemies, bs.plans[w]->rolls.back().enemy_index + 1);
+            }
+          }
+
+          bs.roll_succeeds.resize(SEED_BLOCK_SIZE + max_num_rolled_enemies);
+          Map::client_rare_rolls_succeed(bs.roll_succeeds.data(), version, block_start_seed, bs.roll_succeeds.size());
+          for (size_t w = 0; w < SEED_BLOCK_SIZE; w++) {
+            report_seed(block_start_seed + w, bs.plans[w]->rare_enemies_for_client_rolls(&bs.roll_succeeds[w]));
+          }
+          return false;
+        }
+
+        for (uint64_t seed = block_start_seed; seed < block_start_seed + SEED_BLOCK_SIZE; seed++) {
+          auto random_crypt = make_shared<PSOV2Encryption>(seed);
+          if (vq) {
+            if (!vq->dat_contents) {
+              throw runtime_error("quest does not have DAT data");
+            }
+            auto map = Lobby::load_maps(
+                version, episode, difficulty, 0, 0, rare_rates, seed, random_crypt, vq->decompressed_dat());
+            vector<pair<size_t, EnemyType>> rare_enemies;
+            for (size_t z = 0; z < map->enemies.size(); z++) {
+              if (enemy_type_is_rare(map->enemies[z].type)) {
+                rare_enemies.emplace_back(z, map->enemies[z].type);
+              }
+            }
+            report_seed(seed, rare_enemies);
+
+          } else {
+            parray<le_uint32_t, 0x20> variations;
+            generate_variations_deprecated(variations, random_crypt, version, episode, (mode == GameMode::SOLO));
+            report_seed(seed, get_plan(variations, thread_num)->rare_enemies_for_seed(seed, random_crypt));
+          }
+        }
         return false;
       };
 
-      phosg::parallel_range<uint64_t>(thread_fn, 0, 0x100000000, num_threads, nullptr);
+      phosg::parallel_range<uint64_t>(thread_fn, 0, 0x100000000 / SEED_BLOCK_SIZE, num_threads, nullptr);
     });
 
 Action a_load_maps_test(
@@ -2377,7 +2694,7 @@ Action a_load_maps_test(
               Map::DEFAULT_RARE_ENEMIES,
               0,
               nullptr,
-              vq->dat_contents_decompressed);
+              vq->decompressed_dat());
           fprintf(stderr, "... %" PRIu32 " (%s) %s %s %s => %zu enemies (%zu sets), %zu objects, %zu events\n",
               vq->quest_number,
               vq->name.c_str(),
@@ -2488,6 +2805,21 @@ Action a_dc_serial_number_speed_test(
       }
     });
 
+Action a_ip_checksum_speed_test(
+    "ip-checksum-speed-test", "\
+  ip-checksum-speed-test [--seed=SEED]\n\
+    Run a speed test of the IP checksum function used by the IP stack simulator\n\
+    against a simple byte-wise implementation, using random frames of several\n\
+    common sizes.\n",
+    +[](phosg::Arguments& args) {
+      const string& seed = args.get<string>("seed");
+      if (seed.empty()) {
+        ip_checksum_speed_test();
+      } else {
+        ip_checksum_speed_test(stoul(seed, nullptr, 16));
+      }
+    });
+
 Action a_address_translator(
     "address-translator", nullptr, +[](phosg::Arguments& args) {
       const string& dir = args.get<string>(1, false);
@@ -2664,6 +2996,14 @@ Action a_run_server_replay_log(
         config_log.info("DNS server is disabled");
       }
 
+      state->reload_jobs = make_shared<ReloadJobManager>(state);
+      if (!is_replay && state->num_game_creation_threads) {
+        state->game_creation_pool = make_shared<WorkerPool>(state->num_game_creation_threads);
+      }
+      if (!is_replay && state->num_proxy_capture_threads) {
+        state->proxy_capture_pool = make_shared<WorkerPool>(state->num_proxy_capture_threads);
+      }
+
       shared_ptr<ServerShell> shell;
       shared_ptr<ReplaySession> replay_session;
       if (is_replay) {
@@ -2838,6 +3178,12 @@ Action a_run_server_replay_log(
         config_log.info("Waiting for HTTP server to stop");
         state->http_server->wait_for_stop();
       }
+      config_log.info("Waiting for reload jobs to stop");
+      state->reload_jobs.reset();
+      config_log.info("Waiting for game creation threads to stop");
+      state->game_creation_pool.reset();
+      config_log.info("Waiting for proxy captures to finish");
+      state->proxy_capture_pool.reset();
       state->proxy_server.reset(); // Break reference cycle
     });
 
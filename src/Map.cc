@@ -1,5 +1,6 @@
 #include "Map.hh"
 
+#include <algorithm>
 #include <phosg/Filesystem.hh>
 #include <phosg/Random.hh>
 #include <phosg/Strings.hh>
@@ -18,6 +19,10 @@ static uint64_t section_index_key(uint8_t floor, uint16_t section, uint16_t wave
   return (static_cast<uint64_t>(floor) << 32) | (static_cast<uint64_t>(section) << 16) | static_cast<uint64_t>(wave_number);
 }
 
+static uint64_t floor_type_key(uint8_t floor, EnemyType type) {
+  return (static_cast<uint64_t>(floor) << 32) | static_cast<uint32_t>(type);
+}
+
 const char* Map::name_for_object_type(uint16_t type) {
   switch (type) {
     case 0x0000:
@@ -727,6 +732,9 @@ void Map::clear() {
   this->objects.clear();
   this->enemies.clear();
   this->rare_enemy_indexes.clear();
+  this->floor_section_and_group_to_object.clear();
+  this->floor_section_and_wave_number_to_enemy.clear();
+  this->floor_and_type_to_enemy.clear();
 }
 
 void Map::add_objects_from_map_data(uint8_t floor, const void* data, size_t size) {
@@ -754,8 +762,7 @@ void Map::add_objects_from_map_data(uint8_t floor, const void* data, size_t size
         .set_flags = 0,
         .item_drop_checked = false,
     });
-    uint64_t k = section_index_key(floor, objects[z].section, objects[z].group);
-    this->floor_section_and_group_to_object_index.emplace(k, object_id);
+    this->floor_section_and_group_to_object.add(section_index_key(floor, objects[z].section, objects[z].group), object_id);
   }
 }
 
@@ -775,14 +782,7 @@ bool Map::check_and_log_rare_enemy(bool default_is_rare, uint32_t rare_rate) {
     }
 
   } else {
-    // TODO: We only need the first value from this crypt, so it's unfortunate
-    // that we have to initialize the entire thing. Find a way to make this
-    // faster.
-    PSOV2Encryption crypt(this->rare_seed + 0x1000 + this->enemies.size());
-    float det = (static_cast<float>((crypt.next() >> 16) & 0xFFFF) / 65536.0f);
-    // On v1 and v2 (and GC NTE), the rare rate is 0.1% instead of 0.2%.
-    float threshold = is_v1_or_v2(this->version) ? 0.001f : 0.002f;
-    if (det < threshold) {
+    if (Map::client_rare_roll_succeeds(this->version, this->rare_seed, this->enemies.size())) {
       this->rare_enemy_indexes.emplace_back(this->enemies.size());
       return true;
     }
@@ -805,8 +805,22 @@ void Map::add_enemy(
   auto add = [&](EnemyType type, uint16_t alias_enemy_id = 0xFFFF) -> void {
     uint16_t enemy_id = this->enemies.size();
     this->enemies.emplace_back(enemy_id, source_index, set_index, floor, e.section, e.wave_number, type, alias_enemy_id);
-    uint64_t k = section_index_key(floor, e.section, e.wave_number);
-    this->floor_section_and_wave_number_to_enemy_index.emplace(k, enemy_id);
+    this->floor_section_and_wave_number_to_enemy.add(section_index_key(floor, e.section, e.wave_number), enemy_id);
+    this->floor_and_type_to_enemy.add(floor_type_key(floor, type), enemy_id);
+  };
+  auto add_possibly_rare = [&](bool default_is_rare, uint32_t RareEnemyRates::* rate, EnemyType type, EnemyType rare_type) -> void {
+    if (this->defer_rare_enemies) {
+      this->deferred_rare_enemies.emplace_back(FloorTemplate::RareEnemyCandidate{
+          .enemy_index = this->enemies.size(),
+          .num_enemies = 1,
+          .default_is_rare = default_is_rare,
+          .rate = rate,
+          .rare_type = rare_type,
+      });
+      add(type);
+    } else {
+      add(this->check_and_log_rare_enemy(default_is_rare, (*rare_rates).*rate) ? rare_type : type);
+    }
   };
 
   EnemyType child_type = EnemyType::UNKNOWN;
@@ -879,42 +893,38 @@ void Map::add_enemy(
 
     case 0x0040: { // TObjEneMoja
       bool default_is_rare = (this->version == Version::BB_V4) ? (e.uparam1 & 1) : (e.uparam1 != 0);
-      add(this->check_and_log_rare_enemy(default_is_rare, rare_rates->hildeblue)
-              ? EnemyType::HILDEBLUE
-              : EnemyType::HILDEBEAR);
+      add_possibly_rare(default_is_rare, &RareEnemyRates::hildeblue, EnemyType::HILDEBEAR, EnemyType::HILDEBLUE);
       break;
     }
     case 0x0041: { // TObjEneLappy
       bool default_is_rare = (this->version == Version::BB_V4) ? (e.uparam1 & 1) : (e.uparam1 != 0);
-      bool is_rare = this->check_and_log_rare_enemy(default_is_rare, rare_rates->rappy);
       switch (episode) {
         case Episode::EP1:
-          add(is_rare ? EnemyType::AL_RAPPY : EnemyType::RAG_RAPPY);
+          add_possibly_rare(default_is_rare, &RareEnemyRates::rappy, EnemyType::RAG_RAPPY, EnemyType::AL_RAPPY);
           break;
-        case Episode::EP2:
-          if (is_rare) {
-            switch (event) {
-              case 0x01: // rappy_type 1
-                add(EnemyType::SAINT_RAPPY);
-                break;
-              case 0x04: // rappy_type 2
-                add(EnemyType::EGG_RAPPY);
-                break;
-              case 0x05: // rappy_type 3
-                add(EnemyType::HALLO_RAPPY);
-                break;
-              default:
-                add(EnemyType::LOVE_RAPPY);
-            }
-          } else {
-            add(EnemyType::RAG_RAPPY);
+        case Episode::EP2: {
+          EnemyType rare_type;
+          switch (event) {
+            case 0x01: // rappy_type 1
+              rare_type = EnemyType::SAINT_RAPPY;
+              break;
+            case 0x04: // rappy_type 2
+              rare_type = EnemyType::EGG_RAPPY;
+              break;
+            case 0x05: // rappy_type 3
+              rare_type = EnemyType::HALLO_RAPPY;
+              break;
+            default:
+              rare_type = EnemyType::LOVE_RAPPY;
           }
+          add_possibly_rare(default_is_rare, &RareEnemyRates::rappy, EnemyType::RAG_RAPPY, rare_type);
           break;
+        }
         case Episode::EP4:
           if (e.floor > 0x05) {
-            add(is_rare ? EnemyType::DEL_RAPPY_ALT : EnemyType::SAND_RAPPY_ALT);
+            add_possibly_rare(default_is_rare, &RareEnemyRates::rappy, EnemyType::SAND_RAPPY_ALT, EnemyType::DEL_RAPPY_ALT);
           } else {
-            add(is_rare ? EnemyType::DEL_RAPPY : EnemyType::SAND_RAPPY);
+            add_possibly_rare(default_is_rare, &RareEnemyRates::rappy, EnemyType::SAND_RAPPY, EnemyType::DEL_RAPPY);
           }
           break;
         default:
@@ -942,9 +952,7 @@ void Map::add_enemy(
       if ((episode == Episode::EP2) && (e.floor == 0x11)) {
         add(EnemyType::DEL_LILY);
       } else {
-        add(this->check_and_log_rare_enemy(false, rare_rates->nar_lily)
-                ? EnemyType::NAR_LILY
-                : EnemyType::POISON_LILY);
+        add_possibly_rare(false, &RareEnemyRates::nar_lily, EnemyType::POISON_LILY, EnemyType::NAR_LILY);
       }
       break;
     case 0x0062: // TObjEneNanoDrago
@@ -961,9 +969,11 @@ void Map::add_enemy(
       }
       default_num_children = -1; // Skip adding children (because we do it here)
       for (size_t z = 0; z < 5; z++) {
-        add(this->check_and_log_rare_enemy((this->version == Version::BB_V4) && (e.uparam2 & 1), rare_rates->pouilly_slime)
-                ? EnemyType::POUILLY_SLIME
-                : EnemyType::POFUILLY_SLIME);
+        add_possibly_rare(
+            (this->version == Version::BB_V4) && (e.uparam2 & 1),
+            &RareEnemyRates::pouilly_slime,
+            EnemyType::POFUILLY_SLIME,
+            EnemyType::POUILLY_SLIME);
       }
       break;
     case 0x0065: // TObjEnePanarms
@@ -1179,22 +1189,18 @@ void Map::add_enemy(
       }
       break;
     case 0x0112:
-      add(this->check_and_log_rare_enemy(e.uparam1 & 0x01, rare_rates->merissa_aa)
-              ? EnemyType::MERISSA_AA
-              : EnemyType::MERISSA_A);
+      add_possibly_rare(e.uparam1 & 0x01, &RareEnemyRates::merissa_aa, EnemyType::MERISSA_A, EnemyType::MERISSA_AA);
       break;
     case 0x0113:
       add(EnemyType::GIRTABLULU);
       break;
-    case 0x0114: {
-      bool is_rare = this->check_and_log_rare_enemy(e.uparam1 & 0x01, rare_rates->pazuzu);
+    case 0x0114:
       if (e.floor > 0x05) {
-        add(is_rare ? EnemyType::PAZUZU_ALT : EnemyType::ZU_ALT);
+        add_possibly_rare(e.uparam1 & 0x01, &RareEnemyRates::pazuzu, EnemyType::ZU_ALT, EnemyType::PAZUZU_ALT);
       } else {
-        add(is_rare ? EnemyType::PAZUZU : EnemyType::ZU);
+        add_possibly_rare(e.uparam1 & 0x01, &RareEnemyRates::pazuzu, EnemyType::ZU, EnemyType::PAZUZU);
       }
       break;
-    }
     case 0x0115:
       if (e.uparam1 & 2) {
         add(EnemyType::BA_BOOTA);
@@ -1203,25 +1209,21 @@ void Map::add_enemy(
       }
       break;
     case 0x0116:
-      add(this->check_and_log_rare_enemy(e.uparam1 & 0x01, rare_rates->dorphon_eclair)
-              ? EnemyType::DORPHON_ECLAIR
-              : EnemyType::DORPHON);
+      add_possibly_rare(e.uparam1 & 0x01, &RareEnemyRates::dorphon_eclair, EnemyType::DORPHON, EnemyType::DORPHON_ECLAIR);
       break;
     case 0x0117: {
       static const EnemyType types[3] = {EnemyType::GORAN, EnemyType::PYRO_GORAN, EnemyType::GORAN_DETONATOR};
       add(types[e.uparam1 % 3]);
       break;
     }
-    case 0x0119: {
-      bool is_rare = this->check_and_log_rare_enemy((e.fparam2 != 0.0f), rare_rates->kondrieu);
-      if (is_rare) {
-        add(EnemyType::KONDRIEU);
-      } else {
-        add((e.uparam1 & 1) ? EnemyType::SHAMBERTIN : EnemyType::SAINT_MILLION);
-      }
+    case 0x0119:
+      add_possibly_rare(
+          (e.fparam2 != 0.0f),
+          &RareEnemyRates::kondrieu,
+          (e.uparam1 & 1) ? EnemyType::SHAMBERTIN : EnemyType::SAINT_MILLION,
+          EnemyType::KONDRIEU);
       default_num_children = 0x18;
       break;
-    }
 
     case 0x00C3: // TBoss3VoloptP01
     case 0x00C4: // TBoss3VoloptCore or subclass
@@ -1243,6 +1245,13 @@ void Map::add_enemy(
     size_t num_children = e.num_children ? e.num_children.load() : default_num_children;
     if ((child_type == EnemyType::UNKNOWN) && !this->enemies.empty()) {
       child_type = this->enemies.back().type;
+      // If the parent's rare roll was deferred, the children must follow the
+      // result of that roll too
+      if (this->defer_rare_enemies &&
+          !this->deferred_rare_enemies.empty() &&
+          (this->deferred_rare_enemies.back().enemy_index == this->enemies.size() - 1)) {
+        this->deferred_rare_enemies.back().num_enemies += num_children;
+      }
     }
     for (size_t x = 0; x < num_children; x++) {
       add(child_type);
@@ -1490,28 +1499,15 @@ void Map::add_event(uint32_t event_id, uint16_t flags, uint8_t floor, uint16_t s
   ev.floor = floor;
   ev.action_stream_offset = action_stream_offset;
 
-  uint64_t k = (static_cast<uint64_t>(floor) << 32) | event_id;
-  this->floor_and_event_id_to_index.emplace(k, index);
-  k = section_index_key(floor, section, wave_number);
-  this->floor_section_and_wave_number_to_event_index.emplace(k, index);
+  this->floor_and_event_id_to_event.add((static_cast<uint64_t>(floor) << 32) | event_id, index);
+  this->floor_section_and_wave_number_to_event.add(section_index_key(floor, section, wave_number), index);
 }
 
-vector<Map::Event*> Map::get_events(uint8_t floor, uint32_t event_id) {
-  uint64_t k = (static_cast<uint64_t>(floor) << 32) | event_id;
-  vector<Event*> ret;
-  for (auto its = this->floor_and_event_id_to_index.equal_range(k); its.first != its.second; its.first++) {
-    ret.emplace_back(&this->events.at(its.first->second));
+span<Map::Event* const> Map::get_events(uint8_t floor, uint32_t event_id) {
+  if (!this->floor_and_event_id_to_event.built()) {
+    this->floor_and_event_id_to_event.build(this->events);
   }
-  return ret;
-}
-
-vector<const Map::Event*> Map::get_events(uint8_t floor, uint32_t event_id) const {
-  uint64_t k = (static_cast<uint64_t>(floor) << 32) | event_id;
-  vector<const Event*> ret;
-  for (auto its = this->floor_and_event_id_to_index.equal_range(k); its.first != its.second; its.first++) {
-    ret.emplace_back(&this->events.at(its.first->second));
-  }
-  return ret;
+  return this->floor_and_event_id_to_event.find((static_cast<uint64_t>(floor) << 32) | event_id);
 }
 
 void Map::add_events_from_map_data(uint8_t floor, const void* data, size_t size) {
@@ -1532,6 +1528,176 @@ void Map::add_events_from_map_data(uint8_t floor, const void* data, size_t size)
   }
 }
 
+shared_ptr<const Map::FloorTemplate> Map::FloorTemplate::from_map_data(
+    Version version,
+    Episode episode,
+    uint8_t difficulty,
+    uint8_t event,
+    uint8_t floor,
+    shared_ptr<const string> enemies_data,
+    shared_ptr<const string> objects_data,
+    shared_ptr<const string> events_data) {
+  Map map(version, 0, 0, nullptr);
+  map.defer_rare_enemies = true;
+  if (enemies_data) {
+    map.add_enemies_from_map_data(episode, difficulty, event, floor, enemies_data->data(), enemies_data->size());
+  }
+  if (objects_data) {
+    map.add_objects_from_map_data(floor, objects_data->data(), objects_data->size());
+  }
+  if (events_data) {
+    map.add_events_from_map_data(floor, events_data->data(), events_data->size());
+  }
+
+  auto ret = make_shared<FloorTemplate>();
+  ret->floor = floor;
+  ret->objects = std::move(map.objects);
+  ret->enemies = std::move(map.enemies);
+  ret->num_enemy_sets = map.enemy_set_flags.size();
+  ret->rare_enemy_candidates = std::move(map.deferred_rare_enemies);
+  ret->events = std::move(map.events);
+  ret->event_action_stream = std::move(map.event_action_stream);
+  return ret;
+}
+
+void Map::add_floor_from_template(const FloorTemplate& t, shared_ptr<const RareEnemyRates> rare_rates) {
+  uint16_t base_object_id = this->objects.size();
+  this->objects.reserve(this->objects.size() + t.objects.size());
+  for (const auto& src_obj : t.objects) {
+    auto& obj = this->objects.emplace_back(src_obj);
+    obj.object_id = base_object_id + src_obj.object_id;
+    this->floor_section_and_group_to_object.add(section_index_key(obj.floor, obj.section, obj.group), obj.object_id);
+  }
+
+  uint16_t base_enemy_id = this->enemies.size();
+  size_t base_set_index = this->enemy_set_flags.size();
+  this->enemy_set_flags.resize(base_set_index + t.num_enemy_sets, 0);
+  this->enemies.reserve(this->enemies.size() + t.enemies.size());
+  auto candidate_it = t.rare_enemy_candidates.begin();
+  EnemyType rare_type = EnemyType::UNKNOWN;
+  size_t rare_end_index = 0;
+  for (size_t z = 0; z < t.enemies.size(); z++) {
+    // The rare roll must happen before the enemy is added, since the enemy's
+    // index is part of the roll on non-BB versions
+    if ((candidate_it != t.rare_enemy_candidates.end()) && (candidate_it->enemy_index == z)) {
+      if (this->check_and_log_rare_enemy(candidate_it->default_is_rare, (*rare_rates).*(candidate_it->rate))) {
+        rare_type = candidate_it->rare_type;
+        rare_end_index = z + candidate_it->num_enemies;
+      }
+      candidate_it++;
+    }
+
+    const auto& src_ene = t.enemies[z];
+    auto& ene = this->enemies.emplace_back(src_ene);
+    ene.enemy_id = base_enemy_id + src_ene.enemy_id;
+    ene.set_index = base_set_index + src_ene.set_index;
+    if (ene.alias_entity_id != 0xFFFF) {
+      ene.alias_entity_id += base_enemy_id;
+    }
+    if (z < rare_end_index) {
+      ene.type = rare_type;
+    }
+    this->floor_section_and_wave_number_to_enemy.add(section_index_key(ene.floor, ene.section, ene.wave_number), ene.enemy_id);
+    this->floor_and_type_to_enemy.add(floor_type_key(ene.floor, ene.type), ene.enemy_id);
+  }
+
+  uint32_t base_action_stream_offset = this->event_action_stream.size();
+  this->event_action_stream += t.event_action_stream;
+  this->events.reserve(this->events.size() + t.events.size());
+  for (const auto& ev : t.events) {
+    this->add_event(ev.event_id, ev.flags, ev.floor, ev.section, ev.wave_number, ev.action_stream_offset + base_action_stream_offset);
+  }
+}
+
+Map::RareEnemyRollPlan::RareEnemyRollPlan(
+    Version version,
+    const vector<shared_ptr<const FloorTemplate>>& floors,
+    shared_ptr<const RareEnemyRates> rare_rates)
+    : version(version) {
+  size_t base_enemy_index = 0;
+  for (const auto& t : floors) {
+    auto candidate_it = t->rare_enemy_candidates.begin();
+    size_t candidate_end_index = 0;
+    for (size_t z = 0; z < t->enemies.size(); z++) {
+      if ((candidate_it != t->rare_enemy_candidates.end()) && (candidate_it->enemy_index == z)) {
+        candidate_end_index = z + candidate_it->num_enemies;
+        if (candidate_it->default_is_rare) {
+          for (size_t w = z; w < candidate_end_index; w++) {
+            this->fixed_rare_enemies.emplace_back(base_enemy_index + w, candidate_it->rare_type);
+          }
+        } else {
+          this->rolls.emplace_back(Roll{
+              .enemy_index = base_enemy_index + z,
+              .num_enemies = candidate_it->num_enemies,
+              .rate = (*rare_rates).*(candidate_it->rate),
+              .rare_type = candidate_it->rare_type,
+          });
+        }
+        candidate_it++;
+      }
+      if ((z >= candidate_end_index) && enemy_type_is_rare(t->enemies[z].type)) {
+        this->fixed_rare_enemies.emplace_back(base_enemy_index + z, t->enemies[z].type);
+      }
+    }
+    base_enemy_index += t->enemies.size();
+  }
+}
+
+vector<pair<size_t, EnemyType>> Map::RareEnemyRollPlan::rare_enemies_for_seed(
+    uint32_t rare_seed, shared_ptr<PSOLFGEncryption> opt_rand_crypt) const {
+  vector<pair<size_t, EnemyType>> ret = this->fixed_rare_enemies;
+  // This must match check_and_log_rare_enemy
+  size_t num_rolled_rares = 0;
+  for (const auto& roll : this->rolls) {
+    bool is_rare;
+    if (this->version == Version::BB_V4) {
+      is_rare = (num_rolled_rares < 0x10) && (random_from_optional_crypt(opt_rand_crypt) < roll.rate);
+    } else {
+      is_rare = Map::client_rare_roll_succeeds(this->version, rare_seed, roll.enemy_index);
+    }
+    if (is_rare) {
+      num_rolled_rares++;
+      for (size_t z = 0; z < roll.num_enemies; z++) {
+        ret.emplace_back(roll.enemy_index + z, roll.rare_type);
+      }
+    }
+  }
+  if (!this->fixed_rare_enemies.empty() && (ret.size() > this->fixed_rare_enemies.size())) {
+    sort(ret.begin(), ret.end());
+  }
+  return ret;
+}
+
+vector<pair<size_t, EnemyType>> Map::RareEnemyRollPlan::rare_enemies_for_client_rolls(const uint8_t* roll_succeeds) const {
+  vector<pair<size_t, EnemyType>> ret = this->fixed_rare_enemies;
+  for (const auto& roll : this->rolls) {
+    if (roll_succeeds[roll.enemy_index]) {
+      for (size_t z = 0; z < roll.num_enemies; z++) {
+        ret.emplace_back(roll.enemy_index + z, roll.rare_type);
+      }
+    }
+  }
+  if (!this->fixed_rare_enemies.empty() && (ret.size() > this->fixed_rare_enemies.size())) {
+    sort(ret.begin(), ret.end());
+  }
+  return ret;
+}
+
+void Map::client_rare_rolls_succeed(uint8_t* out, Version version, uint32_t rare_seed, size_t count) {
+  // The random values are generated in chunks with outputs_for_seeds, and the
+  // threshold is checked on each entire chunk; both loops can be vectorized
+  float threshold = Map::client_rare_roll_threshold(version);
+  uint32_t values[0x100];
+  for (size_t chunk_start = 0; chunk_start < count; chunk_start += 0x100) {
+    size_t chunk_size = min<size_t>(count - chunk_start, 0x100);
+    PSOV2Encryption::outputs_for_seeds(values, rare_seed + 0x1000 + chunk_start, chunk_size);
+    for (size_t z = 0; z < chunk_size; z++) {
+      float det = (static_cast<float>((values[z] >> 16) & 0xFFFF) / 65536.0f);
+      out[chunk_start + z] = (det < threshold);
+    }
+  }
+}
+
 vector<Map::DATSectionsForFloor> Map::collect_quest_map_data_sections(const void* data, size_t size) {
   vector<DATSectionsForFloor> ret;
   phosg::StringReader r(data, size);
@@ -1593,6 +1759,70 @@ vector<Map::DATSectionsForFloor> Map::collect_quest_map_data_sections(const void
   return ret;
 }
 
+static void add_entities_from_quest_floor_data(
+    Map& map,
+    Episode episode,
+    uint8_t difficulty,
+    uint8_t event,
+    uint8_t floor,
+    const Map::DATSectionsForFloor& floor_sections,
+    const phosg::StringReader& r,
+    shared_ptr<Map::DATParserRandomState>& random_state,
+    shared_ptr<const Map::RareEnemyRates> rare_rates) {
+  if (floor_sections.objects != 0xFFFFFFFF) {
+    const auto& header = r.pget<Map::SectionHeader>(floor_sections.objects);
+    if (header.data_size % sizeof(Map::ObjectEntry)) {
+      throw runtime_error("quest layout object section size is not a multiple of object entry size");
+    }
+    map.add_objects_from_map_data(floor, r.pgetv(floor_sections.objects + sizeof(header), header.data_size), header.data_size);
+  }
+
+  if ((floor_sections.wave_events != 0xFFFFFFFF) &&
+      (floor_sections.random_enemy_locations != 0xFFFFFFFF) &&
+      (floor_sections.random_enemy_definitions != 0xFFFFFFFF)) {
+    // Challenge Mode random enemy waves
+    const auto& wave_events_header = r.pget<Map::SectionHeader>(floor_sections.wave_events);
+    const auto& random_enemy_locations_header = r.pget<Map::SectionHeader>(floor_sections.random_enemy_locations);
+    const auto& random_enemy_definitions_header = r.pget<Map::SectionHeader>(floor_sections.random_enemy_definitions);
+    if (!random_state) {
+      random_state = make_shared<Map::DATParserRandomState>(map.rare_seed);
+    }
+    map.add_random_enemies_from_map_data(
+        episode,
+        difficulty,
+        event,
+        floor,
+        r.sub(floor_sections.wave_events + sizeof(Map::SectionHeader), wave_events_header.data_size),
+        r.sub(floor_sections.random_enemy_locations + sizeof(Map::SectionHeader), random_enemy_locations_header.data_size),
+        r.sub(floor_sections.random_enemy_definitions + sizeof(Map::SectionHeader), random_enemy_definitions_header.data_size),
+        random_state,
+        rare_rates);
+
+  } else {
+    // Non-Challenge (standard) enemies
+    if (floor_sections.enemies != 0xFFFFFFFF) {
+      const auto& header = r.pget<Map::SectionHeader>(floor_sections.enemies);
+      if (header.data_size % sizeof(Map::EnemyEntry)) {
+        throw runtime_error("quest layout enemy section size is not a multiple of enemy entry size");
+      }
+      map.add_enemies_from_map_data(
+          episode,
+          difficulty,
+          event,
+          floor,
+          r.pgetv(floor_sections.enemies + sizeof(header), header.data_size),
+          header.data_size,
+          rare_rates);
+    }
+
+    if (floor_sections.wave_events != 0xFFFFFFFF) {
+      const auto& wave_events_header = r.pget<Map::SectionHeader>(floor_sections.wave_events);
+      const void* data = r.pgetv(floor_sections.wave_events + sizeof(Map::SectionHeader), wave_events_header.data_size);
+      map.add_events_from_map_data(floor, data, wave_events_header.data_size);
+    }
+  }
+}
+
 void Map::add_entities_from_quest_data(
     Episode episode,
     uint8_t difficulty,
@@ -1605,61 +1835,62 @@ void Map::add_entities_from_quest_data(
   phosg::StringReader r(data, size);
   shared_ptr<DATParserRandomState> random_state;
   for (size_t floor = 0; floor < all_floor_sections.size(); floor++) {
-    const auto& floor_sections = all_floor_sections[floor];
+    add_entities_from_quest_floor_data(
+        *this, episode, difficulty, event, floor, all_floor_sections[floor], r, random_state, rare_rates);
+  }
+}
 
-    if (floor_sections.objects != 0xFFFFFFFF) {
-      const auto& header = r.pget<SectionHeader>(floor_sections.objects);
-      if (header.data_size % sizeof(ObjectEntry)) {
-        throw runtime_error("quest layout object section size is not a multiple of object entry size");
-      }
-      this->add_objects_from_map_data(floor, r.pgetv(floor_sections.objects + sizeof(header), header.data_size), header.data_size);
-    }
+void Map::add_pending_floors_from_quest_data(
+    Episode episode,
+    uint8_t difficulty,
+    uint8_t event,
+    shared_ptr<const string> data,
+    shared_ptr<const RareEnemyRates> rare_rates) {
+  auto all_floor_sections = this->collect_quest_map_data_sections(data->data(), data->size());
 
-    if ((floor_sections.wave_events != 0xFFFFFFFF) &&
-        (floor_sections.random_enemy_locations != 0xFFFFFFFF) &&
-        (floor_sections.random_enemy_definitions != 0xFFFFFFFF)) {
-      // Challenge Mode random enemy waves
-      const auto& wave_events_header = r.pget<SectionHeader>(floor_sections.wave_events);
-      const auto& random_enemy_locations_header = r.pget<SectionHeader>(floor_sections.random_enemy_locations);
-      const auto& random_enemy_definitions_header = r.pget<SectionHeader>(floor_sections.random_enemy_definitions);
-      if (!random_state) {
-        random_state = make_shared<DATParserRandomState>(this->rare_seed);
-      }
-      this->add_random_enemies_from_map_data(
-          episode,
-          difficulty,
-          event,
-          floor,
-          r.sub(floor_sections.wave_events + sizeof(SectionHeader), wave_events_header.data_size),
-          r.sub(floor_sections.random_enemy_locations + sizeof(SectionHeader), random_enemy_locations_header.data_size),
-          r.sub(floor_sections.random_enemy_definitions + sizeof(SectionHeader), random_enemy_definitions_header.data_size),
-          random_state,
-          rare_rates);
+  // The random state is shared between floors, just as in the eager case.
+  // This is correct because pending floors are always loaded in order.
+  auto random_state = make_shared<shared_ptr<DATParserRandomState>>();
+  for (size_t floor = 0; floor < all_floor_sections.size(); floor++) {
+    const auto& floor_sections = all_floor_sections[floor];
+    this->add_pending_floor(floor, [this, episode, difficulty, event, floor, floor_sections, data, random_state, rare_rates]() -> void {
+      phosg::StringReader r(data->data(), data->size());
+      add_entities_from_quest_floor_data(
+          *this, episode, difficulty, event, floor, floor_sections, r, *random_state, rare_rates);
+    });
+  }
+}
 
-    } else {
-      // Non-Challenge (standard) enemies
-      if (floor_sections.enemies != 0xFFFFFFFF) {
-        const auto& header = r.pget<SectionHeader>(floor_sections.enemies);
-        if (header.data_size % sizeof(EnemyEntry)) {
-          throw runtime_error("quest layout enemy section size is not a multiple of enemy entry size");
-        }
-        this->add_enemies_from_map_data(
-            episode,
-            difficulty,
-            event,
-            floor,
-            r.pgetv(floor_sections.enemies + sizeof(header), header.data_size),
-            header.data_size,
-            rare_rates);
-      }
+void Map::add_pending_floor(uint8_t floor, function<void()>&& load) {
+  this->pending_floors.emplace_back(PendingFloor{.floor = floor, .load = std::move(load)});
+}
 
-      if (floor_sections.wave_events != 0xFFFFFFFF) {
-        const auto& wave_events_header = r.pget<SectionHeader>(floor_sections.wave_events);
-        const void* data = r.pgetv(floor_sections.wave_events + sizeof(SectionHeader), wave_events_header.data_size);
-        this->add_events_from_map_data(floor, data, wave_events_header.data_size);
-      }
+void Map::materialize_floor(uint8_t floor) {
+  if (this->pending_floors_failed || this->pending_floors.empty() || (this->pending_floors.front().floor > floor)) {
+    return;
+  }
+  try {
+    while (!this->pending_floors.empty() && (this->pending_floors.front().floor <= floor)) {
+      this->materialize_next_pending_floor();
     }
+  } catch (const exception&) {
+    // The failed floor may have added some of its entities already, so any
+    // later floor's entity IDs would not match the client's. Don't load any
+    // more floors after this.
+    this->pending_floors_failed = true;
+    this->build_indexes();
+    throw;
   }
+  this->build_indexes();
+}
+
+void Map::materialize_next_pending_floor() {
+  // The floor is only removed after it's loaded, so has_pending_floors still
+  // returns true if loading fails
+  const auto& pf = this->pending_floors.front();
+  this->log.info("Loading entities for floor %02hhX", pf.floor);
+  pf.load();
+  this->pending_floors.pop_front();
 }
 
 const Map::Enemy& Map::find_enemy(uint16_t enemy_id) const {
@@ -1692,53 +1923,63 @@ Map::Enemy& Map::find_enemy(uint8_t floor, EnemyType type) {
   if (this->enemies.empty()) {
     throw out_of_range("no enemies defined");
   }
-  // TODO: Linear search is bad here. Do something better, like binary search
-  // for the floor start and just linear search through the floor enemies.
-  for (auto& e : this->enemies) {
-    if (e.floor == floor && e.type == type) {
-      return e;
-    }
+  if (!this->floor_and_type_to_enemy.built()) {
+    this->floor_and_type_to_enemy.build(this->enemies);
   }
-  throw out_of_range("enemy not found");
+  // Enemies with the same key are in the order they were added, so this
+  // returns the enemy with the lowest ID, as a linear search would
+  auto res = this->floor_and_type_to_enemy.find(floor_type_key(floor, type));
+  if (res.empty()) {
+    throw out_of_range("enemy not found");
+  }
+  return *res.front();
 }
 
-std::vector<Map::Object*> Map::get_objects(uint8_t floor, uint16_t section, uint16_t group) {
-  uint64_t k = section_index_key(floor, section, group);
-  vector<Object*> ret;
-  for (auto its = this->floor_section_and_group_to_object_index.equal_range(k); its.first != its.second; its.first++) {
-    ret.emplace_back(&this->objects.at(its.first->second));
+void Map::build_indexes() {
+  if (!this->floor_and_event_id_to_event.built()) {
+    this->floor_and_event_id_to_event.build(this->events);
+  }
+  if (!this->floor_section_and_group_to_object.built()) {
+    this->floor_section_and_group_to_object.build(this->objects);
+  }
+  if (!this->floor_section_and_wave_number_to_enemy.built()) {
+    this->floor_section_and_wave_number_to_enemy.build(this->enemies);
+  }
+  if (!this->floor_and_type_to_enemy.built()) {
+    this->floor_and_type_to_enemy.build(this->enemies);
+  }
+  if (!this->floor_section_and_wave_number_to_event.built()) {
+    this->floor_section_and_wave_number_to_event.build(this->events);
   }
-  return ret;
 }
 
-std::vector<Map::Enemy*> Map::get_enemies(uint8_t floor, uint16_t section, uint16_t wave_number) {
-  uint64_t k = section_index_key(floor, section, wave_number);
-  vector<Enemy*> ret;
-  for (auto its = this->floor_section_and_wave_number_to_enemy_index.equal_range(k); its.first != its.second; its.first++) {
-    ret.emplace_back(&this->enemies.at(its.first->second));
+span<Map::Object* const> Map::get_objects(uint8_t floor, uint16_t section, uint16_t group) {
+  if (!this->floor_section_and_group_to_object.built()) {
+    this->floor_section_and_group_to_object.build(this->objects);
   }
-  return ret;
+  return this->floor_section_and_group_to_object.find(section_index_key(floor, section, group));
 }
 
-std::vector<Map::Event*> Map::get_events(uint8_t floor, uint16_t section, uint16_t wave_number) {
-  uint64_t k = section_index_key(floor, section, wave_number);
-  vector<Event*> ret;
-  for (auto its = this->floor_section_and_wave_number_to_event_index.equal_range(k); its.first != its.second; its.first++) {
-    ret.emplace_back(&this->events.at(its.first->second));
+span<Map::Enemy* const> Map::get_enemies(uint8_t floor, uint16_t section, uint16_t wave_number) {
+  if (!this->floor_section_and_wave_number_to_enemy.built()) {
+    this->floor_section_and_wave_number_to_enemy.build(this->enemies);
   }
-  return ret;
+  return this->floor_section_and_wave_number_to_enemy.find(section_index_key(floor, section, wave_number));
 }
 
-std::vector<Map::Event*> Map::get_events(uint8_t floor) {
-  uint64_t k_start = (static_cast<uint64_t>(floor) << 32);
-  uint64_t k_end = (static_cast<uint64_t>(floor + 1) << 32);
-  vector<Event*> ret;
-  for (auto it = this->floor_and_event_id_to_index.lower_bound(k_start);
-       (it != this->floor_and_event_id_to_index.end()) && (it->first < k_end);
-       it++) {
-    ret.emplace_back(&this->events.at(it->second));
+span<Map::Event* const> Map::get_events(uint8_t floor, uint16_t section, uint16_t wave_number) {
+  if (!this->floor_section_and_wave_number_to_event.built()) {
+    this->floor_section_and_wave_number_to_event.build(this->events);
   }
-  return ret;
+  return this->floor_section_and_wave_number_to_event.find(section_index_key(floor, section, wave_number));
+}
+
+span<Map::Event* const> Map::get_events(uint8_t floor) {
+  if (!this->floor_and_event_id_to_event.built()) {
+    this->floor_and_event_id_to_event.build(this->events);
+  }
+  return this->floor_and_event_id_to_event.find_range(
+      static_cast<uint64_t>(floor) << 32, static_cast<uint64_t>(floor + 1) << 32);
 }
 
 template <typename EntryT>
@@ -2476,14 +2717,23 @@ void generate_variations_deprecated(
     Version version,
     Episode episode,
     bool is_solo) {
+  generate_variations_deprecated(variations, [&]() -> uint32_t { return random_crypt->next(); }, version, episode, is_solo);
+}
+
+void generate_variations_deprecated(
+    parray<le_uint32_t, 0x20>& variations,
+    const function<uint32_t()>& next_value,
+    Version version,
+    Episode episode,
+    bool is_solo) {
   for (size_t z = 0; z < 0x10; z++) {
     const auto& a = file_info_for_variation_deprecated(version, episode, z, is_solo);
     if (!a.name_token) {
       variations[z * 2 + 0] = 0;
       variations[z * 2 + 1] = 0;
     } else {
-      variations[z * 2 + 0] = (a.variation1_values.size() <= 1) ? 0 : (random_crypt->next() % a.variation1_values.size());
-      variations[z * 2 + 1] = (a.variation2_values.size() <= 1) ? 0 : (random_crypt->next() % a.variation2_values.size());
+      variations[z * 2 + 0] = (a.variation1_values.size() <= 1) ? 0 : (next_value() % a.variation1_values.size());
+      variations[z * 2 + 1] = (a.variation2_values.size() <= 1) ? 0 : (next_value() % a.variation2_values.size());
     }
   }
 }
@@ -2594,3 +2844,20 @@ vector<vector<string>> map_filenames_for_variations_deprecated(
 
 const shared_ptr<const Map::RareEnemyRates> Map::NO_RARE_ENEMIES = make_shared<Map::RareEnemyRates>(0, 0);
 const shared_ptr<const Map::RareEnemyRates> Map::DEFAULT_RARE_ENEMIES = make_shared<Map::RareEnemyRates>(0x0083126E, 0x1999999A);
+
+shared_ptr<const Map::FloorTemplate> MapFloorTemplateCache::get(
+    const string& key, function<shared_ptr<const Map::FloorTemplate>()> generate) {
+  {
+    shared_lock g(this->lock);
+    auto it = this->key_to_template.find(key);
+    if (it != this->key_to_template.end()) {
+      return it->second;
+    }
+  }
+  unique_lock g(this->lock);
+  auto it = this->key_to_template.find(key);
+  if (it == this->key_to_template.end()) {
+    it = this->key_to_template.emplace(key, generate()).first;
+  }
+  return it->second;
+}
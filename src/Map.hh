@@ -2,11 +2,17 @@
 
 #include <inttypes.h>
 
+#include <algorithm>
+#include <deque>
+#include <functional>
 #include <memory>
 #include <phosg/Encoding.hh>
 #include <phosg/JSON.hh>
 #include <random>
+#include <shared_mutex>
+#include <span>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "BattleParamsIndex.hh"
@@ -300,6 +306,175 @@ struct Map {
     void generate_shuffled_location_table(const Map::RandomEnemyLocationsHeader& header, phosg::StringReader r, uint16_t section);
   };
 
+  // A parsed free-roam map for one floor, which can be added to any number of
+  // Maps with add_floor_from_template. Parsing the map files is much slower
+  // than copying the parsed entities, so templates are cached across games
+  // (see MapFloorTemplateCache). Templates don't depend on the random seed:
+  // enemies that could be rare are stored as their non-rare types, and the
+  // rare rolls are done when the template is added to a Map.
+  struct FloorTemplate {
+    struct RareEnemyCandidate {
+      size_t enemy_index; // Index in enemies (not an enemy ID in any Map)
+      size_t num_enemies; // Includes children that inherit the rare type
+      bool default_is_rare;
+      uint32_t RareEnemyRates::* rate;
+      EnemyType rare_type;
+    };
+    uint8_t floor;
+    std::vector<Object> objects;
+    std::vector<Enemy> enemies;
+    size_t num_enemy_sets = 0;
+    std::vector<RareEnemyCandidate> rare_enemy_candidates; // Ordered by enemy_index
+    std::vector<Event> events;
+    std::string event_action_stream;
+
+    // Any of the data arguments may be null, in which case the template has
+    // no entities of that kind.
+    static std::shared_ptr<const FloorTemplate> from_map_data(
+        Version version,
+        Episode episode,
+        uint8_t difficulty,
+        uint8_t event,
+        uint8_t floor,
+        std::shared_ptr<const std::string> enemies_data,
+        std::shared_ptr<const std::string> objects_data,
+        std::shared_ptr<const std::string> events_data);
+  };
+
+  // The rare enemy rolls that a free-roam Map built from a sequence of floor
+  // templates would make, in the order it would make them. This makes it
+  // possible to find the rare enemies for many seeds without building a Map
+  // for each one (see find-rare-enemy-seeds).
+  struct RareEnemyRollPlan {
+    struct Roll {
+      size_t enemy_index; // Index in the Map's enemies
+      size_t num_enemies; // Includes children that inherit the rare type
+      uint32_t rate; // Only used on BB
+      EnemyType rare_type;
+    };
+    Version version;
+    std::vector<Roll> rolls; // Ordered by enemy_index
+    // Enemies that are rare for every seed (ordered by index)
+    std::vector<std::pair<size_t, EnemyType>> fixed_rare_enemies;
+
+    RareEnemyRollPlan(
+        Version version,
+        const std::vector<std::shared_ptr<const FloorTemplate>>& floors,
+        std::shared_ptr<const RareEnemyRates> rare_rates = DEFAULT_RARE_ENEMIES);
+
+    // Returns the index and type of each rare enemy that the Map would have,
+    // ordered by index. On BB, opt_rand_crypt must be in the state that the
+    // Map's crypt would be in when the first floor is added.
+    std::vector<std::pair<size_t, EnemyType>> rare_enemies_for_seed(
+        uint32_t rare_seed, std::shared_ptr<PSOLFGEncryption> opt_rand_crypt) const;
+    // Like rare_enemies_for_seed, but only for non-BB versions, and takes the
+    // results of the rolls instead of the seed: roll_succeeds[z] must be the
+    // result of client_rare_roll_succeeds for enemy index z, for all z up to
+    // and including the index of the last roll.
+    std::vector<std::pair<size_t, EnemyType>> rare_enemies_for_client_rolls(const uint8_t* roll_succeeds) const;
+  };
+
+  static inline float client_rare_roll_threshold(Version version) {
+    // On v1 and v2 (and GC NTE), the rare rate is 0.1% instead of 0.2%.
+    return is_v1_or_v2(version) ? 0.001f : 0.002f;
+  }
+  // Returns true if the enemy at the given index should be rare on non-BB
+  // versions, which always use the client's rare logic
+  static inline bool client_rare_roll_succeeds(Version version, uint32_t rare_seed, size_t enemy_index) {
+    // This is equivalent to taking the first value from a PSOV2Encryption
+    // constructed with this seed, but doesn't construct the entire stream
+    uint32_t value = PSOV2Encryption::output_for_seed(rare_seed + 0x1000 + enemy_index);
+    float det = (static_cast<float>((value >> 16) & 0xFFFF) / 65536.0f);
+    return (det < Map::client_rare_roll_threshold(version));
+  }
+  // Sets out[z] to client_rare_roll_succeeds(version, rare_seed, z) for each z
+  // in [0, count). The roll for enemy index z with seed S is the same as the
+  // roll for enemy index (z + 1) with seed (S - 1), so for N consecutive
+  // seeds starting at S, this can compute all of their rolls at once by
+  // passing S and (N + the number of enemies); the rolls for seed (S + w)
+  // then start at out[w].
+  static void client_rare_rolls_succeed(uint8_t* out, Version version, uint32_t rare_seed, size_t count);
+
+  // A flat index from 64-bit keys to entities. Entries are recorded with add()
+  // while the map is loading; build() then sorts them into a CSR-style layout
+  // (a sorted array of distinct keys, an array of offsets, and one array of
+  // entity pointers), so lookups during the game are binary searches that
+  // return contiguous spans without allocating. Entities with the same key
+  // are returned in the order they were added. The pointers refer to the
+  // entity vector passed to build(), so the index must be rebuilt if that
+  // vector is resized; Map does this automatically.
+  template <typename T>
+  class FlatIndex {
+  public:
+    void add(uint64_t key, size_t index) {
+      this->entries.emplace_back(key, index);
+      this->is_built = false;
+    }
+
+    void clear() {
+      this->entries.clear();
+      this->keys.clear();
+      this->offsets.clear();
+      this->values.clear();
+      this->is_built = false;
+    }
+
+    inline bool built() const {
+      return this->is_built;
+    }
+
+    void build(std::vector<T>& entities) {
+      std::stable_sort(this->entries.begin(), this->entries.end(), [](const auto& a, const auto& b) -> bool {
+        return a.first < b.first;
+      });
+      this->keys.clear();
+      this->offsets.clear();
+      this->values.clear();
+      this->values.reserve(this->entries.size());
+      for (const auto& [key, index] : this->entries) {
+        if (this->keys.empty() || (this->keys.back() != key)) {
+          this->keys.emplace_back(key);
+          this->offsets.emplace_back(this->values.size());
+        }
+        this->values.emplace_back(&entities.at(index));
+      }
+      this->offsets.emplace_back(this->values.size());
+      this->is_built = true;
+    }
+
+    // Returns all entities with the given key
+    std::span<T* const> find(uint64_t key) const {
+      auto it = std::lower_bound(this->keys.begin(), this->keys.end(), key);
+      if ((it == this->keys.end()) || (*it != key)) {
+        return {};
+      }
+      size_t key_index = it - this->keys.begin();
+      return this->span_for_key_indexes(key_index, key_index + 1);
+    }
+
+    // Returns all entities with keys in the range [start_key, end_key)
+    std::span<T* const> find_range(uint64_t start_key, uint64_t end_key) const {
+      size_t start_index = std::lower_bound(this->keys.begin(), this->keys.end(), start_key) - this->keys.begin();
+      size_t end_index = std::lower_bound(this->keys.begin(), this->keys.end(), end_key) - this->keys.begin();
+      return this->span_for_key_indexes(start_index, end_index);
+    }
+
+  private:
+    std::vector<std::pair<uint64_t, size_t>> entries; // (key, entity index)
+    std::vector<uint64_t> keys; // Sorted, distinct
+    std::vector<uint32_t> offsets; // Size is keys.size() + 1
+    std::vector<T*> values;
+    bool is_built = false;
+
+    std::span<T* const> span_for_key_indexes(size_t start_index, size_t end_index) const {
+      if (start_index >= end_index) {
+        return {};
+      }
+      return std::span<T* const>(
+          this->values.data() + this->offsets[start_index], this->offsets[end_index] - this->offsets[start_index]);
+    }
+  };
+
   Map(Version version, uint32_t lobby_id, uint32_t rare_seed, std::shared_ptr<PSOLFGEncryption> opt_rand_crypt);
   ~Map() = default;
 
@@ -342,10 +517,12 @@ struct Map {
       uint16_t section,
       uint16_t wave_number,
       uint32_t action_stream_offset);
-  std::vector<Event*> get_events(uint8_t floor, uint32_t event_id);
-  std::vector<const Event*> get_events(uint8_t floor, uint32_t event_id) const;
+  std::span<Event* const> get_events(uint8_t floor, uint32_t event_id);
   void add_events_from_map_data(uint8_t floor, const void* data, size_t size);
 
+  void add_floor_from_template(
+      const FloorTemplate& t, std::shared_ptr<const RareEnemyRates> rare_rates = DEFAULT_RARE_ENEMIES);
+
   struct DATSectionsForFloor {
     uint32_t objects = 0xFFFFFFFF;
     uint32_t enemies = 0xFFFFFFFF;
@@ -362,15 +539,44 @@ struct Map {
       const void* data,
       size_t size,
       std::shared_ptr<const RareEnemyRates> rare_rates = Map::DEFAULT_RARE_ENEMIES);
+  // Like add_entities_from_quest_data, but each floor is added as a pending
+  // floor (see add_pending_floor) instead of being parsed immediately
+  void add_pending_floors_from_quest_data(
+      Episode episode,
+      uint8_t difficulty,
+      uint8_t event,
+      std::shared_ptr<const std::string> data,
+      std::shared_ptr<const RareEnemyRates> rare_rates = Map::DEFAULT_RARE_ENEMIES);
+
+  // In lazy loading mode, floors are added as pending floors, each with a
+  // function that adds that floor's entities to the map. A pending floor is
+  // loaded the first time materialize_floor is called for it or for any later
+  // floor. Floors are always loaded in the order they were added, and all
+  // earlier floors are loaded before any later floor, so entity IDs and
+  // non-BB rare enemies are the same as if the entire map were loaded up
+  // front. (This isn't true for BB, since rare enemies on BB are chosen from
+  // a shared random stream and must be known when the game starts, so lazy
+  // loading must not be used there.) If a floor fails to load,
+  // materialize_floor throws, and no more floors are loaded after that.
+  void add_pending_floor(uint8_t floor, std::function<void()>&& load);
+  void materialize_floor(uint8_t floor);
+  inline bool has_pending_floors() const {
+    return !this->pending_floors.empty();
+  }
 
   const Enemy& find_enemy(uint16_t enemy_id) const;
   Enemy& find_enemy(uint16_t enemy_id);
   const Enemy& find_enemy(uint8_t floor, EnemyType type) const;
   Enemy& find_enemy(uint8_t floor, EnemyType type);
-  std::vector<Object*> get_objects(uint8_t floor, uint16_t section, uint16_t wave_number);
-  std::vector<Enemy*> get_enemies(uint8_t floor, uint16_t section, uint16_t wave_number);
-  std::vector<Event*> get_events(uint8_t floor, uint16_t section, uint16_t wave_number);
-  std::vector<Event*> get_events(uint8_t floor);
+  // These functions return spans that are valid until more entities are
+  // added to the map. If any entities were added since the indexes were last
+  // built, they rebuild the indexes first; build_indexes should be called
+  // when loading is done so this never happens during the game.
+  void build_indexes();
+  std::span<Object* const> get_objects(uint8_t floor, uint16_t section, uint16_t group);
+  std::span<Enemy* const> get_enemies(uint8_t floor, uint16_t section, uint16_t wave_number);
+  std::span<Event* const> get_events(uint8_t floor, uint16_t section, uint16_t wave_number);
+  std::span<Event* const> get_events(uint8_t floor);
 
   static std::string disassemble_objects_data(const void* data, size_t size, size_t* object_number = nullptr);
   static std::string disassemble_enemies_data(const void* data, size_t size, size_t* enemy_number = nullptr);
@@ -387,10 +593,45 @@ struct Map {
   std::vector<size_t> rare_enemy_indexes;
   std::vector<Event> events;
   std::string event_action_stream;
-  std::multimap<uint64_t, size_t> floor_and_event_id_to_index;
-  std::unordered_multimap<uint64_t, size_t> floor_section_and_group_to_object_index;
-  std::unordered_multimap<uint64_t, size_t> floor_section_and_wave_number_to_enemy_index;
-  std::unordered_multimap<uint64_t, size_t> floor_section_and_wave_number_to_event_index;
+  FlatIndex<Event> floor_and_event_id_to_event;
+  FlatIndex<Object> floor_section_and_group_to_object;
+  FlatIndex<Enemy> floor_section_and_wave_number_to_enemy;
+  FlatIndex<Enemy> floor_and_type_to_enemy;
+  FlatIndex<Event> floor_section_and_wave_number_to_event;
+  // If defer_rare_enemies is true, add_enemy doesn't roll for rare enemies;
+  // instead, it adds the non-rare type and records the enemy in
+  // deferred_rare_enemies. This is only used when generating FloorTemplates.
+  bool defer_rare_enemies = false;
+  std::vector<FloorTemplate::RareEnemyCandidate> deferred_rare_enemies;
+
+private:
+  struct PendingFloor {
+    uint8_t floor;
+    std::function<void()> load;
+  };
+  std::deque<PendingFloor> pending_floors; // In load order
+  bool pending_floors_failed = false;
+
+  void materialize_next_pending_floor();
+};
+
+class MapFloorTemplateCache {
+public:
+  MapFloorTemplateCache() = default;
+  MapFloorTemplateCache(const MapFloorTemplateCache&) = delete;
+  MapFloorTemplateCache(MapFloorTemplateCache&&) = delete;
+  MapFloorTemplateCache& operator=(const MapFloorTemplateCache&) = delete;
+  MapFloorTemplateCache& operator=(MapFloorTemplateCache&&) = delete;
+  ~MapFloorTemplateCache() = default;
+
+  // Like ThreadSafeFileCache, generate() is called while the lock is held for
+  // writing, so it will block other threads.
+  std::shared_ptr<const Map::FloorTemplate> get(
+      const std::string& key, std::function<std::shared_ptr<const Map::FloorTemplate>()> generate);
+
+private:
+  std::shared_mutex lock;
+  std::unordered_map<std::string, std::shared_ptr<const Map::FloorTemplate>> key_to_template;
 };
 
 class SetDataTableBase {
@@ -484,6 +725,14 @@ void generate_variations_deprecated(
     Version version,
     Episode episode,
     bool is_solo);
+// Like the above, but gets each random value from next_value instead of from
+// a crypt. At most 0x20 values are used.
+void generate_variations_deprecated(
+    parray<le_uint32_t, 0x20>& variations,
+    const std::function<uint32_t()>& next_value,
+    Version version,
+    Episode episode,
+    bool is_solo);
 
 parray<le_uint32_t, 0x20> variation_maxes_deprecated(Version version, Episode episode, bool is_solo);
 bool next_variation_deprecated(parray<le_uint32_t, 0x20>& variations, Version version, Episode episode, bool is_solo);
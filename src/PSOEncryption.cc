@@ -143,6 +143,74 @@ PSOEncryption::Type PSOV2Encryption::type() const {
   return Type::V2;
 }
 
+PSOV2Encryption::FastOutputCoefficients::FastOutputCoefficients() {
+  // This mirrors the constructor and update_stream, but tracks each stream
+  // value as a pair of (constant term, coefficient of seed) instead of as a
+  // single value. Since the only operation is subtraction, the pairs can be
+  // subtracted componentwise.
+  uint32_t stream_base[STREAM_LENGTH + 1] = {};
+  uint32_t stream_mult[STREAM_LENGTH + 1] = {};
+  uint32_t a_base = 1, a_mult = 0, b_base = 0, b_mult = 1;
+  stream_base[0x37] = b_base;
+  stream_mult[0x37] = b_mult;
+  for (uint16_t virtual_index = 0x15; virtual_index <= 0x36 * 0x15; virtual_index += 0x15) {
+    stream_base[virtual_index % 0x37] = a_base;
+    stream_mult[virtual_index % 0x37] = a_mult;
+    uint32_t c_base = b_base - a_base;
+    uint32_t c_mult = b_mult - a_mult;
+    b_base = a_base;
+    b_mult = a_mult;
+    a_base = c_base;
+    a_mult = c_mult;
+  }
+  for (size_t x = 0; x < 5; x++) {
+    for (size_t z = 1; z < 0x19; z++) {
+      stream_base[z] -= stream_base[z + 0x1F];
+      stream_mult[z] -= stream_mult[z + 0x1F];
+    }
+    for (size_t z = 0x19; z < 0x38; z++) {
+      stream_base[z] -= stream_base[z - 0x18];
+      stream_mult[z] -= stream_mult[z - 0x18];
+    }
+  }
+  // After the constructor, offset is 1, so the first value returned by next()
+  // is stream[1]
+  for (size_t z = 0; z < NUM_FAST_OUTPUTS; z++) {
+    this->base[z] = stream_base[z + 1];
+    this->multiplier[z] = stream_mult[z + 1];
+  }
+}
+
+const PSOV2Encryption::FastOutputCoefficients& PSOV2Encryption::fast_output_coefficients() {
+  static const FastOutputCoefficients coeffs;
+  return coeffs;
+}
+
+void PSOV2Encryption::outputs_for_seed(uint32_t* out, uint32_t seed, size_t count) {
+  if (count > NUM_FAST_OUTPUTS) {
+    throw invalid_argument("too many outputs requested");
+  }
+  const auto& coeffs = PSOV2Encryption::fast_output_coefficients();
+  for (size_t z = 0; z < count; z++) {
+    out[z] = coeffs.base[z] + coeffs.multiplier[z] * seed;
+  }
+}
+
+void PSOV2Encryption::outputs_for_seeds(uint32_t* out, uint32_t first_seed, size_t count, size_t index) {
+  if (index >= NUM_FAST_OUTPUTS) {
+    throw invalid_argument("output index out of range");
+  }
+  const auto& coeffs = PSOV2Encryption::fast_output_coefficients();
+  uint32_t base = coeffs.base[index];
+  uint32_t multiplier = coeffs.multiplier[index];
+  // Consecutive seeds produce outputs that differ by exactly multiplier, but
+  // computing each output independently keeps the loop free of carried
+  // dependencies so it can be vectorized
+  for (size_t z = 0; z < count; z++) {
+    out[z] = base + multiplier * static_cast<uint32_t>(first_seed + z);
+  }
+}
+
 PSOV3Encryption::PSOV3Encryption(uint32_t seed)
     : PSOLFGEncryption(seed, STREAM_LENGTH, STREAM_LENGTH) {
   uint32_t x, y, basekey, source1, source2, source3;
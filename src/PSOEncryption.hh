@@ -80,10 +80,36 @@ public:
   explicit PSOV2Encryption(uint32_t seed);
   virtual Type type() const;
 
+  // The initial state and every stream update are linear in the seed, so each
+  // of the first NUM_FAST_OUTPUTS values returned by next() is of the form
+  // (base + multiplier * seed) for constants that don't depend on the seed.
+  // These functions use that to compute those values without constructing
+  // the entire stream, which is much faster when only a few values are
+  // needed from each of many seeds (e.g. for non-BB rare enemy checks and
+  // seed searches). output_for_seed(seed, z) returns the same value as the
+  // (z + 1)th call to PSOV2Encryption(seed).next(). outputs_for_seed fills
+  // out with the first count values for a single seed, and outputs_for_seeds
+  // fills out with the zth value for count consecutive seeds starting at
+  // first_seed; the latter is written so the compiler can vectorize it.
+  static constexpr size_t NUM_FAST_OUTPUTS = 0x37;
+  static inline uint32_t output_for_seed(uint32_t seed, size_t index = 0) {
+    const auto& coeffs = PSOV2Encryption::fast_output_coefficients();
+    return coeffs.base[index] + coeffs.multiplier[index] * seed;
+  }
+  static void outputs_for_seed(uint32_t* out, uint32_t seed, size_t count);
+  static void outputs_for_seeds(uint32_t* out, uint32_t first_seed, size_t count, size_t index = 0);
+
 protected:
   virtual void update_stream();
 
   static constexpr size_t STREAM_LENGTH = 0x38;
+
+  struct FastOutputCoefficients {
+    uint32_t base[NUM_FAST_OUTPUTS];
+    uint32_t multiplier[NUM_FAST_OUTPUTS];
+    FastOutputCoefficients();
+  };
+  static const FastOutputCoefficients& fast_output_coefficients();
 };
 
 class PSOV3Encryption : public PSOLFGEncryption {
@@ -848,8 +848,13 @@ static HandlerResult C_B3(shared_ptr<ProxyServer::LinkedSession> ses, uint16_t,
 static HandlerResult S_B_E7(shared_ptr<ProxyServer::LinkedSession> ses, uint16_t, uint32_t, string& data) {
   if (ses->config.check_flag(Client::Flag::PROXY_SAVE_FILES)) {
     string output_filename = phosg::string_printf("player.%" PRId64 ".bin", phosg::now());
-    phosg::save_file(output_filename, data);
-    ses->log.info("Wrote player data to file %s", output_filename.c_str());
+    ses->run_capture_job(
+        [output_filename, data]() -> void {
+          phosg::save_file(output_filename, data);
+        },
+        [output_filename](shared_ptr<ProxyServer::LinkedSession> ses) -> void {
+          ses->log.info("Wrote player data to file %s", output_filename.c_str());
+        });
   }
   return HandlerResult::Type::FORWARD;
 }
@@ -1076,15 +1081,22 @@ static HandlerResult S_6x(shared_ptr<ProxyServer::LinkedSession> ses, uint16_t,
           const auto& cmd = check_size_t<G_MapData_Ep3_6xB6x41>(data, 0xFFFF);
           string filename = phosg::string_printf("map%08" PRIX32 ".%" PRIu64 ".mnmd",
               cmd.map_number.load(), phosg::now());
-          string map_data = prs_decompress(
-              data.data() + sizeof(cmd), data.size() - sizeof(cmd));
-          phosg::save_file(filename, map_data);
-          if (map_data.size() != sizeof(Episode3::MapDefinition) && map_data.size() != sizeof(Episode3::MapDefinitionTrial)) {
-            ses->log.warning("Wrote %zu bytes to %s (expected %zu or %zu bytes; the file may be invalid)",
-                map_data.size(), filename.c_str(), sizeof(Episode3::MapDefinitionTrial), sizeof(Episode3::MapDefinition));
-          } else {
-            ses->log.info("Wrote %zu bytes to %s", map_data.size(), filename.c_str());
-          }
+          auto map_data_size = make_shared<size_t>(0);
+          ses->run_capture_job(
+              [filename, map_data_size, compressed_data = data.substr(sizeof(cmd))]() -> void {
+                string map_data = prs_decompress(compressed_data);
+                phosg::save_file(filename, map_data);
+                *map_data_size = map_data.size();
+              },
+              [filename, map_data_size](shared_ptr<ProxyServer::LinkedSession> ses) -> void {
+                size_t size = *map_data_size;
+                if (size != sizeof(Episode3::MapDefinition) && size != sizeof(Episode3::MapDefinitionTrial)) {
+                  ses->log.warning("Wrote %zu bytes to %s (expected %zu or %zu bytes; the file may be invalid)",
+                      size, filename.c_str(), sizeof(Episode3::MapDefinitionTrial), sizeof(Episode3::MapDefinition));
+                } else {
+                  ses->log.info("Wrote %zu bytes to %s", size, filename.c_str());
+                }
+              });
         }
       }
     }
@@ -1379,29 +1391,11 @@ static HandlerResult S_13_A7(shared_ptr<ProxyServer::LinkedSession> ses, uint16_
   }
 
   if (is_last_block) {
-    if (ses->config.check_flag(Client::Flag::PROXY_SAVE_FILES)) {
-      ses->log.info("Writing file %s => %s", sf->basename.c_str(), sf->output_filename.c_str());
-
-      if (sf->is_download && (phosg::ends_with(sf->basename, ".bin") || phosg::ends_with(sf->basename, ".dat") || phosg::ends_with(sf->basename, ".pvr"))) {
-        sf->data = decode_dlq_data(sf->data);
-      }
-      phosg::save_file(sf->output_filename, sf->data);
-      if (phosg::ends_with(sf->basename, ".bin")) {
-        try {
-          string decompressed = prs_decompress(sf->data);
-          auto disassembly = disassemble_quest_script(decompressed.data(), decompressed.size(), ses->version(), ses->language(), false);
-          phosg::save_file(sf->output_filename + ".txt", disassembly);
-        } catch (const exception& e) {
-          ses->log.warning("Failed to disassemble quest file: %s", e.what());
-        }
-      }
-    } else {
-      ses->log.info("Download complete for file %s", sf->basename.c_str());
-    }
-
+    // The quest's map is loaded immediately, since drop requests in the quest
+    // must be checked against it (see reconcile_drop_request_with_map)
     if (!sf->is_download && phosg::ends_with(sf->basename, ".dat")) {
-      auto quest_dat_data = make_shared<std::string>(prs_decompress(sf->data));
       try {
+        auto quest_dat_data = make_shared<std::string>(prs_decompress(sf->data));
         ses->map = Lobby::load_maps(
             ses->version(),
             ses->lobby_episode,
@@ -1417,6 +1411,38 @@ static HandlerResult S_13_A7(shared_ptr<ProxyServer::LinkedSession> ses, uint16_
       }
     }
 
+    if (ses->config.check_flag(Client::Flag::PROXY_SAVE_FILES)) {
+      ses->log.info("Writing file %s => %s", sf->basename.c_str(), sf->output_filename.c_str());
+      // Decoding, saving, and disassembling the file can take a while for
+      // large quests, so it's done in a capture job. The job takes ownership
+      // of the file's data and copies of the session's parameters, so it
+      // doesn't refer to the session.
+      auto disassembly_error = make_shared<string>();
+      ses->run_capture_job(
+          [disassembly_error, sf = std::move(*sf), version = ses->version(), language = ses->language()]() mutable -> void {
+            if (sf.is_download && (phosg::ends_with(sf.basename, ".bin") || phosg::ends_with(sf.basename, ".dat") || phosg::ends_with(sf.basename, ".pvr"))) {
+              sf.data = decode_dlq_data(sf.data);
+            }
+            phosg::save_file(sf.output_filename, sf.data);
+            if (phosg::ends_with(sf.basename, ".bin")) {
+              try {
+                string decompressed = prs_decompress(sf.data);
+                auto disassembly = disassemble_quest_script(decompressed.data(), decompressed.size(), version, language, false);
+                phosg::save_file(sf.output_filename + ".txt", disassembly);
+              } catch (const exception& e) {
+                *disassembly_error = e.what();
+              }
+            }
+          },
+          [disassembly_error](shared_ptr<ProxyServer::LinkedSession> ses) -> void {
+            if (!disassembly_error->empty()) {
+              ses->log.warning("Failed to disassemble quest file: %s", disassembly_error->c_str());
+            }
+          });
+    } else {
+      ses->log.info("Download complete for file %s", sf->basename.c_str());
+    }
+
     ses->saving_files.erase(cmd.filename.decode());
   }
 
@@ -1454,8 +1480,13 @@ static HandlerResult S_G_B8(shared_ptr<ProxyServer::LinkedSession> ses, uint16_t
     }
 
     string output_filename = phosg::string_printf("card-definitions.%" PRIu64 ".mnr", phosg::now());
-    phosg::save_file(output_filename, r.read(size));
-    ses->log.info("Wrote %zu bytes to %s", size, output_filename.c_str());
+    ses->run_capture_job(
+        [output_filename, file_data = r.read(size)]() -> void {
+          phosg::save_file(output_filename, file_data);
+        },
+        [output_filename, size](shared_ptr<ProxyServer::LinkedSession> ses) -> void {
+          ses->log.info("Wrote %zu bytes to %s", size, output_filename.c_str());
+        });
   }
 
   // Unset the flag specifying that the client has newserv's card definitions,
@@ -1474,9 +1505,6 @@ static HandlerResult S_G_B9(shared_ptr<ProxyServer::LinkedSession> ses, uint16_t
         throw runtime_error("Media data size extends beyond end of command; not saving file");
       }
 
-      string decompressed_data = prs_decompress(
-          data.data() + sizeof(header), data.size() - sizeof(header));
-
       string output_filename = phosg::string_printf("media-update.%" PRIu64, phosg::now());
       if (header.type == 1) {
         output_filename += ".gvm";
@@ -1485,9 +1513,16 @@ static HandlerResult S_G_B9(shared_ptr<ProxyServer::LinkedSession> ses, uint16_t
       } else {
         output_filename += ".bin";
       }
-      phosg::save_file(output_filename, decompressed_data);
-      ses->log.info("Wrote %zu bytes to %s",
-          decompressed_data.size(), output_filename.c_str());
+      auto decompressed_size = make_shared<size_t>(0);
+      ses->run_capture_job(
+          [output_filename, decompressed_size, compressed_data = data.substr(sizeof(header))]() -> void {
+            string decompressed_data = prs_decompress(compressed_data);
+            phosg::save_file(output_filename, decompressed_data);
+            *decompressed_size = decompressed_data.size();
+          },
+          [output_filename, decompressed_size](shared_ptr<ProxyServer::LinkedSession> ses) -> void {
+            ses->log.info("Wrote %zu bytes to %s", *decompressed_size, output_filename.c_str());
+          });
     } catch (const exception& e) {
       ses->log.warning("Failed to save file: %s", e.what());
     }
@@ -601,6 +601,52 @@ std::shared_ptr<ServerState> ProxyServer::LinkedSession::require_server_state()
   return this->require_server()->state;
 }
 
+void ProxyServer::LinkedSession::run_capture_job(
+    function<void()>&& job, function<void(shared_ptr<LinkedSession>)>&& on_complete) {
+  auto server = this->require_server();
+  auto s = server->state;
+  bool run_synchronously = !s->proxy_capture_pool;
+  if (!run_synchronously && (server->num_pending_capture_jobs >= server->MAX_PENDING_CAPTURE_JOBS)) {
+    this->log.warning("Too many captures are in progress; saving synchronously");
+    run_synchronously = true;
+  }
+
+  if (run_synchronously) {
+    try {
+      job();
+    } catch (const exception& e) {
+      this->log.warning("Failed to save captured data: %s", e.what());
+      return;
+    }
+    if (on_complete) {
+      on_complete(this->shared_from_this());
+    }
+    return;
+  }
+
+  // Everything that refers to the server is moved into the event thread
+  // callback so it's never destroyed on the worker thread
+  server->num_pending_capture_jobs++;
+  auto base = server->base;
+  s->proxy_capture_pool->enqueue([base, server = std::move(server), wses = this->weak_from_this(), job = std::move(job), on_complete = std::move(on_complete)]() mutable -> void {
+    string error;
+    try {
+      job();
+    } catch (const exception& e) {
+      error = e.what();
+    }
+    forward_to_event_thread(base, [server = std::move(server), wses = std::move(wses), error = std::move(error), on_complete = std::move(on_complete)]() -> void {
+      server->num_pending_capture_jobs--;
+      auto ses = wses.lock();
+      if (!error.empty()) {
+        (ses ? ses->log : proxy_server_log).warning("Failed to save captured data: %s", error.c_str());
+      } else if (ses && on_complete) {
+        on_complete(ses);
+      }
+    });
+  });
+}
+
 void ProxyServer::LinkedSession::set_version(Version v) {
   this->client_channel.version = v;
   this->server_channel.version = v;
@@ -154,6 +154,15 @@ public:
     std::shared_ptr<ProxyServer> require_server() const;
     std::shared_ptr<ServerState> require_server_state() const;
 
+    // Runs job on the proxy capture pool, so saving captured files doesn't
+    // delay forwarding commands for any session. If there is no pool or too
+    // many jobs are already pending, job is run immediately instead. job must
+    // not refer to the session; on_complete (if given) is called on the event
+    // thread after job returns, if the session still exists.
+    void run_capture_job(
+        std::function<void()>&& job,
+        std::function<void(std::shared_ptr<LinkedSession>)>&& on_complete = nullptr);
+
     inline Version version() const {
       return this->client_channel.version;
     }
@@ -296,6 +305,7 @@ private:
   std::unordered_map<uint64_t, std::shared_ptr<LinkedSession>> id_to_linked_session;
   uint64_t next_unlinked_session_id;
   uint64_t next_logged_out_session_id;
+  size_t num_pending_capture_jobs = 0;
 
   static void dispatch_destroy_sessions(evutil_socket_t, short, void* ctx);
   void destroy_sessions();
@@ -309,4 +319,5 @@ private:
 
   static constexpr uint64_t MIN_UNLINKED_SESSION_ID = 0xC000000000000000;
   static constexpr uint64_t MIN_LINKED_LOGGED_OUT_SESSION_ID = 0x1000000000000000;
+  static constexpr size_t MAX_PENDING_CAPTURE_JOBS = 32;
 };
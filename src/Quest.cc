@@ -9,6 +9,7 @@
 #include <phosg/Strings.hh>
 #include <phosg/Tools.hh>
 #include <string>
+#include <thread>
 #include <unordered_map>
 
 #include "CommandFormats.hh"
@@ -227,7 +228,12 @@ VersionedQuest::VersionedQuest(
       enabled_expression(enabled_expression) {
 
   if (this->dat_contents) {
-    this->dat_contents_decompressed = make_shared<string>(prs_decompress(*this->dat_contents));
+    // Most quests are never played, so don't keep the decompressed .dat file
+    // in memory until it's needed; just make sure it can be decompressed, so
+    // quests with corrupt .dat files are excluded from the index
+    prs_decompress_size(*this->dat_contents);
+    this->lazy_decompressed_dat = make_shared<LazyDecompressedDat>();
+    this->lazy_decompressed_dat->compressed = this->dat_contents;
   }
 
   auto bin_decompressed = prs_decompress(*this->bin_contents);
@@ -483,19 +489,35 @@ shared_ptr<const VersionedQuest> Quest::version(Version v, uint8_t language) con
 QuestIndex::QuestIndex(
     const string& directory,
     std::shared_ptr<const QuestCategoryIndex> category_index,
-    bool is_ep3)
+    bool is_ep3,
+    size_t num_threads)
     : directory(directory),
       category_index(category_index) {
+  if (num_threads == 0) {
+    num_threads = thread::hardware_concurrency();
+  }
 
-  struct FileData {
-    std::string filename;
-    shared_ptr<const string> data;
+  // Loading and decoding files (and compressing uncompressed .bind/.datd
+  // files) is the slowest part of indexing, and each file is independent of
+  // the others, so this is done in parallel. The results are then added to the
+  // index sequentially in directory order, so errors and conflicts are
+  // reported the same way regardless of how many threads are used.
+  enum class FileType {
+    BIN = 0,
+    DAT,
+    PVR,
+    JSON,
   };
-  map<string, FileData> bin_files;
-  map<string, FileData> dat_files;
-  map<string, FileData> pvr_files;
-  map<string, FileData> json_files;
-  map<string, uint32_t> categories;
+  struct SourceFile {
+    uint32_t category_id;
+    string path;
+    string orig_filename;
+    string filename; // With decoding extensions (.gci, .txt, etc.) removed
+    string basename;
+    vector<pair<FileType, string>> contents;
+    string error;
+  };
+  vector<SourceFile> source_files;
   for (const auto& cat : this->category_index->categories) {
     // Don't index Ep3 download categories for non-Ep3 quest indexing, and vice
     // versa
@@ -503,22 +525,6 @@ QuestIndex::QuestIndex(
       continue;
     }
 
-    auto add_file = [&](map<string, FileData>& files, const string& basename, const string& filename, string&& value, bool check_chunk_size) {
-      if (categories.emplace(basename, cat->category_id).first->second != cat->category_id) {
-        throw runtime_error("file " + basename + " exists in multiple categories");
-      }
-      auto data_ptr = make_shared<string>(std::move(value));
-      if (!files.emplace(basename, FileData{filename, data_ptr}).second) {
-        throw runtime_error("file " + basename + " already exists");
-      }
-      // There is a bug in the client that prevents quests from loading properly
-      // if any file's size is a multiple of 0x400. See the comments on the 13
-      // command in CommandFormats.hh for more details.
-      if (check_chunk_size && !(data_ptr->size() & 0x3FF)) {
-        data_ptr->push_back(0x00);
-      }
-    };
-
     string cat_path = directory + "/" + cat->directory_name;
     if (!phosg::isdir(cat_path)) {
       static_game_data_log.warning("Quest category directory %s is missing; skipping it", cat_path.c_str());
@@ -528,80 +534,158 @@ QuestIndex::QuestIndex(
       if (filename == ".DS_Store") {
         continue;
       }
+      auto& sf = source_files.emplace_back();
+      sf.category_id = cat->category_id;
+      sf.path = cat_path + "/" + filename;
+      sf.orig_filename = filename;
+      sf.filename = std::move(filename);
+    }
+  }
 
-      string file_path = cat_path + "/" + filename;
-      try {
-        string orig_filename = filename;
-        string file_data;
-        if (phosg::ends_with(filename, ".gci")) {
-          file_data = decode_gci_data(phosg::load_file(file_path));
-          filename.resize(filename.size() - 4);
-        } else if (phosg::ends_with(filename, ".vms")) {
-          file_data = decode_vms_data(phosg::load_file(file_path));
-          filename.resize(filename.size() - 4);
-        } else if (phosg::ends_with(filename, ".dlq")) {
-          file_data = decode_dlq_data(phosg::load_file(file_path));
-          filename.resize(filename.size() - 4);
-        } else if (phosg::ends_with(filename, ".txt")) {
-          string include_dir = phosg::dirname(file_path);
-          file_data = assemble_quest_script(phosg::load_file(file_path), include_dir);
-          filename.resize(filename.size() - 4);
-          if (phosg::ends_with(filename, ".bin")) {
-            filename.push_back('d');
-          }
-        } else {
-          file_data = phosg::load_file(file_path);
+  phosg::parallel_range<size_t>([&](size_t index, size_t) -> bool {
+    auto& sf = source_files[index];
+    try {
+      string file_data;
+      if (phosg::ends_with(sf.filename, ".gci")) {
+        file_data = decode_gci_data(phosg::load_file(sf.path));
+        sf.filename.resize(sf.filename.size() - 4);
+      } else if (phosg::ends_with(sf.filename, ".vms")) {
+        file_data = decode_vms_data(phosg::load_file(sf.path));
+        sf.filename.resize(sf.filename.size() - 4);
+      } else if (phosg::ends_with(sf.filename, ".dlq")) {
+        file_data = decode_dlq_data(phosg::load_file(sf.path));
+        sf.filename.resize(sf.filename.size() - 4);
+      } else if (phosg::ends_with(sf.filename, ".txt")) {
+        string include_dir = phosg::dirname(sf.path);
+        file_data = assemble_quest_script(phosg::load_file(sf.path), include_dir);
+        sf.filename.resize(sf.filename.size() - 4);
+        if (phosg::ends_with(sf.filename, ".bin")) {
+          sf.filename.push_back('d');
         }
+      } else {
+        file_data = phosg::load_file(sf.path);
+      }
 
-        size_t dot_pos = filename.rfind('.');
-        string file_basename;
-        string extension;
-        if (dot_pos != string::npos) {
-          file_basename = phosg::tolower(filename.substr(0, dot_pos));
-          extension = phosg::tolower(filename.substr(dot_pos + 1));
-        } else {
-          file_basename = phosg::tolower(filename);
-        }
+      size_t dot_pos = sf.filename.rfind('.');
+      string extension;
+      if (dot_pos != string::npos) {
+        sf.basename = phosg::tolower(sf.filename.substr(0, dot_pos));
+        extension = phosg::tolower(sf.filename.substr(dot_pos + 1));
+      } else {
+        sf.basename = phosg::tolower(sf.filename);
+      }
 
-        if (extension == "json") {
-          add_file(json_files, file_basename, orig_filename, std::move(file_data), false);
-        } else if (extension == "bin" || extension == "mnm") {
-          add_file(bin_files, file_basename, orig_filename, std::move(file_data), true);
-        } else if (extension == "bind" || extension == "mnmd") {
-          add_file(bin_files, file_basename, orig_filename, prs_compress_optimal(file_data), true);
-        } else if (extension == "dat") {
-          add_file(dat_files, file_basename, orig_filename, std::move(file_data), true);
-        } else if (extension == "datd") {
-          add_file(dat_files, file_basename, orig_filename, prs_compress_optimal(file_data), true);
-        } else if (extension == "pvr") {
-          add_file(pvr_files, file_basename, orig_filename, std::move(file_data), true);
-        } else if (extension == "qst") {
-          auto files = decode_qst_data(file_data);
-          for (auto& it : files) {
-            if (phosg::ends_with(it.first, ".bin")) {
-              add_file(bin_files, file_basename, orig_filename, std::move(it.second), true);
-            } else if (phosg::ends_with(it.first, ".dat")) {
-              add_file(dat_files, file_basename, orig_filename, std::move(it.second), true);
-            } else if (phosg::ends_with(it.first, ".pvr")) {
-              add_file(pvr_files, file_basename, orig_filename, std::move(it.second), true);
-            } else {
-              throw runtime_error("qst file contains unsupported file type: " + it.first);
-            }
+      if (extension == "json") {
+        sf.contents.emplace_back(FileType::JSON, std::move(file_data));
+      } else if (extension == "bin" || extension == "mnm") {
+        sf.contents.emplace_back(FileType::BIN, std::move(file_data));
+      } else if (extension == "bind" || extension == "mnmd") {
+        sf.contents.emplace_back(FileType::BIN, prs_compress_optimal(file_data));
+      } else if (extension == "dat") {
+        sf.contents.emplace_back(FileType::DAT, std::move(file_data));
+      } else if (extension == "datd") {
+        sf.contents.emplace_back(FileType::DAT, prs_compress_optimal(file_data));
+      } else if (extension == "pvr") {
+        sf.contents.emplace_back(FileType::PVR, std::move(file_data));
+      } else if (extension == "qst") {
+        auto files = decode_qst_data(file_data);
+        for (auto& it : files) {
+          if (phosg::ends_with(it.first, ".bin")) {
+            sf.contents.emplace_back(FileType::BIN, std::move(it.second));
+          } else if (phosg::ends_with(it.first, ".dat")) {
+            sf.contents.emplace_back(FileType::DAT, std::move(it.second));
+          } else if (phosg::ends_with(it.first, ".pvr")) {
+            sf.contents.emplace_back(FileType::PVR, std::move(it.second));
+          } else {
+            throw runtime_error("qst file contains unsupported file type: " + it.first);
           }
         }
+      }
+    } catch (const exception& e) {
+      sf.contents.clear();
+      sf.error = e.what();
+    }
+    return false;
+  },
+      0, source_files.size(), num_threads);
 
-      } catch (const exception& e) {
-        static_game_data_log.warning("(%s) Failed to load quest file: (%s)", filename.c_str(), e.what());
+  struct FileData {
+    std::string filename;
+    shared_ptr<const string> data;
+  };
+  map<string, FileData> bin_files;
+  map<string, FileData> dat_files;
+  map<string, FileData> pvr_files;
+  map<string, FileData> json_files;
+  map<string, uint32_t> categories;
+  for (auto& sf : source_files) {
+    if (!sf.error.empty()) {
+      static_game_data_log.warning("(%s) Failed to load quest file: (%s)", sf.filename.c_str(), sf.error.c_str());
+      continue;
+    }
+    try {
+      for (auto& [type, data] : sf.contents) {
+        if (categories.emplace(sf.basename, sf.category_id).first->second != sf.category_id) {
+          throw runtime_error("file " + sf.basename + " exists in multiple categories");
+        }
+        auto data_ptr = make_shared<string>(std::move(data));
+        map<string, FileData>* files;
+        switch (type) {
+          case FileType::BIN:
+            files = &bin_files;
+            break;
+          case FileType::DAT:
+            files = &dat_files;
+            break;
+          case FileType::PVR:
+            files = &pvr_files;
+            break;
+          case FileType::JSON:
+            files = &json_files;
+            break;
+          default:
+            throw logic_error("invalid quest file type");
+        }
+        if (!files->emplace(sf.basename, FileData{sf.orig_filename, data_ptr}).second) {
+          throw runtime_error("file " + sf.basename + " already exists");
+        }
+        // There is a bug in the client that prevents quests from loading
+        // properly if any file's size is a multiple of 0x400. See the comments
+        // on the 13 command in CommandFormats.hh for more details.
+        if ((type != FileType::JSON) && !(data_ptr->size() & 0x3FF)) {
+          data_ptr->push_back(0x00);
+        }
       }
+    } catch (const exception& e) {
+      static_game_data_log.warning("(%s) Failed to load quest file: (%s)", sf.filename.c_str(), e.what());
     }
   }
+  source_files.clear();
 
   // All quests have a bin file (even in Episode 3, though its format is
   // different), so we use bin_files as the primary list of all quests that
-  // should be indexed
-  for (auto& bin_it : bin_files) {
-    const string& basename = bin_it.first;
-    const auto* bin_filedata = &bin_it.second;
+  // should be indexed. Parsing each quest's header and metadata is also
+  // independent of the others, so it's done in parallel; the quests are then
+  // added to the index in order.
+  struct IndexedQuest {
+    const string* basename;
+    const FileData* bin_filedata;
+    shared_ptr<VersionedQuest> vq;
+    string filenames_str;
+    string error;
+  };
+  vector<IndexedQuest> indexed_quests;
+  indexed_quests.reserve(bin_files.size());
+  for (const auto& bin_it : bin_files) {
+    auto& iq = indexed_quests.emplace_back();
+    iq.basename = &bin_it.first;
+    iq.bin_filedata = &bin_it.second;
+  }
+
+  phosg::parallel_range<size_t>([&](size_t index, size_t) -> bool {
+    auto& iq = indexed_quests[index];
+    const string& basename = *iq.basename;
+    const auto* bin_filedata = iq.bin_filedata;
 
     try {
       // Quest .bin filenames are like K###-VERS-LANG.EXT, where:
@@ -756,7 +840,6 @@ QuestIndex::QuestIndex(
           force_joinable,
           lock_status_register);
 
-      auto category_name = this->category_index->at(vq->category_id)->name;
       string filenames_str = bin_filedata->filename;
       if (dat_filedata) {
         filenames_str += phosg::string_printf("/%s", dat_filedata->filename.c_str());
@@ -767,6 +850,24 @@ QuestIndex::QuestIndex(
       if (json_filedata) {
         filenames_str += phosg::string_printf("/%s", json_filedata->filename.c_str());
       }
+      iq.vq = std::move(vq);
+      iq.filenames_str = std::move(filenames_str);
+    } catch (const exception& e) {
+      iq.error = e.what();
+    }
+    return false;
+  },
+      0, indexed_quests.size(), num_threads);
+
+  for (auto& iq : indexed_quests) {
+    if (!iq.vq) {
+      static_game_data_log.warning("(%s) Failed to index quest file: (%s)", iq.basename->c_str(), iq.error.c_str());
+      continue;
+    }
+    auto vq = std::move(iq.vq);
+    const auto& filenames_str = iq.filenames_str;
+    try {
+      auto category_name = this->category_index->at(vq->category_id)->name;
       auto q_it = this->quests_by_number.find(vq->quest_number);
       if (q_it != this->quests_by_number.end()) {
         q_it->second->add_version(vq);
@@ -793,7 +894,37 @@ QuestIndex::QuestIndex(
             vq->joinable ? "joinable" : "not joinable");
       }
     } catch (const exception& e) {
-      static_game_data_log.warning("(%s) Failed to index quest file: (%s)", basename.c_str(), e.what());
+      static_game_data_log.warning("(%s) Failed to index quest file: (%s)", iq.basename->c_str(), e.what());
+    }
+  }
+
+  this->build_menu_index();
+}
+
+uint64_t QuestIndex::menu_index_key(uint32_t category_id, Version version, Episode episode) {
+  return (static_cast<uint64_t>(category_id) << 32) |
+      (static_cast<uint64_t>(version) << 8) |
+      static_cast<uint64_t>(episode);
+}
+
+void QuestIndex::build_menu_index() {
+  for (const auto& cat_it : this->quests_by_category_id_and_number) {
+    for (const auto& q_it : cat_it.second) {
+      const auto& q = q_it.second;
+      // versions is sorted by version, then language, so each version's
+      // entries are contiguous
+      Version prev_version = Version::UNKNOWN;
+      for (const auto& vq_it : q->versions) {
+        Version v = static_cast<Version>(vq_it.first >> 8);
+        if (v == prev_version) {
+          continue;
+        }
+        prev_version = v;
+        this->menu_index[this->menu_index_key(cat_it.first, v, Episode::NONE)].emplace_back(q);
+        if (q->episode != Episode::NONE) {
+          this->menu_index[this->menu_index_key(cat_it.first, v, q->episode)].emplace_back(q);
+        }
+      }
     }
   }
 }
@@ -838,26 +969,58 @@ vector<pair<QuestIndex::IncludeState, shared_ptr<const Quest>>> QuestIndex::filt
   Episode effective_episode = cat->enable_episode_filter() ? episode : Episode::NONE;
 
   vector<pair<IncludeState, shared_ptr<const Quest>>> ret;
-  auto category_it = this->quests_by_category_id_and_number.find(category_id);
-  if (category_it == this->quests_by_category_id_and_number.end()) {
+  auto index_it = this->menu_index.find(this->menu_index_key(category_id, version, effective_episode));
+  if (index_it == this->menu_index.end()) {
     return ret;
   }
-  for (auto it : category_it->second) {
-    if (((effective_episode == Episode::NONE) || (it.second->episode == effective_episode)) &&
-        it.second->has_version_any_language(version)) {
-      IncludeState state = include_condition ? include_condition(it.second) : IncludeState::AVAILABLE;
-      if (state == IncludeState::HIDDEN) {
-        continue;
-      }
-      ret.emplace_back(make_pair(state, it.second));
-      if (limit && (ret.size() >= limit)) {
-        break;
-      }
+  for (const auto& q : index_it->second) {
+    IncludeState state = include_condition ? include_condition(q) : IncludeState::AVAILABLE;
+    if (state == IncludeState::HIDDEN) {
+      continue;
+    }
+    ret.emplace_back(make_pair(state, q));
+    if (limit && (ret.size() >= limit)) {
+      break;
     }
   }
   return ret;
 }
 
+shared_ptr<const VersionedQuest> QuestIndex::download_quest(shared_ptr<const VersionedQuest> vq, uint8_t language) const {
+  uint64_t key = (static_cast<uint64_t>(vq->quest_number) << 32) |
+      (static_cast<uint64_t>(vq->version) << 8) |
+      static_cast<uint64_t>(language);
+
+  {
+    lock_guard g(this->download_quests_lock);
+    auto it = this->download_quests.find(key);
+    if (it != this->download_quests.end()) {
+      this->download_quests_lru.splice(this->download_quests_lru.begin(), this->download_quests_lru, it->second.lru_it);
+      return it->second.vq;
+    }
+  }
+
+  // Build the download quest without holding the lock, since this involves
+  // recompressing the .bin file
+  shared_ptr<const VersionedQuest> dlq = vq->create_download_quest(language);
+
+  lock_guard g(this->download_quests_lock);
+  auto emplace_ret = this->download_quests.try_emplace(key);
+  if (!emplace_ret.second) {
+    // Another thread built the same quest in the meantime; use its version
+    this->download_quests_lru.splice(this->download_quests_lru.begin(), this->download_quests_lru, emplace_ret.first->second.lru_it);
+    return emplace_ret.first->second.vq;
+  }
+  this->download_quests_lru.emplace_front(key);
+  emplace_ret.first->second.vq = dlq;
+  emplace_ret.first->second.lru_it = this->download_quests_lru.begin();
+  while (this->download_quests.size() > MAX_CACHED_DOWNLOAD_QUESTS) {
+    this->download_quests.erase(this->download_quests_lru.back());
+    this->download_quests_lru.pop_back();
+  }
+  return dlq;
+}
+
 string encode_download_quest_data(const string& compressed_data, size_t decompressed_size, uint32_t encryption_seed) {
   // Download quest files are like normal (PRS-compressed) quest files, but they
   // are encrypted with PSO V2 encryption (even on V3 / PSO GC), and a small
@@ -889,6 +1052,18 @@ string encode_download_quest_data(const string& compressed_data, size_t decompre
   return data;
 }
 
+shared_ptr<const string> VersionedQuest::decompressed_dat() const {
+  if (!this->lazy_decompressed_dat) {
+    return nullptr;
+  }
+  auto& lazy = *this->lazy_decompressed_dat;
+  lock_guard g(lazy.lock);
+  if (!lazy.decompressed) {
+    lazy.decompressed = make_shared<string>(prs_decompress(*lazy.compressed));
+  }
+  return lazy.decompressed;
+}
+
 shared_ptr<VersionedQuest> VersionedQuest::create_download_quest(uint8_t override_language) const {
   // The download flag needs to be set in the bin header, or else the client
   // will ignore it when scanning for download quests in an offline game. To set
@@ -2,8 +2,10 @@
 
 #include <stdint.h>
 
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -77,7 +79,6 @@ struct VersionedQuest {
   std::string long_description;
   std::shared_ptr<const std::string> bin_contents;
   std::shared_ptr<const std::string> dat_contents;
-  std::shared_ptr<const std::string> dat_contents_decompressed;
   std::shared_ptr<const std::string> pvr_contents;
   std::shared_ptr<const BattleRules> battle_rules;
   ssize_t challenge_template_index;
@@ -107,8 +108,26 @@ struct VersionedQuest {
   std::string pvr_filename() const;
   std::string xb_filename() const;
 
+  // Returns the decompressed .dat file, or null if the quest has none. Most
+  // quests are never played between reloads, so the .dat file is only
+  // decompressed the first time this is called (and then only once, even if
+  // multiple threads call it at the same time). The constructor checks that
+  // the .dat file is valid, so this doesn't throw.
+  std::shared_ptr<const std::string> decompressed_dat() const;
+
   std::shared_ptr<VersionedQuest> create_download_quest(uint8_t override_language = 0xFF) const;
   std::string encode_qst() const;
+
+private:
+  // This is shared between copies of the same VersionedQuest (e.g. the
+  // download version of a quest shares it with the original), so it holds its
+  // own reference to the original compressed data.
+  struct LazyDecompressedDat {
+    std::mutex lock;
+    std::shared_ptr<const std::string> compressed;
+    std::shared_ptr<const std::string> decompressed;
+  };
+  std::shared_ptr<LazyDecompressedDat> lazy_decompressed_dat;
 };
 
 class Quest {
@@ -157,7 +176,14 @@ struct QuestIndex {
   std::map<std::string, std::shared_ptr<Quest>> quests_by_name;
   std::map<uint32_t, std::map<uint32_t, std::shared_ptr<Quest>>> quests_by_category_id_and_number;
 
-  QuestIndex(const std::string& directory, std::shared_ptr<const QuestCategoryIndex> category_index, bool is_ep3);
+  // Files are decoded and quests are indexed on num_threads threads (0 = one
+  // per CPU core), but the results are always the same as if they were
+  // indexed sequentially in filename order.
+  QuestIndex(
+      const std::string& directory,
+      std::shared_ptr<const QuestCategoryIndex> category_index,
+      bool is_ep3,
+      size_t num_threads = 1);
 
   std::shared_ptr<const Quest> get(uint32_t quest_number) const;
   std::shared_ptr<const Quest> get(const std::string& name) const;
@@ -173,6 +199,35 @@ struct QuestIndex {
       uint32_t category_id,
       IncludeCondition include_condition = nullptr,
       size_t limit = 0) const;
+
+  // Returns the download version of vq (see VersionedQuest::create_download_
+  // quest), building it only if it isn't already cached. vq must be the quest
+  // returned by get(...)->version(version, language) for this index. Since a
+  // new QuestIndex is created whenever quests are reloaded, cached entries
+  // never have to be invalidated explicitly.
+  std::shared_ptr<const VersionedQuest> download_quest(std::shared_ptr<const VersionedQuest> vq, uint8_t language) const;
+
+private:
+  // Quests in each category that have at least one language of each version,
+  // in increasing order of quest number. This is built when the index is
+  // created, so filter only has to evaluate include_condition (which depends
+  // on the player) on the quests that could actually appear in the menu.
+  // Lists for Episode::NONE contain all quests in the category regardless of
+  // episode.
+  std::unordered_map<uint64_t, std::vector<std::shared_ptr<const Quest>>> menu_index;
+
+  static uint64_t menu_index_key(uint32_t category_id, Version version, Episode episode);
+  void build_menu_index();
+
+  static constexpr size_t MAX_CACHED_DOWNLOAD_QUESTS = 128;
+
+  struct CachedDownloadQuest {
+    std::shared_ptr<const VersionedQuest> vq;
+    std::list<uint64_t>::iterator lru_it;
+  };
+  mutable std::mutex download_quests_lock;
+  mutable std::unordered_map<uint64_t, CachedDownloadQuest> download_quests;
+  mutable std::list<uint64_t> download_quests_lru; // Most recently used first
 };
 
 std::string encode_download_quest_data(
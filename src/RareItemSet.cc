@@ -250,6 +250,7 @@ RareItemSet::RareItemSet(const AFSArchive& afs, bool is_v1) {
       }
     }
   }
+  this->build_lookup_tables();
 }
 
 string RareItemSet::gsl_entry_name_for_table(GameMode mode, Episode episode, uint8_t difficulty, uint8_t section_id) {
@@ -279,6 +280,7 @@ RareItemSet::RareItemSet(const GSLArchive& gsl, bool is_big_endian) {
       }
     }
   }
+  this->build_lookup_tables();
 }
 
 RareItemSet::RareItemSet(const string& rel_data, bool is_big_endian) {
@@ -299,6 +301,7 @@ RareItemSet::RareItemSet(const string& rel_data, bool is_big_endian) {
       }
     }
   }
+  this->build_lookup_tables();
 }
 
 RareItemSet::RareItemSet(const phosg::JSON& json, shared_ptr<const ItemNameIndex> name_index) {
@@ -377,6 +380,7 @@ RareItemSet::RareItemSet(const phosg::JSON& json, shared_ptr<const ItemNameIndex
       }
     }
   }
+  this->build_lookup_tables();
 }
 
 std::string RareItemSet::serialize_afs(bool is_v1) const {
@@ -422,6 +426,55 @@ std::string RareItemSet::serialize_gsl(bool big_endian) const {
   return GSLArchive::generate(files, big_endian);
 }
 
+shared_ptr<RareItemSet> RareItemSet::from_snapshot(const string& data) {
+  auto read_specs_vec = +[](phosg::StringReader& r, vector<vector<ExpandedDrop>>& vec) -> void {
+    vec.resize(r.get_u32l());
+    for (auto& specs : vec) {
+      specs.resize(r.get_u32l());
+      for (auto& spec : specs) {
+        spec.probability = r.get_u32l();
+        spec.data = r.get<ItemData>();
+      }
+    }
+  };
+
+  auto ret = make_shared<RareItemSet>();
+  phosg::StringReader r(data);
+  size_t num_collections = r.get_u32l();
+  for (size_t z = 0; z < num_collections; z++) {
+    auto& collection = ret->collections[r.get_u16l()];
+    read_specs_vec(r, collection.rt_index_to_specs);
+    read_specs_vec(r, collection.box_area_to_specs);
+  }
+  if (!r.eof()) {
+    throw runtime_error("extra data after end of rare item set snapshot");
+  }
+  ret->build_lookup_tables();
+  return ret;
+}
+
+string RareItemSet::serialize_snapshot() const {
+  auto write_specs_vec = +[](phosg::StringWriter& w, const vector<vector<ExpandedDrop>>& vec) -> void {
+    w.put_u32l(vec.size());
+    for (const auto& specs : vec) {
+      w.put_u32l(specs.size());
+      for (const auto& spec : specs) {
+        w.put_u32l(spec.probability);
+        w.put<ItemData>(spec.data);
+      }
+    }
+  };
+
+  phosg::StringWriter w;
+  w.put_u32l(this->collections.size());
+  for (const auto& it : this->collections) {
+    w.put_u16l(it.first);
+    write_specs_vec(w, it.second.rt_index_to_specs);
+    write_specs_vec(w, it.second.box_area_to_specs);
+  }
+  return std::move(w.str());
+}
+
 phosg::JSON RareItemSet::json(shared_ptr<const ItemNameIndex> name_index) const {
   auto modes_dict = phosg::JSON::dict();
   static const array<GameMode, 4> modes = {GameMode::NORMAL, GameMode::BATTLE, GameMode::CHALLENGE, GameMode::SOLO};
@@ -517,6 +570,7 @@ void RareItemSet::multiply_all_rates(double factor) {
     multiply_rates_vec(coll_it.second.rt_index_to_specs, factor);
     multiply_rates_vec(coll_it.second.box_area_to_specs, factor);
   }
+  this->build_lookup_tables();
 }
 
 void RareItemSet::print_collection(
@@ -583,23 +637,47 @@ void RareItemSet::print_all_collections(FILE* stream, std::shared_ptr<const Item
   }
 }
 
-std::vector<RareItemSet::ExpandedDrop> RareItemSet::get_enemy_specs(
+span<const RareItemSet::ExpandedDrop> RareItemSet::get_enemy_specs(
     GameMode mode, Episode episode, uint8_t difficulty, uint8_t secid, uint8_t rt_index) const {
-  try {
-    return this->get_collection(mode, episode, difficulty, secid).rt_index_to_specs.at(rt_index);
-  } catch (const out_of_range&) {
-    static const std::vector<ExpandedDrop> empty_vector;
-    return empty_vector;
-  }
+  return this->lookup_specs(this->key_for_params(mode, episode, difficulty, secid), false, rt_index);
 }
 
-std::vector<RareItemSet::ExpandedDrop> RareItemSet::get_box_specs(
+span<const RareItemSet::ExpandedDrop> RareItemSet::get_box_specs(
     GameMode mode, Episode episode, uint8_t difficulty, uint8_t secid, uint8_t area) const {
-  try {
-    return this->get_collection(mode, episode, difficulty, secid).box_area_to_specs.at(area);
-  } catch (const out_of_range&) {
-    static const std::vector<ExpandedDrop> empty_vector;
-    return empty_vector;
+  return this->lookup_specs(this->key_for_params(mode, episode, difficulty, secid), true, area);
+}
+
+span<const RareItemSet::ExpandedDrop> RareItemSet::lookup_specs(uint16_t key, bool is_box, uint8_t index) const {
+  if (key >= this->collection_lookups.size()) {
+    return {};
+  }
+  const auto& coll_lookup = this->collection_lookups[key];
+  const auto& ranges = is_box ? coll_lookup.box_area_ranges : coll_lookup.rt_index_ranges;
+  if (index >= ranges.count) {
+    return {};
+  }
+  const auto& range = this->lookup_ranges[ranges.offset + index];
+  return span<const ExpandedDrop>(this->flat_drops.data() + range.offset, range.count);
+}
+
+void RareItemSet::build_lookup_tables() {
+  this->collection_lookups.clear();
+  this->lookup_ranges.clear();
+  this->flat_drops.clear();
+  this->collection_lookups.resize(NUM_COLLECTION_KEYS);
+
+  auto add_specs_vec = [&](const vector<vector<ExpandedDrop>>& vec) -> LookupRange {
+    LookupRange ret{static_cast<uint32_t>(this->lookup_ranges.size()), static_cast<uint32_t>(vec.size())};
+    for (const auto& specs : vec) {
+      this->lookup_ranges.emplace_back(LookupRange{static_cast<uint32_t>(this->flat_drops.size()), static_cast<uint32_t>(specs.size())});
+      this->flat_drops.insert(this->flat_drops.end(), specs.begin(), specs.end());
+    }
+    return ret;
+  };
+  for (const auto& [key, collection] : this->collections) {
+    auto& coll_lookup = this->collection_lookups.at(key);
+    coll_lookup.rt_index_ranges = add_specs_vec(collection.rt_index_to_specs);
+    coll_lookup.box_area_ranges = add_specs_vec(collection.box_area_to_specs);
   }
 }
 
@@ -6,7 +6,9 @@
 #include <memory>
 #include <phosg/JSON.hh>
 #include <random>
+#include <span>
 #include <string>
+#include <vector>
 
 #include "AFSArchive.hh"
 #include "GSLArchive.hh"
@@ -25,18 +27,26 @@ public:
     std::string str(std::shared_ptr<const ItemNameIndex> name_index) const;
   };
 
-  RareItemSet();
+  RareItemSet() = default;
   RareItemSet(const AFSArchive& afs, bool is_v1);
   RareItemSet(const GSLArchive& gsl, bool is_big_endian);
   RareItemSet(const std::string& rel, bool is_big_endian);
   RareItemSet(const phosg::JSON& json, std::shared_ptr<const ItemNameIndex> name_index = nullptr);
   ~RareItemSet() = default;
 
-  std::vector<ExpandedDrop> get_enemy_specs(GameMode mode, Episode episode, uint8_t difficulty, uint8_t secid, uint8_t rt_index) const;
-  std::vector<ExpandedDrop> get_box_specs(GameMode mode, Episode episode, uint8_t difficulty, uint8_t secid, uint8_t area) const;
+  // Parses data generated by serialize_snapshot. This format is only used in
+  // data snapshots (see DataSnapshot.hh); it is not stable across versions of
+  // newserv, so it should not be used for anything else.
+  static std::shared_ptr<RareItemSet> from_snapshot(const std::string& data);
+
+  // These are called for every enemy kill and box break, so they don't
+  // allocate; the returned spans remain valid until the set is modified
+  std::span<const ExpandedDrop> get_enemy_specs(GameMode mode, Episode episode, uint8_t difficulty, uint8_t secid, uint8_t rt_index) const;
+  std::span<const ExpandedDrop> get_box_specs(GameMode mode, Episode episode, uint8_t difficulty, uint8_t secid, uint8_t area) const;
 
   std::string serialize_afs(bool is_v1) const;
   std::string serialize_gsl(bool big_endian) const;
+  std::string serialize_snapshot() const;
   phosg::JSON json(std::shared_ptr<const ItemNameIndex> name_index = nullptr) const;
 
   void multiply_all_rates(double factor);
@@ -102,6 +112,27 @@ protected:
 
   std::unordered_map<uint16_t, SpecCollection> collections;
 
+  // Flattened copy of collections used by get_enemy_specs and get_box_specs.
+  // collection_lookups is indexed by key_for_params and refers to ranges of
+  // lookup_ranges (one per rt_index or area), which in turn refer to ranges
+  // of flat_drops. This must be rebuilt (by build_lookup_tables) whenever
+  // collections is modified.
+  struct LookupRange {
+    uint32_t offset = 0;
+    uint32_t count = 0;
+  };
+  struct CollectionLookup {
+    LookupRange rt_index_ranges;
+    LookupRange box_area_ranges;
+  };
+  static constexpr size_t NUM_COLLECTION_KEYS = 0x300;
+  std::vector<CollectionLookup> collection_lookups;
+  std::vector<LookupRange> lookup_ranges;
+  std::vector<ExpandedDrop> flat_drops;
+
+  void build_lookup_tables();
+  std::span<const ExpandedDrop> lookup_specs(uint16_t key, bool is_box, uint8_t index) const;
+
   const SpecCollection& get_collection(GameMode mode, Episode episode, uint8_t difficulty, uint8_t secid) const;
 
   static std::string gsl_entry_name_for_table(GameMode mode, Episode episode, uint8_t difficulty, uint8_t section_id);
@@ -2631,7 +2631,7 @@ static void on_10(shared_ptr<Client> c, uint16_t, uint32_t, string& data) {
         if (is_ep3(vq->version)) {
           send_open_quest_file(c, q->name, vq->bin_filename(), "", vq->quest_number, QuestFileType::EPISODE_3, vq->bin_contents);
         } else {
-          vq = vq->create_download_quest(c->language());
+          vq = quest_index->download_quest(vq, c->language());
           string xb_filename = vq->xb_filename();
           QuestFileType type = vq->pvr_contents ? QuestFileType::DOWNLOAD_WITH_PVR : QuestFileType::DOWNLOAD_WITHOUT_PVR;
           send_open_quest_file(c, q->name, vq->bin_filename(), xb_filename, vq->quest_number, type, vq->bin_contents);
@@ -3055,26 +3055,17 @@ static void on_D7_GC(shared_ptr<Client> c, uint16_t, uint32_t, string& data) {
 
 static void on_13_A7_V3_V4(shared_ptr<Client> c, uint16_t command, uint32_t flag, string& data) {
   const auto& cmd = check_size_t<C_WriteFileConfirmation_V3_BB_13_A7>(data);
-  bool is_download_quest = (command == 0xA7);
   string filename = cmd.filename.decode();
-  size_t chunk_to_send = flag + V3_V4_QUEST_LOAD_MAX_CHUNKS_IN_FLIGHT;
 
-  shared_ptr<const string> file_data;
-  try {
-    file_data = c->sending_files.at(filename);
-  } catch (const out_of_range&) {
+  auto it = c->sending_files.find(filename);
+  if (it == c->sending_files.end()) {
     return;
   }
-
-  size_t chunk_offset = chunk_to_send * 0x400;
-  if (chunk_offset >= file_data->size()) {
-    c->log.info("Done sending file %s", filename.c_str());
-    c->sending_files.erase(filename);
-  } else {
-    const void* chunk_data = file_data->data() + (chunk_to_send * 0x400);
-    size_t chunk_size = min<size_t>(file_data->size() - chunk_offset, 0x400);
-    send_quest_file_chunk(c, filename, chunk_to_send, chunk_data, chunk_size, is_download_quest);
-  }
+  // The flag is the index of the chunk being acknowledged. Acknowledgements
+  // arrive in order, but ignore any that are stale or duplicated.
+  auto& sf = it->second;
+  sf.num_chunks_acknowledged = max<size_t>(sf.num_chunks_acknowledged, min<size_t>(flag + 1, sf.next_chunk_index));
+  send_next_quest_file_chunks(c, filename);
 }
 
 static void on_61_98(shared_ptr<Client> c, uint16_t command, uint32_t flag, string& data) {
@@ -4236,7 +4227,10 @@ static void on_C9_XB(shared_ptr<Client> c, uint16_t, uint32_t flag, string& data
   c->log.warning("Ignoring connection status change command (%02" PRIX32 ")", flag);
 }
 
-shared_ptr<Lobby> create_game_generic(
+// Creates an unpublished game with everything except its map (for non-Ep3
+// games), which is generated by the caller. Returns null if the client isn't
+// allowed to create the game (and has already been told why).
+static shared_ptr<Lobby> prepare_game(
     shared_ptr<ServerState> s,
     shared_ptr<Client> c,
     const std::string& name,
@@ -4272,7 +4266,7 @@ shared_ptr<Lobby> create_game_generic(
     return nullptr;
   }
 
-  shared_ptr<Lobby> game = s->create_lobby(true);
+  shared_ptr<Lobby> game = s->create_lobby(true, false);
   game->name = name;
   game->base_version = c->version();
   game->allowed_versions = 0;
@@ -4473,7 +4467,6 @@ shared_ptr<Lobby> create_game_generic(
       auto sdt = s->set_data_table(game->base_version, game->episode, game->mode, game->difficulty);
       game->variations = sdt->generate_variations(game->episode, is_solo, game->opt_rand_crypt);
     }
-    game->load_maps();
   } else {
     game->variations.clear(0);
     game->map = make_shared<Map>(game->base_version, game->lobby_id, game->random_seed, game->opt_rand_crypt);
@@ -4517,6 +4510,128 @@ shared_ptr<Lobby> create_game_generic(
   return game;
 }
 
+shared_ptr<Lobby> create_game_generic(
+    shared_ptr<ServerState> s,
+    shared_ptr<Client> c,
+    const std::string& name,
+    const std::string& password,
+    Episode episode,
+    GameMode mode,
+    uint8_t difficulty,
+    bool allow_v1,
+    shared_ptr<Lobby> watched_lobby,
+    shared_ptr<Episode3::BattleRecordPlayer> battle_player) {
+  auto game = prepare_game(s, c, name, password, episode, mode, difficulty, allow_v1, watched_lobby, battle_player);
+  if (game) {
+    if (!game->map) {
+      game->load_maps();
+    }
+    s->publish_lobby(game);
+  }
+  return game;
+}
+
+void create_game_generic_async(
+    shared_ptr<ServerState> s,
+    shared_ptr<Client> c,
+    const std::string& name,
+    const std::string& password,
+    Episode episode,
+    GameMode mode,
+    uint8_t difficulty,
+    bool allow_v1,
+    shared_ptr<Lobby> watched_lobby,
+    std::function<void(shared_ptr<Client>, shared_ptr<Lobby>)>&& on_created) {
+  if (c->game_creation_in_progress) {
+    c->log.warning("Ignoring game creation request while another game is being created");
+    return;
+  }
+
+  // prepare_game consumes the client's variations override and may set the
+  // artificial flag state flag; if the game is discarded before the client
+  // joins it, these are restored
+  auto prev_override_variations = c->override_variations
+      ? make_shared<parray<le_uint32_t, 0x20>>(*c->override_variations)
+      : nullptr;
+  bool had_artificial_flag_state = c->config.check_flag(Client::Flag::SHOULD_SEND_ARTIFICIAL_FLAG_STATE);
+
+  auto game = prepare_game(s, c, name, password, episode, mode, difficulty, allow_v1, watched_lobby, nullptr);
+  if (!game) {
+    return;
+  }
+  if (game->map || !s->game_creation_pool) {
+    if (!game->map) {
+      game->load_maps();
+    }
+    s->publish_lobby(game);
+    on_created(c, game);
+    return;
+  }
+
+  // The map generator only uses copies of the game's parameters, so it can run
+  // on another thread while the game is unpublished. The game is published
+  // and the client is moved into it on the event thread afterward; if the
+  // client disconnects in the meantime, the game is discarded. Everything that
+  // refers to the server or the game is moved into the event thread callback
+  // so it's never destroyed on the worker thread.
+  c->game_creation_in_progress = true;
+  game->log.info("Generating map in background");
+  auto base = s->base;
+  auto discard_game = [prev_override_variations, had_artificial_flag_state](shared_ptr<Client> c) -> void {
+    if (prev_override_variations && !c->override_variations) {
+      c->override_variations = make_unique<parray<le_uint32_t, 0x20>>(*prev_override_variations);
+    }
+    if (!had_artificial_flag_state) {
+      c->config.clear_flag(Client::Flag::SHOULD_SEND_ARTIFICIAL_FLAG_STATE);
+    }
+  };
+  s->game_creation_pool->enqueue([base, s, game, wc = weak_ptr<Client>(c), wl = c->lobby, generate_map = game->map_generator(), discard_game = std::move(discard_game), on_created = std::move(on_created)]() mutable -> void {
+    shared_ptr<Map> map;
+    string error;
+    try {
+      map = generate_map();
+    } catch (const exception& e) {
+      error = e.what();
+    }
+    forward_to_event_thread(base, [s = std::move(s), game = std::move(game), wc = std::move(wc), wl = std::move(wl), map = std::move(map), error = std::move(error), discard_game = std::move(discard_game), on_created = std::move(on_created)]() mutable -> void {
+      auto c = wc.lock();
+      if (c) {
+        c->game_creation_in_progress = false;
+      }
+      if (!map) {
+        game->log.error("Failed to generate map: %s", error.c_str());
+        if (c) {
+          discard_game(c);
+          send_lobby_message_box(c, "$C6Failed to create\ngame:\n" + error);
+        }
+        return;
+      }
+      if (!c) {
+        game->log.info("Creator disconnected before map was ready; discarding game");
+        return;
+      }
+      // If the client joined a game or changed lobbies while the map was being
+      // generated, don't pull it out of wherever it is now
+      auto current_lobby = c->lobby.lock();
+      if (!current_lobby || (current_lobby != wl.lock()) || current_lobby->is_game()) {
+        game->log.info("Creator changed lobbies before map was ready; discarding game");
+        discard_game(c);
+        return;
+      }
+      try {
+        game->map = std::move(map);
+        s->publish_lobby(game);
+        on_created(c, game);
+      } catch (const exception& e) {
+        c->log.warning("Error finishing game creation: %s", e.what());
+        if (s->game_server) {
+          s->game_server->disconnect_client(c);
+        }
+      }
+    });
+  });
+}
+
 static void on_C1_PC(shared_ptr<Client> c, uint16_t, uint32_t, string& data) {
   const auto& cmd = check_size_t<C_CreateGame_PC_C1>(data);
   auto s = c->require_server_state();
@@ -4527,21 +4642,36 @@ static void on_C1_PC(shared_ptr<Client> c, uint16_t, uint32_t, string& data) {
   } else if (cmd.challenge_mode) {
     mode = GameMode::CHALLENGE;
   }
-  auto game = create_game_generic(s, c, cmd.name.decode(c->language()), cmd.password.decode(c->language()), Episode::EP1, mode, cmd.difficulty, true);
-  if (game) {
+  create_game_generic_async(s, c, cmd.name.decode(c->language()), cmd.password.decode(c->language()), Episode::EP1, mode, cmd.difficulty, true, nullptr, [s](shared_ptr<Client> c, shared_ptr<Lobby> game) -> void {
     s->change_client_lobby(c, game);
     c->config.set_flag(Client::Flag::LOADING);
     c->log.info("LOADING flag set");
-  }
+  });
 }
 
 static void on_0C_C1_E7_EC(shared_ptr<Client> c, uint16_t command, uint32_t, string& data) {
   auto s = c->require_server_state();
 
-  shared_ptr<Lobby> game;
+  auto on_created = [s](shared_ptr<Client> c, shared_ptr<Lobby> game) -> void {
+    s->change_client_lobby(c, game);
+    c->config.set_flag(Client::Flag::LOADING);
+    c->log.info("LOADING flag set");
+
+    // There is a bug in DC NTE and 11/2000 that causes them to assign item IDs
+    // twice when joining a game. If there are other players in the game, this
+    // isn't an issue because the equivalent of the 6x6D command resets the next
+    // item ID before the second assignment, so the item IDs stay in sync with
+    // the server. If there was no one else in the game, however (as in this
+    // case, when it was just created), we need to artificially change the next
+    // item IDs during the client's loading procedure.
+    if (is_pre_v1(c->version())) {
+      c->config.set_flag(Client::Flag::SHOULD_SEND_ARTIFICIAL_ITEM_STATE);
+    }
+  };
+
   if ((c->version() == Version::DC_NTE) || (c->version() == Version::DC_V1_11_2000_PROTOTYPE)) {
     const auto& cmd = check_size_t<C_CreateGame_DCNTE>(data);
-    game = create_game_generic(s, c, cmd.name.decode(c->language()), cmd.password.decode(c->language()), Episode::EP1, GameMode::NORMAL, 0, true);
+    create_game_generic_async(s, c, cmd.name.decode(c->language()), cmd.password.decode(c->language()), Episode::EP1, GameMode::NORMAL, 0, true, nullptr, std::move(on_created));
 
   } else {
     const auto& cmd = check_size_t<C_CreateGame_DC_V3_0C_C1_Ep3_EC>(data);
@@ -4592,30 +4722,15 @@ static void on_0C_C1_E7_EC(shared_ptr<Client> c, uint16_t command, uint32_t, str
       }
     }
 
-    game = create_game_generic(s, c, cmd.name.decode(c->language()), cmd.password.decode(c->language()), episode, mode, cmd.difficulty, allow_v1, watched_lobby);
-    if (game && (game->episode == Episode::EP3)) {
-      game->ep3_ex_result_values = s->ep3_default_ex_values;
-      if (spectators_forbidden) {
-        game->set_flag(Lobby::Flag::SPECTATORS_FORBIDDEN);
+    create_game_generic_async(s, c, cmd.name.decode(c->language()), cmd.password.decode(c->language()), episode, mode, cmd.difficulty, allow_v1, watched_lobby, [s, spectators_forbidden, on_created](shared_ptr<Client> c, shared_ptr<Lobby> game) -> void {
+      if (game->episode == Episode::EP3) {
+        game->ep3_ex_result_values = s->ep3_default_ex_values;
+        if (spectators_forbidden) {
+          game->set_flag(Lobby::Flag::SPECTATORS_FORBIDDEN);
+        }
       }
-    }
-  }
-
-  if (game) {
-    s->change_client_lobby(c, game);
-    c->config.set_flag(Client::Flag::LOADING);
-    c->log.info("LOADING flag set");
-
-    // There is a bug in DC NTE and 11/2000 that causes them to assign item IDs
-    // twice when joining a game. If there are other players in the game, this
-    // isn't an issue because the equivalent of the 6x6D command resets the next
-    // item ID before the second assignment, so the item IDs stay in sync with
-    // the server. If there was no one else in the game, however (as in this
-    // case, when it was just created), we need to artificially change the next
-    // item IDs during the client's loading procedure.
-    if (is_pre_v1(c->version())) {
-      c->config.set_flag(Client::Flag::SHOULD_SEND_ARTIFICIAL_ITEM_STATE);
-    }
+      on_created(c, game);
+    });
   }
 }
 
@@ -4658,12 +4773,11 @@ static void on_C1_BB(shared_ptr<Client> c, uint16_t, uint32_t, string& data) {
       throw runtime_error("invalid episode number");
   }
 
-  auto game = create_game_generic(s, c, cmd.name.decode(c->language()), cmd.password.decode(c->language()), episode, mode, cmd.difficulty);
-  if (game) {
+  create_game_generic_async(s, c, cmd.name.decode(c->language()), cmd.password.decode(c->language()), episode, mode, cmd.difficulty, false, nullptr, [s](shared_ptr<Client> c, shared_ptr<Lobby> game) -> void {
     s->change_client_lobby(c, game);
     c->config.set_flag(Client::Flag::LOADING);
     c->log.info("LOADING flag set");
-  }
+  });
 }
 
 static void on_8A(shared_ptr<Client> c, uint16_t, uint32_t, string& data) {
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <string>
 
@@ -17,6 +18,21 @@ std::shared_ptr<Lobby> create_game_generic(
     bool allow_v1 = false,
     std::shared_ptr<Lobby> watched_lobby = nullptr,
     std::shared_ptr<Episode3::BattleRecordPlayer> battle_player = nullptr);
+// Like create_game_generic, but generates the game's map on the server's game
+// creation thread pool (if any), then publishes the game and calls on_created
+// on the event thread. on_created is not called if game creation fails or the
+// client disconnects before it's done.
+void create_game_generic_async(
+    std::shared_ptr<ServerState> s,
+    std::shared_ptr<Client> c,
+    const std::string& name,
+    const std::string& password,
+    Episode episode,
+    GameMode mode,
+    uint8_t difficulty,
+    bool allow_v1,
+    std::shared_ptr<Lobby> watched_lobby,
+    std::function<void(std::shared_ptr<Client>, std::shared_ptr<Lobby>)>&& on_created);
 void set_lobby_quest(std::shared_ptr<Lobby> l, std::shared_ptr<const Quest> q, bool substitute_v3_for_ep3 = false);
 
 void on_connect(std::shared_ptr<Client> c);
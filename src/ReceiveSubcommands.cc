@@ -374,7 +374,12 @@ static void on_sync_joining_player_compressed_state(shared_ptr<Client> c, uint8_
         l->log.info("Checking client enemy state against server state");
         phosg::StringReader r(decompressed);
         size_t count = r.size() / sizeof(G_SyncEnemyState_6x6B_Entry_Decompressed);
-        if (count != l->map->enemies.size()) {
+        if (l->map->has_pending_floors() && (count > l->map->enemies.size())) {
+          // This is normal because floors that no player has entered yet
+          // haven't been loaded
+          l->log.info("Enemy count from client (%zu) exceeds enemy count from partially-loaded map (%zu)",
+              count, l->map->enemies.size());
+        } else if (count != l->map->enemies.size()) {
           l->log.warning("Enemy count from client (%zu) does not match enemy count from map (%zu)",
               count, l->map->enemies.size());
         } else {
@@ -413,8 +418,13 @@ static void on_sync_joining_player_compressed_state(shared_ptr<Client> c, uint8_
         phosg::StringReader r(decompressed);
         size_t count = r.size() / sizeof(G_SyncObjectState_6x6C_Entry_Decompressed);
         if (count > l->map->objects.size()) {
-          l->log.warning("Object count from client (%zu) exceeds object count from map (%zu)",
-              count, l->map->objects.size());
+          if (l->map->has_pending_floors()) {
+            l->log.info("Object count from client (%zu) exceeds object count from partially-loaded map (%zu)",
+                count, l->map->objects.size());
+          } else {
+            l->log.warning("Object count from client (%zu) exceeds object count from map (%zu)",
+                count, l->map->objects.size());
+          }
         } else if (count < l->map->objects.size()) {
           // This is normal because we load objects for inaccessible maps (e.g. lobby)
           l->log.info("Object count from client (%zu) is less than object count from map (%zu) (this is normal)",
@@ -505,8 +515,13 @@ static void on_sync_joining_player_compressed_state(shared_ptr<Client> c, uint8_
         }
 
         if (set_flags_header.num_object_sets > l->map->objects.size()) {
-          l->log.warning("Object set count from client (%" PRIu32 ") exceeds object count from map (%zu)",
-              set_flags_header.num_object_sets.load(), l->map->objects.size());
+          if (l->map->has_pending_floors()) {
+            l->log.info("Object set count from client (%" PRIu32 ") exceeds object count from partially-loaded map (%zu)",
+                set_flags_header.num_object_sets.load(), l->map->objects.size());
+          } else {
+            l->log.warning("Object set count from client (%" PRIu32 ") exceeds object count from map (%zu)",
+                set_flags_header.num_object_sets.load(), l->map->objects.size());
+          }
         } else if (set_flags_header.num_object_sets < l->map->objects.size()) {
           // This is normal because we load objects for inaccessible maps (e.g. lobby)
           l->log.info("Object set count from client (%" PRIu32 ") is less than object count from map (%zu) (this is normal)",
@@ -1394,6 +1409,22 @@ static void on_set_player_visible(shared_ptr<Client> c, uint8_t command, uint8_t
 
 ////////////////////////////////////////////////////////////////////////////////
 
+static void on_client_floor_changed(shared_ptr<Client> c) {
+  c->recent_switch_flags.clear();
+  // If the map is being loaded lazily, load this floor (and all floors before
+  // it) if no player has entered it yet
+  auto l = c->lobby.lock();
+  if (l && l->map) {
+    try {
+      l->map->materialize_floor(min<uint32_t>(c->floor, 0xFF));
+    } catch (const exception& e) {
+      // Entities on this floor (and later floors) will be missing, but the
+      // game can continue
+      l->log.warning("Failed to load map entities for floor %02" PRIX32 ": %s", c->floor, e.what());
+    }
+  }
+}
+
 static void on_change_floor_6x1F(shared_ptr<Client> c, uint8_t command, uint8_t flag, void* data, size_t size) {
   if (is_pre_v1(c->version())) {
     check_size_t<G_SetPlayerFloor_DCNTE_6x1F>(data, size);
@@ -1410,7 +1441,7 @@ static void on_change_floor_6x1F(shared_ptr<Client> c, uint8_t command, uint8_t
     const auto& cmd = check_size_t<G_SetPlayerFloor_6x1F>(data, size);
     if (cmd.floor >= 0 && c->floor != static_cast<uint32_t>(cmd.floor)) {
       c->floor = cmd.floor;
-      c->recent_switch_flags.clear();
+      on_client_floor_changed(c);
     }
   }
   forward_subcommand(c, command, flag, data, size);
@@ -1420,7 +1451,7 @@ static void on_change_floor_6x21(shared_ptr<Client> c, uint8_t command, uint8_t
   const auto& cmd = check_size_t<G_InterLevelWarp_6x21>(data, size);
   if (cmd.floor >= 0 && c->floor != static_cast<uint32_t>(cmd.floor)) {
     c->floor = cmd.floor;
-    c->recent_switch_flags.clear();
+    on_client_floor_changed(c);
   }
   forward_subcommand(c, command, flag, data, size);
 }
@@ -1640,7 +1671,7 @@ void on_movement_with_floor(shared_ptr<Client> c, uint8_t command, uint8_t flag,
   c->z = cmd.z;
   if (cmd.floor >= 0 && c->floor != static_cast<uint32_t>(cmd.floor)) {
     c->floor = cmd.floor;
-    c->recent_switch_flags.clear();
+    on_client_floor_changed(c);
   }
   forward_subcommand(c, command, flag, data, size);
 }
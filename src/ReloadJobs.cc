@@ -0,0 +1,374 @@
+#include "ReloadJobs.hh"
+
+#include <inttypes.h>
+
+#include <chrono>
+#include <phosg/Strings.hh>
+#include <phosg/Time.hh>
+#include <stdexcept>
+
+#include "EventUtils.hh"
+#include "Loggers.hh"
+#include "ServerState.hh"
+
+using namespace std;
+
+struct ReloadItemDefinition {
+  const char* name;
+  // Called on the job thread. If this is null, commit must not be null.
+  void (*build)(shared_ptr<ServerState> s);
+  // Called on the event thread after build returns. If this is null, the job
+  // only waits for the event thread to process the data committed by build.
+  void (*commit)(shared_ptr<ServerState> s);
+};
+
+static const vector<ReloadItemDefinition> reload_item_defs = {
+    {"accounts", +[](shared_ptr<ServerState> s) { s->load_accounts(true); }, nullptr},
+    {"battle-params", +[](shared_ptr<ServerState> s) { s->load_battle_params(true); }, nullptr},
+    {"bb-keys", +[](shared_ptr<ServerState> s) { s->load_bb_private_keys(true); }, nullptr},
+    {"caches", +[](shared_ptr<ServerState> s) { s->clear_file_caches(true); }, nullptr},
+    {"config", nullptr, +[](shared_ptr<ServerState> s) {
+       try {
+         s->load_config_early();
+         s->load_config_late();
+       } catch (const exception& e) {
+         throw runtime_error(phosg::string_printf(
+             "%s (some configuration may have been reloaded; fix the underlying issue and try again)", e.what()));
+       }
+     }},
+    {"dol-files", +[](shared_ptr<ServerState> s) { s->load_dol_files(true); }, nullptr},
+    {"drop-tables", +[](shared_ptr<ServerState> s) { s->load_drop_tables(true); }, nullptr},
+    {"ep3-cards", +[](shared_ptr<ServerState> s) { s->load_ep3_cards(true); }, nullptr},
+    {"ep3-maps", +[](shared_ptr<ServerState> s) { s->load_ep3_maps(true); }, nullptr},
+    {"ep3-tournaments", +[](shared_ptr<ServerState> s) { s->load_ep3_tournament_state(true); }, nullptr},
+    {"functions", +[](shared_ptr<ServerState> s) { s->compile_functions(true); }, nullptr},
+    {"item-definitions", +[](shared_ptr<ServerState> s) { s->load_item_definitions(true); }, nullptr},
+    {"item-name-index", +[](shared_ptr<ServerState> s) { s->load_item_name_indexes(true); }, nullptr},
+    {"level-tables", +[](shared_ptr<ServerState> s) { s->load_level_tables(true); }, nullptr},
+    {"patch-files", +[](shared_ptr<ServerState> s) { s->load_patch_indexes(true); }, nullptr},
+    {"quests", +[](shared_ptr<ServerState> s) { s->load_quest_index(true); }, nullptr},
+    {"set-tables", +[](shared_ptr<ServerState> s) { s->load_set_data_tables(true); }, nullptr},
+    {"teams", +[](shared_ptr<ServerState> s) { s->load_teams(true); }, nullptr},
+    {"text-index", +[](shared_ptr<ServerState> s) { s->load_text_index(true); }, nullptr},
+    {"word-select", +[](shared_ptr<ServerState> s) { s->load_word_select_table(true); }, nullptr},
+};
+
+static const ReloadItemDefinition& reload_item_def_for_name(const string& name) {
+  for (const auto& def : reload_item_defs) {
+    if (name == def.name) {
+      return def;
+    }
+  }
+  throw invalid_argument("invalid data type: " + name);
+}
+
+template <>
+const char* phosg::name_for_enum<ReloadJobManager::Status>(ReloadJobManager::Status status) {
+  switch (status) {
+    case ReloadJobManager::Status::QUEUED:
+      return "QUEUED";
+    case ReloadJobManager::Status::RUNNING:
+      return "RUNNING";
+    case ReloadJobManager::Status::COMPLETE:
+      return "COMPLETE";
+    case ReloadJobManager::Status::FAILED:
+      return "FAILED";
+    case ReloadJobManager::Status::CANCELED:
+      return "CANCELED";
+    default:
+      throw runtime_error("invalid reload job status");
+  }
+}
+
+phosg::JSON ReloadJobManager::Job::json() const {
+  auto items_json = phosg::JSON::list();
+  for (const auto& item : this->items) {
+    items_json.emplace_back(item);
+  }
+  auto ret = phosg::JSON::dict({
+      {"ID", this->id},
+      {"Items", std::move(items_json)},
+      {"Status", phosg::name_for_enum(this->status)},
+      {"ItemsComplete", this->num_items_complete},
+      {"CurrentItem", ((this->status == Status::RUNNING) && (this->num_items_complete < this->items.size()))
+              ? phosg::JSON(this->items[this->num_items_complete])
+              : phosg::JSON(nullptr)},
+      {"Error", this->error.empty() ? phosg::JSON(nullptr) : phosg::JSON(this->error)},
+      {"CancelRequested", this->cancel_requested},
+      {"CreateTime", phosg::format_time(this->create_time)},
+      {"StartTime", this->start_time ? phosg::JSON(phosg::format_time(this->start_time)) : phosg::JSON(nullptr)},
+      {"EndTime", this->end_time ? phosg::JSON(phosg::format_time(this->end_time)) : phosg::JSON(nullptr)},
+  });
+  return ret;
+}
+
+string ReloadJobManager::Job::str() const {
+  string ret = phosg::string_printf("Job %" PRIu64 " (%s): %s",
+      this->id, phosg::join(this->items, ", ").c_str(), phosg::name_for_enum(this->status));
+  if (this->status == Status::RUNNING) {
+    ret += phosg::string_printf(" (%zu/%zu complete", this->num_items_complete, this->items.size());
+    if (this->num_items_complete < this->items.size()) {
+      ret += "; current item: " + this->items[this->num_items_complete];
+    }
+    if (this->cancel_requested) {
+      ret += "; cancel requested";
+    }
+    ret += ")";
+  } else if (this->status == Status::FAILED) {
+    ret += " (" + this->error + ")";
+  }
+  if (this->start_time && this->end_time) {
+    ret += " after " + phosg::format_duration(this->end_time - this->start_time);
+  }
+  return ret;
+}
+
+ReloadJobManager::ReloadJobManager(shared_ptr<ServerState> s)
+    : server_state(s),
+      th(&ReloadJobManager::thread_fn, this) {}
+
+ReloadJobManager::~ReloadJobManager() {
+  {
+    lock_guard g(this->lock);
+    this->should_exit = true;
+    uint64_t now_usecs = phosg::now();
+    for (auto& job : this->jobs) {
+      if (job->status == Status::QUEUED) {
+        job->status = Status::CANCELED;
+        job->end_time = now_usecs;
+      }
+    }
+  }
+  this->cv.notify_all();
+  this->th.join();
+}
+
+const vector<string>& ReloadJobManager::all_item_names() {
+  static const vector<string> ret = []() -> vector<string> {
+    vector<string> ret;
+    for (const auto& def : reload_item_defs) {
+      ret.emplace_back(def.name);
+    }
+    return ret;
+  }();
+  return ret;
+}
+
+ReloadJobManager::Job ReloadJobManager::enqueue(const vector<string>& items) {
+  if (items.empty()) {
+    throw invalid_argument("no data types given");
+  }
+  for (const auto& item : items) {
+    reload_item_def_for_name(item);
+  }
+
+  auto job = make_shared<Job>();
+  job->items = items;
+  job->create_time = phosg::now();
+  Job ret;
+  {
+    lock_guard g(this->lock);
+    job->id = this->next_job_id++;
+    this->jobs.emplace_back(job);
+    this->forget_old_jobs_locked();
+    ret = *job;
+  }
+  this->cv.notify_all();
+  config_log.info("Reload job %" PRIu64 " queued: %s", ret.id, phosg::join(items, ", ").c_str());
+  return ret;
+}
+
+bool ReloadJobManager::cancel(uint64_t job_id) {
+  lock_guard g(this->lock);
+  auto job = this->find_job_locked(job_id);
+  if (!job) {
+    return false;
+  }
+  if (job->status == Status::QUEUED) {
+    job->status = Status::CANCELED;
+    job->end_time = phosg::now();
+    return true;
+  } else if (job->status == Status::RUNNING) {
+    job->cancel_requested = true;
+    return true;
+  } else {
+    return false;
+  }
+}
+
+ReloadJobManager::Job ReloadJobManager::get_job(uint64_t job_id) const {
+  lock_guard g(this->lock);
+  auto job = this->find_job_locked(job_id);
+  if (!job) {
+    throw out_of_range("reload job does not exist");
+  }
+  return *job;
+}
+
+vector<ReloadJobManager::Job> ReloadJobManager::get_jobs() const {
+  lock_guard g(this->lock);
+  vector<Job> ret;
+  for (const auto& job : this->jobs) {
+    ret.emplace_back(*job);
+  }
+  return ret;
+}
+
+phosg::JSON ReloadJobManager::jobs_json() const {
+  auto ret = phosg::JSON::list();
+  for (const auto& job : this->get_jobs()) {
+    ret.emplace_back(job.json());
+  }
+  return ret;
+}
+
+shared_ptr<ReloadJobManager::Job> ReloadJobManager::find_job_locked(uint64_t job_id) const {
+  for (const auto& job : this->jobs) {
+    if (job->id == job_id) {
+      return job;
+    }
+  }
+  return nullptr;
+}
+
+void ReloadJobManager::forget_old_jobs_locked() {
+  size_t num_finished = 0;
+  for (const auto& job : this->jobs) {
+    num_finished += (job->status != Status::QUEUED) && (job->status != Status::RUNNING);
+  }
+  for (auto it = this->jobs.begin(); (num_finished > MAX_FINISHED_JOBS) && (it != this->jobs.end());) {
+    if (((*it)->status != Status::QUEUED) && ((*it)->status != Status::RUNNING)) {
+      it = this->jobs.erase(it);
+      num_finished--;
+    } else {
+      it++;
+    }
+  }
+}
+
+void ReloadJobManager::thread_fn() {
+  for (;;) {
+    shared_ptr<Job> job;
+    {
+      unique_lock g(this->lock);
+      this->cv.wait(g, [&]() -> bool {
+        if (this->should_exit) {
+          return true;
+        }
+        for (const auto& job : this->jobs) {
+          if (job->status == Status::QUEUED) {
+            return true;
+          }
+        }
+        return false;
+      });
+      if (this->should_exit) {
+        return;
+      }
+      for (const auto& queued_job : this->jobs) {
+        if (queued_job->status == Status::QUEUED) {
+          job = queued_job;
+          break;
+        }
+      }
+      job->status = Status::RUNNING;
+      job->start_time = phosg::now();
+    }
+    this->run_job(job);
+  }
+}
+
+void ReloadJobManager::run_job(shared_ptr<Job> job) {
+  auto finish = [&](Status status, const string& error) -> void {
+    lock_guard g(this->lock);
+    job->status = status;
+    job->error = error;
+    job->end_time = phosg::now();
+    this->forget_old_jobs_locked();
+  };
+
+  auto s = this->server_state.lock();
+  if (!s) {
+    finish(Status::CANCELED, "");
+    return;
+  }
+
+  for (size_t z = 0; z < job->items.size(); z++) {
+    bool should_cancel;
+    {
+      lock_guard g(this->lock);
+      should_cancel = job->cancel_requested || this->should_exit;
+    }
+    if (should_cancel) {
+      finish(Status::CANCELED, "");
+      config_log.info("Reload job %" PRIu64 " canceled after %zu of %zu items", job->id, z, job->items.size());
+      return;
+    }
+
+    const auto& def = reload_item_def_for_name(job->items[z]);
+    config_log.info("Reload job %" PRIu64 ": reloading %s (%zu/%zu)", job->id, def.name, z + 1, job->items.size());
+    try {
+      if (def.build) {
+        def.build(s);
+      }
+      if (!this->wait_for_event_thread(s, def.commit)) {
+        finish(Status::CANCELED, "");
+        return;
+      }
+    } catch (const exception& e) {
+      config_log.warning("Reload job %" PRIu64 " failed while reloading %s: %s", job->id, def.name, e.what());
+      finish(Status::FAILED, phosg::string_printf("%s: %s", def.name, e.what()));
+      return;
+    }
+
+    lock_guard g(this->lock);
+    job->num_items_complete++;
+  }
+
+  finish(Status::COMPLETE, "");
+  config_log.info("Reload job %" PRIu64 " complete", job->id);
+}
+
+bool ReloadJobManager::wait_for_event_thread(shared_ptr<ServerState> s, void (*commit)(shared_ptr<ServerState>)) {
+  // This can't use call_on_event_thread, since the event loop might stop
+  // before processing the call (e.g. if the server is shutting down), and we
+  // would then never return. The call state is shared with the event thread
+  // for the same reason: the call may happen after this object is destroyed.
+  struct CallState {
+    mutex lock;
+    condition_variable cv;
+    bool done = false;
+    string error;
+  };
+  auto cs = make_shared<CallState>();
+
+  forward_to_event_thread(s->base, [cs, s, commit]() -> void {
+    string error;
+    if (commit) {
+      try {
+        commit(s);
+      } catch (const exception& e) {
+        error = e.what();
+      }
+    }
+    lock_guard g(cs->lock);
+    cs->done = true;
+    cs->error = std::move(error);
+    cs->cv.notify_all();
+  });
+
+  unique_lock g(cs->lock);
+  while (!cs->done) {
+    cs->cv.wait_for(g, chrono::milliseconds(100));
+    if (!cs->done) {
+      lock_guard g2(this->lock);
+      if (this->should_exit) {
+        return false;
+      }
+    }
+  }
+  if (!cs->error.empty()) {
+    throw runtime_error(cs->error);
+  }
+  return true;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <phosg/JSON.hh>
+#include <phosg/Types.hh>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct ServerState;
+
+// Runs reloads of server data (the same items as the shell's reload command)
+// in the background, one job at a time, so neither the shell nor the HTTP
+// server is blocked while large indexes are rebuilt. Each item in a job is
+// built on the job thread and then committed on the event thread by replacing
+// the relevant shared_ptr, so anything already using the previous version
+// (e.g. a game in progress) keeps it until it's done. The job waits for each
+// commit before starting the next item, so items that depend on each other
+// (e.g. item-definitions and item-name-index) can be reloaded in one job.
+//
+// Jobs can be canceled while they're queued or between items, but an item
+// that has already started always finishes, since data is only committed
+// once it has been completely built.
+class ReloadJobManager {
+public:
+  enum class Status {
+    QUEUED = 0,
+    RUNNING,
+    COMPLETE,
+    FAILED,
+    CANCELED,
+  };
+
+  struct Job {
+    uint64_t id = 0;
+    std::vector<std::string> items;
+    Status status = Status::QUEUED;
+    size_t num_items_complete = 0;
+    std::string error;
+    uint64_t create_time = 0;
+    uint64_t start_time = 0;
+    uint64_t end_time = 0;
+    bool cancel_requested = false;
+
+    phosg::JSON json() const;
+    std::string str() const;
+  };
+
+  explicit ReloadJobManager(std::shared_ptr<ServerState> s);
+  ReloadJobManager(const ReloadJobManager&) = delete;
+  ReloadJobManager(ReloadJobManager&&) = delete;
+  ReloadJobManager& operator=(const ReloadJobManager&) = delete;
+  ReloadJobManager& operator=(ReloadJobManager&&) = delete;
+  // Cancels all queued jobs and waits for the running job (if any) to stop
+  ~ReloadJobManager();
+
+  // Returns the list of valid item names, in the order they're listed in the
+  // shell's help text
+  static const std::vector<std::string>& all_item_names();
+
+  // Throws invalid_argument if any item name is invalid or if items is empty.
+  // Returns the new job's state.
+  Job enqueue(const std::vector<std::string>& items);
+  // Returns false if the job doesn't exist or has already finished
+  bool cancel(uint64_t job_id);
+
+  // Throws out_of_range if the job doesn't exist (or was finished long enough
+  // ago that it was forgotten)
+  Job get_job(uint64_t job_id) const;
+  // Returns all unfinished jobs and the most recent finished jobs, in order
+  // of creation
+  std::vector<Job> get_jobs() const;
+  phosg::JSON jobs_json() const;
+
+private:
+  static constexpr size_t MAX_FINISHED_JOBS = 32;
+
+  std::weak_ptr<ServerState> server_state;
+  mutable std::mutex lock;
+  std::condition_variable cv;
+  bool should_exit = false;
+  uint64_t next_job_id = 1;
+  std::deque<std::shared_ptr<Job>> jobs; // Ordered by ID
+  std::thread th;
+
+  std::shared_ptr<Job> find_job_locked(uint64_t job_id) const;
+  void forget_old_jobs_locked();
+  void thread_fn();
+  void run_job(std::shared_ptr<Job> job);
+  // Calls commit (if not null) on the event thread and waits for it to return.
+  // Returns false if the manager is being destroyed before this happens.
+  bool wait_for_event_thread(std::shared_ptr<ServerState> s, void (*commit)(std::shared_ptr<ServerState>));
+};
+
+template <>
+const char* phosg::name_for_enum<ReloadJobManager::Status>(ReloadJobManager::Status status);
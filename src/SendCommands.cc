@@ -2654,10 +2654,10 @@ void send_game_item_state(shared_ptr<Client> c) {
   for (size_t floor = 0; floor < 0x10; floor++) {
     const auto& m = l->floor_item_managers.at(floor);
     // It's important that these are added in increasing order of item_id (hence
-    // why items is a map and not an unordered_map), since the game uses binary
-    // search to find floor items when picking them up. If items aren't in the
-    // correct order, the game may fail to find an item when attempting to pick
-    // it up, causing "ghost items" which are visible but can't be picked up.
+    // why items is kept sorted), since the game uses binary search to find
+    // floor items when picking them up. If items aren't in the correct order,
+    // the game may fail to find an item when attempting to pick it up, causing
+    // "ghost items" which are visible but can't be picked up.
     for (const auto& it : m.items) {
       const auto& item = it.second;
       if (!item->visible_to_client(c->lobby_client_id)) {
@@ -3853,25 +3853,54 @@ void send_open_quest_file(
   // send a lot of data at once, but on GC, the client will crash if too much
   // quest data is sent at once. This is likely a bug in the TCP stack, since
   // the client should apply backpressure to avoid bad situations, but we have
-  // to deal with it here instead.
-  size_t total_chunks = (contents->size() + 0x3FF) / 0x400;
-  size_t chunks_to_send = is_v1_or_v2(c->version()) ? total_chunks : min<size_t>(V3_V4_QUEST_LOAD_MAX_CHUNKS_IN_FLIGHT, total_chunks);
-
-  for (size_t z = 0; z < chunks_to_send; z++) {
-    size_t offset = z * 0x400;
-    size_t chunk_bytes = contents->size() - offset;
-    if (chunk_bytes > 0x400) {
-      chunk_bytes = 0x400;
+  // to deal with it here instead. V1 and V2 clients don't acknowledge chunks,
+  // so we send the entire file immediately; on later versions, we track the
+  // file so the chunk acknowledgement handler (13 or A7) can send the rest.
+  if (is_v1_or_v2(c->version())) {
+    for (size_t offset = 0; offset < contents->size(); offset += 0x400) {
+      size_t chunk_bytes = min<size_t>(contents->size() - offset, 0x400);
+      send_quest_file_chunk(c, filename.c_str(), offset / 0x400,
+          contents->data() + offset, chunk_bytes, (type != QuestFileType::ONLINE));
     }
-    send_quest_file_chunk(c, filename.c_str(), offset / 0x400,
-        contents->data() + offset, chunk_bytes, (type != QuestFileType::ONLINE));
+  } else {
+    auto& sf = c->sending_files[filename];
+    sf.data = contents;
+    sf.is_download_quest = (type != QuestFileType::ONLINE);
+    sf.next_chunk_index = 0;
+    sf.num_chunks_acknowledged = 0;
+    c->log.info("Opened file %s", filename.c_str());
+    send_next_quest_file_chunks(c, filename);
   }
+}
 
-  // If there are still chunks to send, track the file so the chunk
-  // acknowledgement handler (13 or A7) cna know what to send next
-  if (chunks_to_send < total_chunks) {
-    c->sending_files.emplace(filename, contents);
-    c->log.info("Opened file %s", filename.c_str());
+void send_next_quest_file_chunks(shared_ptr<Client> c, const string& filename) {
+  auto it = c->sending_files.find(filename);
+  if (it == c->sending_files.end()) {
+    return;
+  }
+  auto& sf = it->second;
+
+  // If the connection has fallen behind (there's already more than a full
+  // window of data waiting to be written), keep only one chunk in flight until
+  // it catches up. There must always be at least one chunk in flight, since
+  // the client's acknowledgements are what cause us to send more.
+  auto s = c->require_server_state();
+  size_t window = s->quest_file_chunks_in_flight;
+  if (c->channel.output_buffer_bytes() > window * sizeof(S_WriteFile_13_A7)) {
+    window = 1;
+  }
+
+  size_t total_chunks = (sf.data->size() + 0x3FF) / 0x400;
+  while ((sf.next_chunk_index < total_chunks) && (sf.next_chunk_index - sf.num_chunks_acknowledged < window)) {
+    size_t offset = sf.next_chunk_index * 0x400;
+    size_t chunk_bytes = min<size_t>(sf.data->size() - offset, 0x400);
+    send_quest_file_chunk(c, filename, sf.next_chunk_index, sf.data->data() + offset, chunk_bytes, sf.is_download_quest);
+    sf.next_chunk_index++;
+  }
+
+  if (sf.next_chunk_index >= total_chunks) {
+    c->log.info("Done sending file %s", filename.c_str());
+    c->sending_files.erase(it);
   }
 }
 
@@ -21,8 +21,6 @@ extern const std::unordered_set<uint32_t> v2_crypt_initial_client_commands;
 extern const std::unordered_set<uint32_t> v3_crypt_initial_client_commands;
 extern const std::unordered_set<std::string> bb_crypt_initial_client_commands;
 
-constexpr size_t V3_V4_QUEST_LOAD_MAX_CHUNKS_IN_FLIGHT = 4;
-
 // TODO: Many of these functions should take a Channel& instead of a
 // shared_ptr<Client>. Refactor functions appropriately.
 
@@ -437,6 +435,9 @@ void send_quest_file_chunk(
     const void* data,
     size_t size,
     bool is_download_quest);
+// Sends as many chunks of a file in c->sending_files as the transfer window
+// allows, and stops tracking the file once all chunks have been sent
+void send_next_quest_file_chunks(std::shared_ptr<Client> c, const std::string& filename);
 bool send_quest_barrier_if_all_clients_ready(std::shared_ptr<Lobby> l);
 bool send_ep3_start_tournament_deck_select_if_all_clients_ready(std::shared_ptr<Lobby> l);
 
@@ -1,6 +1,7 @@
 #include "ServerShell.hh"
 
 #include <event2/event.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -231,6 +232,11 @@ CommandDefinition c_reload(
       teams - reindex all BB teams\n\
       text-index - reload in-game text\n\
       word-select - regenerate the Word Select translation table\n\
+    Reloading happens in the background; this command returns immediately, and\n\
+    the reload's progress can be checked with reload-status. The items are\n\
+    reloaded in the order given, and each item's new data is in use before the\n\
+    next item is reloaded, so (for example) item-definitions and item-name-index\n\
+    can be reloaded in the same command.\n\
     Reloading will not affect items that are in use; for example, if an Episode\n\
     3 battle is in progress, it will continue to use the previous map and card\n\
     definitions. Similarly, BB clients are not forced to disconnect or reload\n\
@@ -239,62 +245,55 @@ CommandDefinition c_reload(
     actually received.",
     false,
     +[](CommandArgs& args) {
-      auto types = phosg::split(args.args, ' ');
-      for (const auto& type : types) {
-        if (type == "bb-keys") {
-          args.s->load_bb_private_keys(true);
-        } else if (type == "accounts") {
-          args.s->load_accounts(true);
-        } else if (type == "caches") {
-          args.s->clear_file_caches(true);
-        } else if (type == "patch-files") {
-          args.s->load_patch_indexes(true);
-        } else if (type == "ep3-cards") {
-          args.s->load_ep3_cards(true);
-        } else if (type == "ep3-maps") {
-          args.s->load_ep3_maps(true);
-        } else if (type == "ep3-tournaments") {
-          args.s->load_ep3_tournament_state(true);
-        } else if (type == "functions") {
-          args.s->compile_functions(true);
-        } else if (type == "dol-files") {
-          args.s->load_dol_files(true);
-        } else if (type == "set-tables") {
-          args.s->load_set_data_tables(true);
-        } else if (type == "battle-params") {
-          args.s->load_battle_params(true);
-        } else if (type == "level-tables") {
-          args.s->load_level_tables(true);
-        } else if (type == "text-index") {
-          args.s->load_text_index(true);
-        } else if (type == "word-select") {
-          args.s->load_word_select_table(true);
-        } else if (type == "item-definitions") {
-          args.s->load_item_definitions(true);
-        } else if (type == "item-name-index") {
-          args.s->load_item_name_indexes(true);
-        } else if (type == "drop-tables") {
-          args.s->load_drop_tables(true);
-        } else if (type == "config") {
-          args.s->forward_to_event_thread([s = args.s]() {
-            try {
-              s->load_config_early();
-              s->load_config_late();
-            } catch (const exception& e) {
-              fprintf(stderr, "FAILED: %s\n", e.what());
-              fprintf(stderr, "Some configuration may have been reloaded. Fix the underlying issue and try again.\n");
-            }
-          });
-        } else if (type == "teams") {
-          args.s->load_teams(true);
-        } else if (type == "quests") {
-          args.s->load_quest_index(true);
-        } else {
-          throw runtime_error("invalid data type: " + type);
+      auto job = args.s->reload_jobs->enqueue(phosg::split(args.args, ' '));
+      fprintf(stderr, "Reload job %" PRIu64 " queued\n", job.id);
+    });
+CommandDefinition c_reload_status(
+    "reload-status", "reload-status [JOB-ID]\n\
+    Show the status of a background reload job, or of all recent jobs if no\n\
+    job ID is given.",
+    false,
+    +[](CommandArgs& args) {
+      if (args.args.empty()) {
+        auto jobs = args.s->reload_jobs->get_jobs();
+        if (jobs.empty()) {
+          fprintf(stderr, "No reload jobs\n");
+        }
+        for (const auto& job : jobs) {
+          fprintf(stderr, "%s\n", job.str().c_str());
         }
+      } else {
+        auto job = args.s->reload_jobs->get_job(stoull(args.args, nullptr, 0));
+        fprintf(stderr, "%s\n", job.str().c_str());
+      }
+    });
+CommandDefinition c_reload_cancel(
+    "reload-cancel", "reload-cancel JOB-ID\n\
+    Cancel a background reload job. If the job is in progress, it stops after\n\
+    the item currently being reloaded; items already reloaded are not reverted.",
+    false,
+    +[](CommandArgs& args) {
+      uint64_t job_id = stoull(args.args, nullptr, 0);
+      if (!args.s->reload_jobs->cancel(job_id)) {
+        throw runtime_error("job does not exist or is already finished");
       }
+      fprintf(stderr, "Reload job %" PRIu64 " canceled\n", job_id);
     });
 
+CommandDefinition c_move_accounts(
+    "move-accounts", "move-accounts\n\
+    Move all accounts to the storage chosen by the UseAccountLog option in the\n\
+    current configuration (run `reload config` first if it was changed). Every\n\
+    account is rewritten, so with many accounts the server may not respond to\n\
+    clients for a while.",
+    true,
+    +[](CommandArgs& args) {
+      if (!args.s->move_accounts_to_configured_storage()) {
+        fprintf(stderr, "Accounts are already in the configured storage\n");
+      } else {
+        fprintf(stderr, "Accounts moved\n");
+      }
+    });
 CommandDefinition c_list_accounts(
     "list-accounts", "list-accounts\n\
     List all accounts registered on the server.",
@@ -13,6 +13,7 @@
 #include "IPStackSimulator.hh"
 #include "Loggers.hh"
 #include "NetworkAddresses.hh"
+#include "PSOEncryption.hh"
 #include "SendCommands.hh"
 #include "Text.hh"
 #include "TextIndex.hh"
@@ -173,16 +174,27 @@ vector<shared_ptr<Lobby>> ServerState::all_lobbies() {
   return ret;
 }
 
-shared_ptr<Lobby> ServerState::create_lobby(bool is_game) {
+shared_ptr<Lobby> ServerState::create_lobby(bool is_game, bool publish) {
   while (this->id_to_lobby.count(this->next_lobby_id)) {
     this->next_lobby_id++;
   }
   auto l = make_shared<Lobby>(this->shared_from_this(), this->next_lobby_id++, is_game);
-  this->id_to_lobby.emplace(l->lobby_id, l);
+  if (publish) {
+    this->id_to_lobby.emplace(l->lobby_id, l);
+  }
   l->idle_timeout_usecs = this->persistent_game_idle_timeout_usecs;
   return l;
 }
 
+void ServerState::publish_lobby(shared_ptr<Lobby> l) {
+  // Another lobby could only have taken this ID while this one was
+  // unpublished if the lobby ID counter wrapped around
+  if (this->id_to_lobby.count(l->lobby_id)) {
+    throw runtime_error("lobby ID is already in use");
+  }
+  this->id_to_lobby.emplace(l->lobby_id, l);
+}
+
 void ServerState::remove_lobby(shared_ptr<Lobby> l) {
   auto lobby_it = this->id_to_lobby.find(l->lobby_id);
   if (lobby_it == this->id_to_lobby.end()) {
@@ -456,6 +468,66 @@ ItemData ServerState::parse_item_description(Version version, const string& desc
   return this->item_name_index(version)->parse_item_description(description);
 }
 
+shared_ptr<ItemCreator> ServerState::create_item_creator(
+    Version base_version,
+    Episode episode,
+    GameMode mode,
+    uint8_t difficulty,
+    uint8_t section_id,
+    shared_ptr<PSOLFGEncryption> opt_rand_crypt,
+    shared_ptr<const BattleRules> restrictions) const {
+  shared_ptr<const RareItemSet> rare_item_set;
+  shared_ptr<const CommonItemSet> common_item_set;
+  switch (base_version) {
+    case Version::PC_PATCH:
+    case Version::BB_PATCH:
+    case Version::GC_EP3_NTE:
+    case Version::GC_EP3:
+      throw runtime_error("cannot create item creator for this base version");
+    case Version::DC_NTE:
+    case Version::DC_V1_11_2000_PROTOTYPE:
+    case Version::DC_V1:
+      // TODO: We should probably have a v1 common item set at some point too
+      common_item_set = this->common_item_set_v2;
+      rare_item_set = this->rare_item_sets.at("rare-table-v1");
+      break;
+    case Version::DC_V2:
+    case Version::PC_NTE:
+    case Version::PC_V2:
+      common_item_set = this->common_item_set_v2;
+      rare_item_set = this->rare_item_sets.at("rare-table-v2");
+      break;
+    case Version::GC_NTE:
+    case Version::GC_V3:
+    case Version::XB_V3:
+      common_item_set = this->common_item_set_v3_v4;
+      rare_item_set = this->rare_item_sets.at("rare-table-v3");
+      break;
+    case Version::BB_V4:
+      common_item_set = this->common_item_set_v3_v4;
+      rare_item_set = this->rare_item_sets.at("rare-table-v4");
+      break;
+    default:
+      throw logic_error("invalid lobby base version");
+  }
+  return make_shared<ItemCreator>(
+      common_item_set,
+      rare_item_set,
+      this->armor_random_set,
+      this->tool_random_set,
+      this->weapon_random_sets.at(difficulty),
+      this->tekker_adjustment_set,
+      this->item_parameter_table(base_version),
+      this->item_stack_limits(base_version),
+      episode,
+      // Solo mode uses the same drop tables as normal mode
+      (mode == GameMode::SOLO) ? GameMode::NORMAL : mode,
+      difficulty,
+      section_id,
+      opt_rand_crypt,
+      restrictions);
+}
+
 void ServerState::set_port_configuration(const vector<PortConfiguration>& port_configs) {
   this->name_to_port_config.clear();
   this->number_to_port_config.clear();
@@ -562,6 +634,40 @@ shared_ptr<const string> ServerState::load_map_file_uncached(Version version, co
   return nullptr;
 }
 
+shared_ptr<const string> ServerState::load_snapshot_data(
+    const string& key, function<string()>&& generate) const {
+  if (this->data_snapshot) {
+    auto ret = this->data_snapshot->get(key);
+    if (ret) {
+      return ret;
+    }
+  }
+  auto ret = make_shared<string>(generate());
+  if (this->data_snapshot_builder) {
+    this->data_snapshot_builder->set(key, ret);
+  }
+  return ret;
+}
+
+uint64_t ServerState::compute_data_snapshot_fingerprint() const {
+  // The item stack limits affect the item name indexes, which are used when
+  // parsing JSON rare item tables, so they must be part of the fingerprint
+  string extra_data;
+  try {
+    extra_data = this->config_json->at("ItemStackLimits").serialize();
+  } catch (const out_of_range&) {
+  }
+  return DataSnapshot::compute_source_fingerprint({
+                                                      "system/blueburst",
+                                                      "system/item-tables",
+                                                      "system/level-tables",
+                                                      "system/patch-bb",
+                                                      "system/patch-pc",
+                                                      "system/text-sets",
+                                                  },
+      extra_data);
+}
+
 pair<string, uint16_t> ServerState::parse_port_spec(const phosg::JSON& json) const {
   if (json.is_list()) {
     string addr = json.at(0).as_string();
@@ -688,6 +794,7 @@ void ServerState::load_config_early() {
       }
     } catch (const out_of_range&) {
     }
+    this->http_state_snapshot_interval_usecs = this->config_json->get_int("HTTPStateSnapshotInterval", 1000000);
 
     this->one_time_config_loaded = true;
   }
@@ -738,9 +845,27 @@ void ServerState::load_config_early() {
   this->patch_client_idle_timeout_usecs = this->config_json->get_int("PatchClientIdleTimeout", 300000000);
 
   this->ip_stack_debug = this->config_json->get_bool("IPStackDebug", false);
+  this->ip_stack_verify_local_checksums = this->config_json->get_bool("IPStackVerifyLocalChecksums", true);
   this->allow_unregistered_users = this->config_json->get_bool("AllowUnregisteredUsers", false);
   this->allow_pc_nte = this->config_json->get_bool("AllowPCNTE", false);
   this->use_temp_accounts_for_prototypes = this->config_json->get_bool("UseTemporaryAccountsForPrototypes", true);
+  this->num_startup_threads = this->config_json->get_int("StartupThreads", 0);
+  this->num_game_creation_threads = this->config_json->get_int("GameCreationThreads", 1);
+  this->num_proxy_capture_threads = this->config_json->get_int("ProxyCaptureThreads", 1);
+  // Once the accounts are loaded, changing the storage requires rewriting all
+  // of them, which is too slow to do during a config reload; instead, this is
+  // done by move_accounts_to_configured_storage (the move-accounts command)
+  bool use_account_log = this->config_json->get_bool("UseAccountLog", false);
+  if (!this->account_index) {
+    if (!use_account_log) {
+      this->account_log_store.reset();
+    } else if (!this->account_log_store) {
+      this->account_log_store = make_shared<AccountLogStore>("system/licenses.log");
+    }
+  } else if (use_account_log != static_cast<bool>(this->account_log_store)) {
+    config_log.warning("UseAccountLog has changed; accounts will remain in %s until the server is restarted or move-accounts is run in the shell",
+        this->account_log_store ? this->account_log_store->get_filename().c_str() : "system/licenses");
+  }
   this->notify_server_for_max_level_achieved = this->config_json->get_bool("NotifyServerForMaxLevelAchieved", false);
   this->allowed_drop_modes_v1_v2_normal = this->config_json->get_int("AllowedDropModesV1V2Normal", 0x1F);
   this->allowed_drop_modes_v1_v2_battle = this->config_json->get_int("AllowedDropModesV1V2Battle", 0x07);
@@ -805,6 +930,7 @@ void ServerState::load_config_early() {
   this->cheat_mode_behavior = parse_behavior_switch("CheatModeBehavior", BehaviorSwitch::OFF_BY_DEFAULT);
   this->default_switch_assist_enabled = this->config_json->get_bool("EnableSwitchAssistByDefault", false);
   this->use_game_creator_section_id = this->config_json->get_bool("UseGameCreatorSectionID", false);
+  this->lazy_map_loading = this->config_json->get_bool("LazyMapLoading", false);
   this->rare_notifs_enabled_for_client_drops = this->config_json->get_bool("RareNotificationsEnabledForClientDrops", false);
   this->default_rare_notifs_enabled_v1_v2 = this->config_json->get_bool("RareNotificationsEnabledByDefault", false);
   this->default_rare_notifs_enabled_v3_v4 = this->default_rare_notifs_enabled_v1_v2;
@@ -851,6 +977,7 @@ void ServerState::load_config_early() {
   this->ep3_behavior_flags = this->config_json->get_int("Episode3BehaviorFlags", 0);
   this->ep3_card_auction_points = this->config_json->get_int("CardAuctionPoints", 0);
   this->hide_download_commands = this->config_json->get_bool("HideDownloadCommands", true);
+  this->quest_file_chunks_in_flight = max<size_t>(this->config_json->get_int("QuestFileChunksInFlight", 4), 1);
   this->proxy_allow_save_files = this->config_json->get_bool("ProxyAllowSaveFiles", true);
   this->proxy_enable_login_options = this->config_json->get_bool("ProxyEnableLoginOptions", false);
 
@@ -1370,6 +1497,24 @@ void ServerState::load_config_late() {
   }
 }
 
+void ServerState::load_data_snapshot() {
+  this->data_snapshot.reset();
+  if (!phosg::isfile(DATA_SNAPSHOT_FILENAME)) {
+    return;
+  }
+  try {
+    auto snapshot = make_shared<DataSnapshot>(DATA_SNAPSHOT_FILENAME);
+    if (snapshot->get_source_fingerprint() != this->compute_data_snapshot_fingerprint()) {
+      config_log.warning("Data snapshot is out of date; ignoring it (run `newserv build-data-snapshot` to rebuild it)");
+    } else {
+      config_log.info("Using data snapshot with %zu entries", snapshot->size());
+      this->data_snapshot = std::move(snapshot);
+    }
+  } catch (const exception& e) {
+    config_log.warning("Cannot load data snapshot: %s", e.what());
+  }
+}
+
 void ServerState::load_bb_private_keys(bool from_non_event_thread) {
   vector<shared_ptr<const PSOBBEncryption::KeyFile>> new_keys;
   for (const string& filename : phosg::list_directory("system/blueburst/keys")) {
@@ -1411,7 +1556,7 @@ void ServerState::load_bb_system_defaults(bool from_non_event_thread) {
 
 void ServerState::load_accounts(bool from_non_event_thread) {
   config_log.info("Indexing accounts");
-  shared_ptr<AccountIndex> new_index = make_shared<AccountIndex>(this->is_replay);
+  shared_ptr<AccountIndex> new_index = make_shared<AccountIndex>(this->is_replay, this->account_log_store);
 
   auto set = [s = this->shared_from_this(), new_index = std::move(new_index)]() {
     s->account_index = std::move(new_index);
@@ -1420,6 +1565,23 @@ void ServerState::load_accounts(bool from_non_event_thread) {
   this->forward_or_call(from_non_event_thread, std::move(set));
 }
 
+bool ServerState::move_accounts_to_configured_storage() {
+  bool use_account_log = this->config_json->get_bool("UseAccountLog", false);
+  if (use_account_log == static_cast<bool>(this->account_log_store)) {
+    return false;
+  }
+  if (use_account_log) {
+    this->account_log_store = make_shared<AccountLogStore>("system/licenses.log");
+  } else {
+    this->account_log_store.reset();
+  }
+  config_log.info("Moving accounts to %s", this->account_log_store ? this->account_log_store->get_filename().c_str() : "system/licenses");
+  if (this->account_index) {
+    this->account_index->set_log_store(this->account_log_store);
+  }
+  return true;
+}
+
 void ServerState::load_teams(bool from_non_event_thread) {
   config_log.info("Indexing teams");
   shared_ptr<TeamIndex> new_index = make_shared<TeamIndex>("system/teams", this->team_reward_defs_json);
@@ -1473,6 +1635,7 @@ void ServerState::clear_file_caches(bool from_non_event_thread) {
     for (auto& cache : s->map_file_caches) {
       cache = make_shared<ThreadSafeFileCache>();
     }
+    s->map_floor_template_cache = make_shared<MapFloorTemplateCache>();
     config_log.info("Clearing BB stream file cache");
     s->bb_stream_files_cache.reset(new FileContentsCache(3600000000ULL));
     config_log.info("Clearing BB system cache");
@@ -1547,9 +1710,18 @@ void ServerState::load_battle_params(bool from_non_event_thread) {
 
 void ServerState::load_level_tables(bool from_non_event_thread) {
   config_log.info("Loading level tables");
-  auto new_table_v1_v2 = make_shared<LevelTableV2>(phosg::load_file("system/level-tables/PlayerTable-pc-v2.prs"), true);
-  auto new_table_v3 = make_shared<LevelTableV3BE>(phosg::load_file("system/level-tables/PlyLevelTbl-gc-v3.cpt"), true);
-  auto new_table_v4 = make_shared<LevelTableV4>(*this->load_bb_file("PlyLevelTbl.prs"), true);
+  auto data_v1_v2 = this->load_snapshot_data("level-table-v1-v2", []() -> string {
+    return prs_decompress(phosg::load_file("system/level-tables/PlayerTable-pc-v2.prs"));
+  });
+  auto data_v3 = this->load_snapshot_data("level-table-v3", []() -> string {
+    return decrypt_and_decompress_pr2_data<true>(phosg::load_file("system/level-tables/PlyLevelTbl-gc-v3.cpt"));
+  });
+  auto data_v4 = this->load_snapshot_data("level-table-v4", [&]() -> string {
+    return prs_decompress(*this->load_bb_file("PlyLevelTbl.prs"));
+  });
+  auto new_table_v1_v2 = make_shared<LevelTableV2>(*data_v1_v2, false);
+  auto new_table_v3 = make_shared<LevelTableV3BE>(*data_v3, false);
+  auto new_table_v4 = make_shared<LevelTableV4>(*data_v4, false);
 
   auto set = [s = this->shared_from_this(), new_table_v1_v2 = std::move(new_table_v1_v2), new_table_v3 = std::move(new_table_v3), new_table_v4 = std::move(new_table_v4)]() {
     s->level_table_v1_v2 = std::move(new_table_v1_v2);
@@ -1696,6 +1868,21 @@ void ServerState::load_item_name_indexes(bool from_non_event_thread) {
 void ServerState::load_drop_tables(bool from_non_event_thread) {
   config_log.info("Loading rare item sets");
 
+  // JSON rare item tables are slow to parse since every item description must
+  // be resolved via an item name index, so they're stored in data snapshots
+  auto load_json_rare_item_set = [&](const string& basename, const string& path, Version version) -> shared_ptr<RareItemSet> {
+    string key = "rare-item-set-" + basename;
+    auto snapshot_data = this->data_snapshot ? this->data_snapshot->get(key) : nullptr;
+    if (snapshot_data) {
+      return RareItemSet::from_snapshot(*snapshot_data);
+    }
+    auto ret = make_shared<RareItemSet>(phosg::JSON::parse(phosg::load_file(path)), this->item_name_index(version));
+    if (this->data_snapshot_builder) {
+      this->data_snapshot_builder->set(key, make_shared<string>(ret->serialize_snapshot()));
+    }
+    return ret;
+  };
+
   unordered_map<string, shared_ptr<RareItemSet>> new_rare_item_sets;
   for (const auto& filename : phosg::list_directory_sorted("system/item-tables")) {
     if (!phosg::starts_with(filename, "rare-table-")) {
@@ -1708,16 +1895,16 @@ void ServerState::load_drop_tables(bool from_non_event_thread) {
 
     if (phosg::ends_with(filename, "-v1.json")) {
       config_log.info("Loading v1 JSON rare item table %s", filename.c_str());
-      new_rare_item_sets.emplace(basename, make_shared<RareItemSet>(phosg::JSON::parse(phosg::load_file(path)), this->item_name_index(Version::DC_V1)));
+      new_rare_item_sets.emplace(basename, load_json_rare_item_set(basename, path, Version::DC_V1));
     } else if (phosg::ends_with(filename, "-v2.json")) {
       config_log.info("Loading v2 JSON rare item table %s", filename.c_str());
-      new_rare_item_sets.emplace(basename, make_shared<RareItemSet>(phosg::JSON::parse(phosg::load_file(path)), this->item_name_index(Version::PC_V2)));
+      new_rare_item_sets.emplace(basename, load_json_rare_item_set(basename, path, Version::PC_V2));
     } else if (phosg::ends_with(filename, "-v3.json")) {
       config_log.info("Loading v3 JSON rare item table %s", filename.c_str());
-      new_rare_item_sets.emplace(basename, make_shared<RareItemSet>(phosg::JSON::parse(phosg::load_file(path)), this->item_name_index(Version::GC_V3)));
+      new_rare_item_sets.emplace(basename, load_json_rare_item_set(basename, path, Version::GC_V3));
     } else if (phosg::ends_with(filename, "-v4.json")) {
       config_log.info("Loading v4 JSON rare item table %s", filename.c_str());
-      new_rare_item_sets.emplace(basename, make_shared<RareItemSet>(phosg::JSON::parse(phosg::load_file(path)), this->item_name_index(Version::BB_V4)));
+      new_rare_item_sets.emplace(basename, load_json_rare_item_set(basename, path, Version::BB_V4));
 
     } else if (phosg::ends_with(filename, ".afs")) {
       config_log.info("Loading AFS rare item table %s", filename.c_str());
@@ -1808,13 +1995,17 @@ void ServerState::load_item_definitions(bool from_non_event_thread) {
     Version v = static_cast<Version>(v_s);
     string path = phosg::string_printf("system/item-tables/ItemPMT-%s.prs", file_path_token_for_version(v));
     config_log.info("Loading item definition table %s", path.c_str());
-    auto data = make_shared<string>(prs_decompress(phosg::load_file(path)));
+    auto data = this->load_snapshot_data("item-parameter-table-" + string(file_path_token_for_version(v)), [&]() -> string {
+      return prs_decompress(phosg::load_file(path));
+    });
     new_item_parameter_tables[v_s] = make_shared<ItemParameterTable>(data, v);
   }
 
   // TODO: We should probably load the tables for other versions too.
   config_log.info("Loading mag evolution table");
-  auto mag_data = make_shared<string>(prs_decompress(phosg::load_file("system/item-tables/ItemMagEdit-bb-v4.prs")));
+  auto mag_data = this->load_snapshot_data("mag-evolution-table-v4", []() -> string {
+    return prs_decompress(phosg::load_file("system/item-tables/ItemMagEdit-bb-v4.prs"));
+  });
   auto new_mag_evolution_table = make_shared<MagEvolutionTable>(mag_data);
 
   auto set = [s = this->shared_from_this(),
@@ -1883,9 +2074,9 @@ void ServerState::load_ep3_tournament_state(bool from_non_event_thread) {
 
 void ServerState::load_quest_index(bool from_non_event_thread) {
   config_log.info("Collecting quests");
-  auto new_default_quest_index = make_shared<QuestIndex>("system/quests", this->quest_category_index, false);
+  auto new_default_quest_index = make_shared<QuestIndex>("system/quests", this->quest_category_index, false, this->num_startup_threads);
   config_log.info("Collecting Episode 3 download quests");
-  auto new_ep3_download_quest_index = make_shared<QuestIndex>("system/ep3/maps-download", this->quest_category_index, true);
+  auto new_ep3_download_quest_index = make_shared<QuestIndex>("system/ep3/maps-download", this->quest_category_index, true, this->num_startup_threads);
 
   auto set = [s = this->shared_from_this(),
                  new_default_quest_index = std::move(new_default_quest_index),
@@ -1964,28 +2155,60 @@ void ServerState::create_default_lobbies() {
 void ServerState::load_all() {
   this->collect_network_addresses();
   this->load_config_early();
-  this->load_bb_private_keys(false);
-  this->load_bb_system_defaults(false);
-  this->load_accounts(false);
+  this->load_data_snapshot();
+  // The file caches are used by many stages (e.g. everything that calls
+  // load_bb_file or load_map_file), so they're replaced before any stage runs
+  // rather than in a stage of their own
   this->clear_file_caches(false);
-  this->load_patch_indexes(false);
-  this->load_ep3_cards(false);
-  this->load_ep3_maps(false);
-  this->load_ep3_tournament_state(false);
-  this->compile_functions(false);
-  this->load_dol_files(false);
-  this->create_default_lobbies();
-  this->load_set_data_tables(false);
-  this->load_battle_params(false);
-  this->load_level_tables(false);
-  this->load_text_index(false);
-  this->load_word_select_table(false);
-  this->load_item_definitions(false);
-  this->load_item_name_indexes(false);
-  this->load_drop_tables(false);
-  this->load_config_late();
-  this->load_teams(false);
-  this->load_quest_index(false);
+
+  // The event loop isn't running yet during load_all, so all stages commit
+  // their results directly (from_non_event_thread is false), on whichever
+  // thread they run on. Each stage only writes fields that no stage it isn't
+  // ordered with reads or writes; fields set before the graph runs (like the
+  // config and the file caches above) may be read by any stage. Stages that
+  // work with lobbies run on this thread. Stages must be added in an order
+  // that is valid for sequential loading, since that's what happens if
+  // StartupThreads is 1.
+  TaskGraph g;
+  g.add("bb-keys", {}, [this]() { this->load_bb_private_keys(false); });
+  g.add("bb-system-defaults", {}, [this]() { this->load_bb_system_defaults(false); });
+  g.add("accounts", {}, [this]() { this->load_accounts(false); });
+  g.add("patch-files", {}, [this]() { this->load_patch_indexes(false); });
+  g.add("ep3-cards", {}, [this]() { this->load_ep3_cards(false); });
+  g.add("ep3-maps", {}, [this]() { this->load_ep3_maps(false); });
+  g.add("ep3-tournaments", {"ep3-cards", "ep3-maps"}, [this]() { this->load_ep3_tournament_state(false); });
+  g.add("functions", {}, [this]() { this->compile_functions(false); });
+  g.add("dol-files", {}, [this]() { this->load_dol_files(false); });
+  g.add("default-lobbies", {}, [this]() { this->create_default_lobbies(); }, true);
+  g.add("set-tables", {"patch-files"}, [this]() { this->load_set_data_tables(false); });
+  g.add("battle-params", {"patch-files"}, [this]() { this->load_battle_params(false); });
+  g.add("level-tables", {"patch-files"}, [this]() { this->load_level_tables(false); });
+  g.add("text-index", {"patch-files"}, [this]() { this->load_text_index(false); });
+  g.add("word-select", {"text-index"}, [this]() { this->load_word_select_table(false); });
+  g.add("item-definitions", {}, [this]() { this->load_item_definitions(false); });
+  g.add("item-name-index", {"item-definitions", "text-index"}, [this]() { this->load_item_name_indexes(false); });
+  g.add("drop-tables", {"item-name-index"}, [this]() { this->load_drop_tables(false); });
+  g.add("config-late", {"default-lobbies", "ep3-cards", "item-name-index"}, [this]() { this->load_config_late(); }, true);
+  g.add("teams", {}, [this]() { this->load_teams(false); });
+  g.add("quests", {}, [this]() { this->load_quest_index(false); });
+
+  unique_ptr<WorkerPool> pool;
+  if (this->num_startup_threads != 1) {
+    pool = make_unique<WorkerPool>(this->num_startup_threads);
+    config_log.info("Loading server data using %zu threads", pool->num_threads());
+  }
+  uint64_t start_usecs = phosg::now();
+  auto timings = g.run(pool.get());
+  uint64_t total_usecs = phosg::now() - start_usecs;
+  // Reloads after startup always use the source files, since the snapshot
+  // would be out of date if the reload was prompted by a change to them
+  this->data_snapshot.reset();
+
+  for (const auto& timing : timings) {
+    config_log.info("Startup stage %s: started at +%" PRIu64 "ms; took %" PRIu64 "ms",
+        timing.name.c_str(), timing.start_usecs / 1000, timing.duration_usecs / 1000);
+  }
+  config_log.info("All server data loaded in %" PRIu64 "ms", total_usecs / 1000);
 }
 
 shared_ptr<PatchServer::Config> ServerState::generate_patch_server_config(bool is_bb) const {
@@ -15,6 +15,7 @@
 #include "Client.hh"
 #include "CommonItemSet.hh"
 #include "DNSServer.hh"
+#include "DataSnapshot.hh"
 #include "Episode3/DataIndexes.hh"
 #include "Episode3/Tournament.hh"
 #include "EventUtils.hh"
@@ -29,8 +30,10 @@
 #include "PatchServer.hh"
 #include "PlayerFilesManager.hh"
 #include "Quest.hh"
+#include "ReloadJobs.hh"
 #include "TeamIndex.hh"
 #include "WordSelectTable.hh"
+#include "WorkerPool.hh"
 
 // Forward declarations due to reference cycles
 class ProxyServer;
@@ -85,13 +88,18 @@ struct ServerState : public std::enable_shared_from_this<ServerState> {
   std::vector<std::string> ppp_stack_addresses;
   std::vector<std::string> ppp_raw_addresses;
   std::vector<std::string> http_addresses;
+  uint64_t http_state_snapshot_interval_usecs = 1000000; // 0 = always generate on request
   uint64_t client_ping_interval_usecs = 30000000;
   uint64_t client_idle_timeout_usecs = 60000000;
   uint64_t patch_client_idle_timeout_usecs = 300000000;
   bool ip_stack_debug = false;
+  bool ip_stack_verify_local_checksums = true;
   bool allow_unregistered_users = false;
   bool allow_pc_nte = false;
   bool use_temp_accounts_for_prototypes = true;
+  size_t num_startup_threads = 0; // 0 = one per CPU core
+  size_t num_game_creation_threads = 1; // 0 = create games on the event thread
+  size_t num_proxy_capture_threads = 1; // 0 = save captured files on the event thread
   bool allow_dc_pc_games = true;
   bool allow_gc_xb_games = true;
   bool enable_chat_commands = true;
@@ -130,10 +138,12 @@ struct ServerState : public std::enable_shared_from_this<ServerState> {
   bool ep3_jukebox_is_free = false;
   uint32_t ep3_behavior_flags = 0;
   bool hide_download_commands = true;
+  size_t quest_file_chunks_in_flight = 4;
   RunShellBehavior run_shell_behavior = RunShellBehavior::DEFAULT;
   BehaviorSwitch cheat_mode_behavior = BehaviorSwitch::OFF_BY_DEFAULT;
   bool default_switch_assist_enabled = false;
   bool use_game_creator_section_id = false;
+  bool lazy_map_loading = false;
   bool rare_notifs_enabled_for_client_drops = false;
   bool default_rare_notifs_enabled_v1_v2 = false;
   bool default_rare_notifs_enabled_v3_v4 = false;
@@ -147,10 +157,20 @@ struct ServerState : public std::enable_shared_from_this<ServerState> {
   std::vector<std::shared_ptr<const PSOBBEncryption::KeyFile>> bb_private_keys;
   std::shared_ptr<const parray<uint8_t, 0x16C>> bb_default_keyboard_config;
   std::shared_ptr<const parray<uint8_t, 0x38>> bb_default_joystick_config;
+  static constexpr const char* DATA_SNAPSHOT_FILENAME = "system/data-snapshot.bin";
+  // data_snapshot is only set during load_all, and only if the snapshot file
+  // exists and is up to date; the loaders that support it (level tables, item
+  // parameter tables, mag evolution table, and rare item sets) use its contents
+  // instead of parsing the source files. If data_snapshot_builder is not null,
+  // those loaders record the data they generate there (this is used by the
+  // build-data-snapshot action).
+  std::shared_ptr<const DataSnapshot> data_snapshot;
+  std::shared_ptr<DataSnapshot> data_snapshot_builder;
   std::shared_ptr<const FunctionCodeIndex> function_code_index;
   std::shared_ptr<const PatchFileIndex> pc_patch_file_index;
   std::shared_ptr<const PatchFileIndex> bb_patch_file_index;
   std::array<std::shared_ptr<ThreadSafeFileCache>, NUM_VERSIONS> map_file_caches;
+  std::shared_ptr<MapFloorTemplateCache> map_floor_template_cache;
   std::shared_ptr<FileContentsCache> bb_stream_files_cache;
   std::shared_ptr<FileContentsCache> bb_system_cache;
   std::shared_ptr<FileContentsCache> gba_files_cache;
@@ -231,6 +251,7 @@ struct ServerState : public std::enable_shared_from_this<ServerState> {
   };
   std::vector<Ep3LobbyBannerEntry> ep3_lobby_banners;
 
+  std::shared_ptr<AccountLogStore> account_log_store; // Null if accounts are stored as JSON files
   std::shared_ptr<AccountIndex> account_index;
   std::shared_ptr<IPV4RangeSet> banned_ipv4_ranges;
   std::shared_ptr<TeamIndex> team_index;
@@ -279,6 +300,14 @@ struct ServerState : public std::enable_shared_from_this<ServerState> {
   std::shared_ptr<PatchServer> pc_patch_server;
   std::shared_ptr<PatchServer> bb_patch_server;
   std::shared_ptr<HTTPServer> http_server;
+  std::shared_ptr<ReloadJobManager> reload_jobs;
+  // Generates maps for new games (see create_game_generic_async); null if
+  // games should be created synchronously
+  std::shared_ptr<WorkerPool> game_creation_pool;
+  // Saves files captured by the proxy (see
+  // ProxyServer::LinkedSession::run_capture_job); null if they should be saved
+  // synchronously
+  std::shared_ptr<WorkerPool> proxy_capture_pool;
 
   explicit ServerState(const std::string& config_filename = "");
   ServerState(std::shared_ptr<struct event_base> base, const std::string& config_filename, bool is_replay);
@@ -301,7 +330,10 @@ struct ServerState : public std::enable_shared_from_this<ServerState> {
   std::shared_ptr<Lobby> find_lobby(uint32_t lobby_id);
   std::vector<std::shared_ptr<Lobby>> all_lobbies();
 
-  std::shared_ptr<Lobby> create_lobby(bool is_game);
+  // If publish is false, the lobby is assigned an ID but can't be found or
+  // joined until publish_lobby is called
+  std::shared_ptr<Lobby> create_lobby(bool is_game, bool publish = true);
+  void publish_lobby(std::shared_ptr<Lobby> l);
   void remove_lobby(std::shared_ptr<Lobby> l);
   void on_player_left_lobby(std::shared_ptr<Lobby> l, uint8_t leaving_client_id);
 
@@ -326,6 +358,15 @@ struct ServerState : public std::enable_shared_from_this<ServerState> {
   std::shared_ptr<const ItemNameIndex> item_name_index(Version version) const; // Throws if missing
   std::string describe_item(Version version, const ItemData& item, bool include_color_codes) const;
   ItemData parse_item_description(Version version, const std::string& description) const;
+  // Creates an ItemCreator that uses the drop tables for the given version
+  std::shared_ptr<ItemCreator> create_item_creator(
+      Version base_version,
+      Episode episode,
+      GameMode mode,
+      uint8_t difficulty,
+      uint8_t section_id,
+      std::shared_ptr<PSOLFGEncryption> opt_rand_crypt,
+      std::shared_ptr<const BattleRules> restrictions = nullptr) const;
 
   const std::vector<uint32_t>& public_lobby_search_order(Version version, bool is_client_customization) const;
   inline const std::vector<uint32_t>& public_lobby_search_order(std::shared_ptr<const Client> c) const {
@@ -355,6 +396,11 @@ struct ServerState : public std::enable_shared_from_this<ServerState> {
       const std::string& bb_directory_filename = "") const;
   std::shared_ptr<const std::string> load_map_file(Version version, const std::string& filename) const;
   std::shared_ptr<const std::string> load_map_file_uncached(Version version, const std::string& filename) const;
+  // Returns the snapshot entry for key if there is one; otherwise, calls
+  // generate and returns its result (and records it in data_snapshot_builder)
+  std::shared_ptr<const std::string> load_snapshot_data(
+      const std::string& key, std::function<std::string()>&& generate) const;
+  uint64_t compute_data_snapshot_fingerprint() const;
 
   std::pair<std::string, uint16_t> parse_port_spec(const phosg::JSON& json) const;
   std::vector<PortConfiguration> parse_port_configuration(const phosg::JSON& json) const;
@@ -384,9 +430,14 @@ struct ServerState : public std::enable_shared_from_this<ServerState> {
   void collect_network_addresses();
   void load_config_early();
   void load_config_late();
+  void load_data_snapshot();
   void load_bb_private_keys(bool from_non_event_thread);
   void load_bb_system_defaults(bool from_non_event_thread);
   void load_accounts(bool from_non_event_thread);
+  // Switches the loaded accounts to the storage given by UseAccountLog in the
+  // current config, rewriting all of them there. Returns false if they already
+  // use that storage. This must be called on the event thread.
+  bool move_accounts_to_configured_storage();
   void load_teams(bool from_non_event_thread);
   void load_patch_indexes(bool from_non_event_thread);
   void clear_file_caches(bool from_non_event_thread);
@@ -28,6 +28,8 @@ TextTranscoder::~TextTranscoder() {
 
 TextTranscoder::Result TextTranscoder::operator()(
     void* dest, size_t dest_bytes, const void* src, size_t src_bytes, bool truncate_oversize_result) {
+  lock_guard g(this->lock);
+
   // Clear any conversion state left over from the previous call
   iconv(this->ic, nullptr, nullptr, nullptr, nullptr);
 
@@ -84,6 +86,8 @@ TextTranscoder::Result TextTranscoder::operator()(
 }
 
 string TextTranscoder::operator()(const void* src, size_t src_bytes) {
+  lock_guard g(this->lock);
+
   // Clear any conversion state left over from the previous call
   iconv(this->ic, nullptr, nullptr, nullptr, nullptr);
 
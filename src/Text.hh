@@ -6,6 +6,7 @@
 #include <string.h>
 
 #include <initializer_list>
+#include <mutex>
 #include <phosg/Encoding.hh>
 #include <phosg/Strings.hh>
 #include <stdexcept>
@@ -50,6 +51,10 @@ protected:
 
   static const iconv_t INVALID_IC;
   static const size_t FAILURE_RESULT;
+  // iconv_t objects have internal state, so they can't be used by multiple
+  // threads at once (the global transcoders are used by loaders running on
+  // worker threads during startup, for example)
+  std::mutex lock;
   iconv_t ic;
 };
 
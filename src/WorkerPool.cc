@@ -0,0 +1,173 @@
+#include "WorkerPool.hh"
+
+#include <algorithm>
+#include <exception>
+#include <phosg/Time.hh>
+#include <stdexcept>
+
+using namespace std;
+
+WorkerPool::WorkerPool(size_t num_threads) {
+  if (num_threads == 0) {
+    num_threads = max<size_t>(thread::hardware_concurrency(), 1);
+  }
+  while (this->threads.size() < num_threads) {
+    this->threads.emplace_back(&WorkerPool::thread_fn, this);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    lock_guard g(this->lock);
+    this->should_exit = true;
+  }
+  this->cv.notify_all();
+  for (auto& th : this->threads) {
+    th.join();
+  }
+}
+
+void WorkerPool::enqueue(function<void()>&& fn) {
+  {
+    lock_guard g(this->lock);
+    this->queue.emplace_back(std::move(fn));
+  }
+  this->cv.notify_one();
+}
+
+void WorkerPool::thread_fn() {
+  for (;;) {
+    function<void()> fn;
+    {
+      unique_lock g(this->lock);
+      this->cv.wait(g, [&]() -> bool { return this->should_exit || !this->queue.empty(); });
+      if (this->queue.empty()) {
+        return; // should_exit must be true
+      }
+      fn = std::move(this->queue.front());
+      this->queue.pop_front();
+    }
+    fn();
+  }
+}
+
+void TaskGraph::add(
+    const string& name,
+    const vector<string>& dependencies,
+    function<void()>&& fn,
+    bool run_on_calling_thread) {
+  size_t index = this->tasks.size();
+  if (!this->name_to_index.emplace(name, index).second) {
+    throw logic_error("duplicate task name: " + name);
+  }
+  auto& t = this->tasks.emplace_back();
+  t.name = name;
+  t.fn = std::move(fn);
+  t.run_on_calling_thread = run_on_calling_thread;
+  t.num_pending_dependencies = dependencies.size();
+  t.timing.name = name;
+  for (const auto& dep_name : dependencies) {
+    try {
+      this->tasks.at(this->name_to_index.at(dep_name)).dependent_indexes.emplace_back(index);
+    } catch (const out_of_range&) {
+      throw logic_error("task " + name + " depends on unknown task " + dep_name);
+    }
+  }
+}
+
+vector<TaskGraph::Timing> TaskGraph::run(WorkerPool* pool) {
+  uint64_t start_usecs = phosg::now();
+  auto run_task = [&](Task& t) -> void {
+    uint64_t task_start_usecs = phosg::now();
+    t.timing.start_usecs = task_start_usecs - start_usecs;
+    t.fn();
+    t.timing.duration_usecs = phosg::now() - task_start_usecs;
+  };
+
+  if (!pool) {
+    for (auto& t : this->tasks) {
+      run_task(t);
+    }
+
+  } else {
+    mutex lock;
+    condition_variable cv;
+    deque<size_t> calling_thread_queue;
+    size_t num_running = 0;
+    exception_ptr first_exc;
+
+    // All of the following functions must be called while holding lock
+    function<void(size_t)> start_task;
+    auto on_task_complete = [&](size_t index, exception_ptr exc) -> void {
+      num_running--;
+      if (exc && !first_exc) {
+        first_exc = exc;
+      }
+      if (!first_exc) {
+        for (size_t dependent_index : this->tasks[index].dependent_indexes) {
+          if (--this->tasks[dependent_index].num_pending_dependencies == 0) {
+            start_task(dependent_index);
+          }
+        }
+      }
+      cv.notify_all();
+    };
+    start_task = [&](size_t index) -> void {
+      num_running++;
+      if (this->tasks[index].run_on_calling_thread) {
+        calling_thread_queue.emplace_back(index);
+        cv.notify_all();
+      } else {
+        pool->enqueue([&, index]() -> void {
+          exception_ptr exc;
+          try {
+            run_task(this->tasks[index]);
+          } catch (...) {
+            exc = current_exception();
+          }
+          lock_guard g(lock);
+          on_task_complete(index, exc);
+        });
+      }
+    };
+
+    unique_lock g(lock);
+    for (size_t z = 0; z < this->tasks.size(); z++) {
+      if (this->tasks[z].num_pending_dependencies == 0) {
+        start_task(z);
+      }
+    }
+    while (num_running > 0) {
+      if (calling_thread_queue.empty()) {
+        cv.wait(g);
+        continue;
+      }
+      size_t index = calling_thread_queue.front();
+      calling_thread_queue.pop_front();
+      exception_ptr exc;
+      if (!first_exc) {
+        g.unlock();
+        try {
+          run_task(this->tasks[index]);
+        } catch (...) {
+          exc = current_exception();
+        }
+        g.lock();
+      }
+      on_task_complete(index, exc);
+    }
+
+    if (first_exc) {
+      rethrow_exception(first_exc);
+    }
+  }
+
+  vector<Timing> ret;
+  for (const auto& t : this->tasks) {
+    ret.emplace_back(t.timing);
+  }
+  sort(ret.begin(), ret.end(), [](const Timing& a, const Timing& b) -> bool {
+    return a.start_usecs < b.start_usecs;
+  });
+  return ret;
+}
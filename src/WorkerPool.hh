@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// A fixed set of threads that run enqueued functions in FIFO order. Exceptions
+// thrown by enqueued functions are not caught; callers should catch them
+// within the function if needed (TaskGraph does this).
+class WorkerPool {
+public:
+  // If num_threads is 0, one thread is created per CPU core
+  explicit WorkerPool(size_t num_threads = 0);
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool(WorkerPool&&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+  WorkerPool& operator=(WorkerPool&&) = delete;
+  // The destructor waits for all enqueued functions to finish
+  ~WorkerPool();
+
+  inline size_t num_threads() const {
+    return this->threads.size();
+  }
+
+  void enqueue(std::function<void()>&& fn);
+
+private:
+  std::mutex lock;
+  std::condition_variable cv;
+  std::deque<std::function<void()>> queue;
+  bool should_exit = false;
+  std::vector<std::thread> threads;
+
+  void thread_fn();
+};
+
+// A set of named tasks, each of which may depend on other tasks. When run, all
+// tasks whose dependencies are complete are run concurrently on a WorkerPool,
+// except for tasks marked as requiring the calling thread, which are run on
+// the thread that called run() (this is used for things that must happen on
+// the event thread). If any task throws, no new tasks are started, and run()
+// rethrows the first exception after all running tasks finish.
+class TaskGraph {
+public:
+  struct Timing {
+    std::string name;
+    uint64_t start_usecs; // Relative to when run() was called
+    uint64_t duration_usecs;
+  };
+
+  TaskGraph() = default;
+  TaskGraph(const TaskGraph&) = delete;
+  TaskGraph(TaskGraph&&) = delete;
+  TaskGraph& operator=(const TaskGraph&) = delete;
+  TaskGraph& operator=(TaskGraph&&) = delete;
+  ~TaskGraph() = default;
+
+  // All dependencies must already have been added.
+  void add(
+      const std::string& name,
+      const std::vector<std::string>& dependencies,
+      std::function<void()>&& fn,
+      bool run_on_calling_thread = false);
+
+  // If pool is null, all tasks are run on the calling thread, in the order
+  // they were added. Returns the timing of each task, in order of start time.
+  std::vector<Timing> run(WorkerPool* pool);
+
+private:
+  struct Task {
+    std::string name;
+    std::function<void()> fn;
+    bool run_on_calling_thread;
+    size_t num_pending_dependencies;
+    std::vector<size_t> dependent_indexes;
+    Timing timing;
+  };
+  std::vector<Task> tasks;
+  std::unordered_map<std::string, size_t> name_to_index;
+};